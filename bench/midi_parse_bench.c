@@ -0,0 +1,380 @@
+/*
+ * midi_parse_bench.c
+ *
+ *  Created on: Aug 7, 2020
+ *      Author: andy
+ *
+ * Host-side microbenchmark for the serial MIDI IN parser.
+ *
+ * This is not part of the firmware (it is excluded from the CCS build). It runs on
+ * the development PC and compares the old parser, which decoded each status byte
+ * with a nested switch and returned one message per call, against the current
+ * table-driven MIDIUART_readMessages().
+ *
+ * Both parsers see the same byte stream through the same receive ring, which we
+ * fill here in place of the UART ISR. Filling the ring costs the same for both.
+ * The old parser is kept out of line, as it was in midi_uart.c, so the compiler
+ * can't fold it into the loop below when it can't do that with the new one.
+ *
+ * Each parser is run BENCH_RUNS times and the fastest run is reported, so a
+ * busy PC upsets the numbers less.
+ *
+ * Build and run from the project root with something like:
+ *
+ *   gcc -O2 -std=gnu99 -Dgcc -DPART_TM4C1294NCPDT -DTARGET_IS_TM4C129_RA2 \
+ *       -I. -Iinc -Idriverlib -Iusblib -Imidi -Imidi_uart -Iusb_midi \
+ *       -o midi_parse_bench bench/midi_parse_bench.c midi_uart/midi_uart.c
+ *   ./midi_parse_bench
+ *
+ * Only the parser is exercised; the functions that touch the UART are never called.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "midi.h"
+#include "midi_uart.h"
+
+/**
+ * How many messages to push through each parser.
+ */
+#define BENCH_MESSAGES 20000000UL
+
+/**
+ * How many times to run each parser.
+ */
+#define BENCH_RUNS 5
+
+/**
+ * The test stream: note on/off, control changes with and without running status,
+ * a program change, a clock and a short SysEx. Repeated over and over.
+ */
+static const uint8_t stream[] =
+{
+    0x90, 0x3C, 0x40,           // note on
+    0x3E, 0x40,                 // running status note on
+    0x80, 0x3C, 0x00,           // note off
+    0xB0, 0x07, 0x64,           // control change
+    0x0A, 0x40,                 // running status control change
+    0x01, 0x20,                 // running status control change
+    0xC0, 0x05,                 // program change
+    0xF8,                       // clock
+    0xE0, 0x00, 0x40,           // pitch bend
+    0xF0, 0x7E, 0x00, 0x06, 0x01, 0xF7  // identity request
+};
+
+/**
+ * Messages the stream above turns into. The SysEx is two packets.
+ */
+#define STREAM_MESSAGES 11
+
+static midiport_t port;
+
+/*
+ * Driverlib calls made by the set-up code in midi_uart.c which are not in the
+ * ROM table. They are never called here, they just have to link.
+ */
+void GPIOPadConfigSet(uint32_t ui32Port, uint8_t ui8Pins, uint32_t ui32Strength, uint32_t ui32PadType)
+{
+    (void) ui32Port;
+    (void) ui8Pins;
+    (void) ui32Strength;
+    (void) ui32PadType;
+}
+
+/*
+ * Likewise the soft UART calls, for soft ports, which the bench doesn't use.
+ */
+bool SoftUARTCharsAvail(tSoftUART *psUART)
+{
+    (void) psUART;
+    return false;
+}
+
+bool SoftUARTSpaceAvail(tSoftUART *psUART)
+{
+    (void) psUART;
+    return false;
+}
+
+int32_t SoftUARTCharGetNonBlocking(tSoftUART *psUART)
+{
+    (void) psUART;
+    return -1;
+}
+
+bool SoftUARTCharPutNonBlocking(tSoftUART *psUART, uint8_t ui8Data)
+{
+    (void) psUART;
+    (void) ui8Data;
+    return false;
+}
+
+/**
+ * Stand-in for the receive ISR. Put as many stream bytes in the ring as will fit.
+ */
+static void fillRing(uint32_t *pos)
+{
+    uint8_t nexthead;
+
+    for (;;)
+    {
+        nexthead = port.rxfifohead + 1;
+        if (MIDI_RX_FIFO_SIZE == nexthead)
+            nexthead = 0;
+        if (nexthead == port.rxfifotail)
+            break;
+        port.rxfifo[port.rxfifohead] = stream[*pos];
+        port.rxfifohead = nexthead;
+        if (++(*pos) == sizeof(stream))
+            *pos = 0;
+    }
+}
+
+/**
+ * The parser as it was before the status table went in, reading from the ring.
+ */
+static __attribute__ ((noinline)) bool oldReadMessage(midiport_t *port, USBMIDI_Message_t *msg)
+{
+    bool done;
+    uint8_t newbyte;
+    uint8_t thistail;
+
+    done = false;
+
+    while (!done && (port->rxfifotail != port->rxfifohead))
+    {
+        newbyte = port->rxfifo[port->rxfifotail];
+        thistail = port->rxfifotail + 1;
+        if (MIDI_RX_FIFO_SIZE == thistail) {
+            thistail = 0;
+        }
+        port->rxfifotail = thistail;
+
+        switch (port->rxstate) {
+            case MU_IDLE :
+                msg->byte2 = 0x00;
+                msg->byte3 = 0x00;
+
+                if (newbyte == MIDI_MSG_SOX) {
+                    msg->byte1 = MIDI_MSG_SOX;
+                    port->rxstate = MU_SYSEX1;
+
+                } else if (newbyte < 0x80) {
+                    msg->byte2 = newbyte;
+                    if (port->bytesinpacket == 2) {
+                        port->rxstate = MU_DATABYTE3;
+                    } else {
+                        port->rxstate = MU_IDLE;
+                        done = true;
+                    }
+
+                } else {
+                    switch (newbyte & 0xF0) {
+                    case MIDI_MSG_NOTEOFF :
+                        port->cin = USB_MIDI_CIN_NOTEOFF;
+                        port->bytesinpacket = 2;
+                        break;
+                    case MIDI_MSG_NOTEON :
+                        port->cin = USB_MIDI_CIN_NOTEON;
+                        port->bytesinpacket = 2;
+                        break;
+                    case MIDI_MSG_POLYPRESSURE :
+                        port->cin = USB_MIDI_CIN_POLYKEYPRESS;
+                        port->bytesinpacket = 2;
+                        break;
+                    case MIDI_MSG_CTRLCHANGE :
+                        port->cin = USB_MIDI_CIN_CTRLCHANGE;
+                        port->bytesinpacket = 2;
+                        break;
+                    case MIDI_MSG_PROGCHANGE :
+                        port->cin = USB_MIDI_CIN_PROGCHANGE;
+                        port->bytesinpacket = 1;
+                        break;
+                    case MIDI_MSG_CHANNELPRESSURE :
+                        port->cin = USB_MIDI_CIN_CHANPRESSURE;
+                        port->bytesinpacket = 1;
+                        break;
+                    case MIDI_MSG_PITCHBEND :
+                        port->cin = USB_MIDI_CIN_PITCHBEND;
+                        port->bytesinpacket = 2;
+                        break;
+                    case MIDI_MSG_SOX :
+                        switch (newbyte) {
+                        case  MIDI_MSG_MTCQF :
+                        case  MIDI_MSG_SS :
+                            port->cin = USB_MIDI_CIN_SYSCOM2;
+                            port->bytesinpacket = 1;
+                            break;
+                        case MIDI_MSG_SPP :
+                            port->cin = USB_MIDI_CIN_SYSCOM3;
+                            port->bytesinpacket = 2;
+                            break;
+                        case MIDI_MSG_F4 :
+                        case MIDI_MSG_F5 :
+                        case MIDI_MSG_TUNEREQ :
+                            port->cin = USB_MIDI_CIN_SYSEND1;
+                            port->bytesinpacket = 0;
+                            break;
+                        default :
+                            port->cin = USB_MIDI_CIN_SINGLEBYTE;
+                            port->bytesinpacket = 0;
+                            break;
+                        }
+                        break;
+                    default:
+                        break;
+                    }
+
+                    if (0 == port->bytesinpacket) {
+                        done = true;
+                        port->rxstate = MU_IDLE;
+                    } else {
+                        port->bytecnt = port->bytesinpacket;
+                        port->rxstate = MU_DATABYTE2;
+                    }
+                    msg->byte1 = newbyte;
+                    msg->header = USB_MIDI_HEADER(port->cablenum, port->cin);
+                }
+                break;
+
+            case MU_DATABYTE2 :
+                msg->byte2 = newbyte;
+                --(port->bytecnt);
+                if (port->bytecnt) {
+                    port->rxstate = MU_DATABYTE3;
+                } else {
+                    port->rxstate = MU_IDLE;
+                    done = true;
+                }
+                break;
+
+            case MU_DATABYTE3 :
+                msg->byte3 = newbyte;
+                done = true;
+                port->rxstate = MU_IDLE;
+                break;
+
+            case MU_SYSEX1 :
+                msg->byte2 = newbyte;
+                if (msg->byte2 == MIDI_MSG_EOX) {
+                    msg->header = USB_MIDI_HEADER(port->cablenum, USB_MIDI_CIN_SYSEND2);
+                    done = true;
+                    port->rxstate = MU_IDLE;
+                } else {
+                    port->rxstate = MU_SYSEX2;
+                }
+                break;
+
+            case MU_SYSEX2 :
+                msg->byte3 = newbyte;
+                if (msg->byte3 == MIDI_MSG_EOX) {
+                    msg->header = USB_MIDI_HEADER(port->cablenum, USB_MIDI_CIN_SYSEND3);
+                    port->rxstate = MU_IDLE;
+                } else {
+                    msg->header = USB_MIDI_HEADER(port->cablenum, USB_MIDI_CIN_SYSEXSTART);
+                    port->rxstate = MU_SYSEX1;
+                }
+                done = true;
+                break;
+
+            default :
+                break;
+        }
+    }
+
+    return done;
+}
+
+/**
+ * Reset the receiver side of the port between runs.
+ */
+static void resetPort(void)
+{
+    port.cablenum = 1;
+    port.cin = 0;
+    port.bytecnt = 0;
+    port.bytesinpacket = 0;
+    port.rxstate = MU_IDLE;
+    port.rxfifohead = 0;
+    port.rxfifotail = 0;
+}
+
+/**
+ * A parser under test: put up to 16 packets in msgs and return how many.
+ */
+typedef uint32_t (*parser_t)(USBMIDI_Message_t *msgs);
+
+static uint32_t switchOne(USBMIDI_Message_t *msgs)
+{
+    return oldReadMessage(&port, msgs);
+}
+
+static uint32_t tableOne(USBMIDI_Message_t *msgs)
+{
+    return MIDIUART_readMessage(&port, msgs);
+}
+
+static uint32_t tableBatch(USBMIDI_Message_t *msgs)
+{
+    return MIDIUART_readMessages(&port, msgs, 16);
+}
+
+/**
+ * Push BENCH_MESSAGES messages through a parser, BENCH_RUNS times, and report the
+ * fastest run. The checksum guards against the compiler throwing the work away,
+ * and lets us see that the parsers all produced the same packets.
+ */
+static void bench(const char *name, parser_t parser)
+{
+    USBMIDI_Message_t msgs[16];
+    uint32_t pos;
+    uint32_t done;
+    uint32_t n;
+    uint32_t i;
+    uint32_t run;
+    uint32_t checksum;
+    clock_t start;
+    double secs;
+    double best;
+
+    best = 0.0;
+    checksum = 0;
+    for (run = 0; run < BENCH_RUNS; run++)
+    {
+        resetPort();
+        pos = 0;
+        done = 0;
+        checksum = 0;
+        start = clock();
+        while (done < BENCH_MESSAGES)
+        {
+            fillRing(&pos);
+            while ((n = parser(msgs)) != 0)
+            {
+                for (i = 0; i < n; i++)
+                    checksum = (checksum * 31) + msgs[i].header + msgs[i].byte1 + msgs[i].byte2 + msgs[i].byte3;
+                done += n;
+            }
+        }
+        secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+        if ((0 == run) || (secs < best))
+            best = secs;
+    }
+
+    printf("%-28s %8.3f s  %12.0f msgs/s  checksum %08x\n",
+           name, best, BENCH_MESSAGES / best, checksum);
+}
+
+int main(void)
+{
+    printf("%lu messages, stream of %u bytes / %u messages, best of %u runs\n",
+           BENCH_MESSAGES, (unsigned) sizeof(stream), STREAM_MESSAGES, BENCH_RUNS);
+
+    bench("switch, one per call", switchOne);
+    bench("table, one per call", tableOne);
+    bench("table, readMessages x16", tableBatch);
+
+    return 0;
+}
@@ -20,7 +20,7 @@
 #include "pconfig.h"
 #include "midi.h"
 #include "midi_uart.h"
-#include "midi_uart7.h"
+#include "midi_ports.h"
 #include "buttons.h"
 
 static volatile uint8_t btnstate;
@@ -0,0 +1,46 @@
+/*
+ * dmactrl.c
+ *
+ *  Created on: Aug 6, 2020
+ *      Author: andy
+ *
+ * Set up the uDMA controller.
+ *
+ * The channel control table must be aligned on a 1024-byte boundary, and how
+ * we ask for that depends on the compiler.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "inc/hw_memmap.h"
+#include "driverlib/rom.h"
+#include "driverlib/rom_map.h"
+#include "driverlib/sysctl.h"
+#include "driverlib/udma.h"
+
+#include "dmactrl.h"
+
+/**
+ * The uDMA channel control table.
+ * There are 32 channels, each with a primary and alternate 16-byte structure.
+ */
+#if defined(ewarm)
+#pragma data_alignment=1024
+static uint8_t pui8DMAControlTable[1024];
+#elif defined(ccs)
+#pragma DATA_ALIGN(pui8DMAControlTable, 1024)
+static uint8_t pui8DMAControlTable[1024];
+#else
+static uint8_t pui8DMAControlTable[1024] __attribute__ ((aligned(1024)));
+#endif
+
+/**
+ * Turn on the uDMA controller and give it the channel control table.
+ */
+void DMA_Init(void)
+{
+    MAP_SysCtlPeripheralEnable(SYSCTL_PERIPH_UDMA);
+    while (!MAP_SysCtlPeripheralReady(SYSCTL_PERIPH_UDMA))
+        ;
+    MAP_uDMAEnable();
+    MAP_uDMAControlBaseSet(pui8DMAControlTable);
+}
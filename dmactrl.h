@@ -0,0 +1,20 @@
+/*
+ * dmactrl.h
+ *
+ *  Created on: Aug 6, 2020
+ *      Author: andy
+ *
+ * The micro has one uDMA controller, shared by every peripheral that uses it.
+ * It needs one channel control table, which lives here.
+ */
+
+#ifndef DMACTRL_H_
+#define DMACTRL_H_
+
+/**
+ * Turn on the uDMA controller and give it the channel control table.
+ * Call this once, before any peripheral sets up a uDMA channel.
+ */
+void DMA_Init(void);
+
+#endif /* DMACTRL_H_ */
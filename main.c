@@ -3,29 +3,42 @@
  *
  * This design has both serial (UART) MIDI and USB MIDI.
  *
- * The USB MIDI has two "cables" or ports in each direction.
+ * The USB MIDI has USBMIDI_NUM_CABLES_OUT/IN "cables" or ports in each direction
+ * (two of each by default, see pconfig.h).
  *
- * Cable 0 IN (from the host) will control the LEDs. (Maybe I can do PWM.)
- * Cable 0 OUT (to the host) sends button presses as control changes.
- * Cable 1 IN drives serial port OUT.
- * Cable 1 OUT gets messages from serial port IN and sends them to the host.
+ * Each cable from the host drives the OUT of the serial port with the same cable
+ * number (MIDI_UARTn_CN in pconfig.h). UART7 is cable 0.
+ * Each cable to the host gets the messages from the IN of the serial port with that
+ * cable number. Cable 1 OUT also sends button presses as notes.
  *
  *************
  * UART MIDI:
  *
  * IN.
- * As bytes come in, they are collected and a USB MIDI message is built. The main loop periodically
- * checks MIDISERIAL_readUSBMessage() and when that returns true, it has a new message which is
- * written back to the USB host.
+ * As bytes come in, the port's ISR puts them in its receive ring. The main loop (MIDI_Rx_Task())
+ * builds USB MIDI messages from each port's bytes, with the port's cable number, and writes them
+ * back to the USB host a batch at a time with USBMIDI_InEpMsgWriteBatch().
  *
  * OUT.
- * MIDI data from USB are written to a message packet FIFO. The main loop pops that FIFO,
- * examines the message and if it is meant for Cable 1 (the serial port), the message bytes
- * and message size are written to MIDISERIAL_SendMessage()
+ * The USB interrupt puts MIDI data from USB on a message queue for each cable. The main loop
+ * (MIDI_USB_Rx_Task()) takes each cable's messages and writes them to the serial port with that
+ * cable number with MIDIUART_tryWriteEvents(), which copies each message's bytes to the port's
+ * transmit FIFO. A port that is full leaves its cable's messages queued. Once the cable's queue
+ * is full, the USB interrupt holds back that cable's messages and NAKs the host until there is
+ * room, so nothing from the host is dropped.
  *
  *************
  * USB MIDI.
  *
+ *************
+ * Console.
+ *
+ * With USBMIDI_CDC in pconfig.h, CONSOLE_printf() goes to a CDC-ACM serial port on our
+ * own USB device (usb_midi/usbcdc_console.h). Else, and in host mode, it is UARTprintf() on UART0.
+ * With USBMIDI_REMOTE_WAKEUP, it reports how long the host took to wake up for DIN input.
+ *
+ * The SysTick counts milliseconds in g_ui32SysTickCount, which times the wakeup.
+ *
  */
 
 #include <stdint.h>
@@ -48,19 +61,25 @@
 #include "driverlib/pin_map.h"
 #include "usblib/usblib.h"
 #include "usblib/device/usbdevice.h"
+#include "usblib/host/usbhost.h"
 #include "utils/uartstdio.h"
 #include "utils/ustdlib.h"
 #include "pconfig.h"
 #include "pinout.h"
 #include "clcd.h"
 #include "midi_uart.h"
-#include "midi_uart7.h"
+#include "midi_ports.h"
+#include "midi_softports.h"
 #include "buttons.h"
+#include "dmactrl.h"
 #include "qeictrl.h"
 #include "midi_rx_task.h"
 #include "midi_usb_rx_task.h"
+#include "midi_usbh_rx_task.h"
 
 #include "usbmidi.h"
+#include "usbhmidi.h"
+#include "usbcdc_console.h"
 
 
 //*****************************************************************************
@@ -69,9 +88,9 @@
 //
 //*****************************************************************************
 uint32_t g_ui32SysClock;
-uint32_t g_ui32SysTickCount;
+volatile uint32_t g_ui32SysTickCount;
 
-#define SYSTICKS_PER_SECOND 100
+#define SYSTICKS_PER_SECOND 1000
 #define SYSTICK_PERIOD_MS   (1000 / SYSTICKS_PER_SECOND)
 
 void
@@ -81,6 +100,13 @@ SysTickIntHandler(void)
     // Update our system tick counter.
     //
     g_ui32SysTickCount++;
+
+#if USBMIDI_REMOTE_WAKEUP
+    //
+    // End USB remote wakeup signalling when it is due.
+    //
+    USBMIDI_WakeTick();
+#endif
 }
 
 int main(void)
@@ -92,6 +118,11 @@ int main(void)
     uint8_t msg[3];         	// This message is three bytes
     USBMIDI_Message_t txmsg;	// and here it is as a USB MIDI message
     bool wasConnected = false;
+    midiport_t *ctlport;        // the DIN port for the buttons, if there is one
+#if USBMIDI_REMOTE_WAKEUP
+    uint32_t resumeMs;
+    uint32_t firstEventMs;
+#endif
 
     // The SYSCTL_MOSC_HIGHFREQ parameter is used when the crystal
     // frequency is 10MHz or higher.
@@ -137,9 +168,25 @@ int main(void)
     QEI_Setup();
 
     /**
-     * Set up MIDI UART.
+     * Set up the uDMA controller, before anything wants a channel.
+     */
+    DMA_Init();
+
+    /**
+     * Set up the serial MIDI ports.
      */
-    MIDIUART_Init(&mpuart7, MIDI_UART7_BASE, MIDI_UART7_SYSCTL_PERIPH, g_ui32SysClock, MIDI_UART7_CN, MIDI_UART7_INT);
+    MIDIPORTS_Init(g_ui32SysClock);
+    MIDISOFT_Init(g_ui32SysClock);
+#if MIDI_THRU
+    {
+        midiport_t *thru[1];
+
+        thru[0] = MIDIPORTS_byCable(MIDI_THRU_CN);
+        if( thru[0] )
+            MIDIUART_setThru(thru[0], thru, 1, MIDI_THRU_MERGE);
+    }
+#endif
+    ctlport = MIDIPORTS_byCable(MIDI_CONTROLS_CN);
 
     /**
      * Set up the buttons.
@@ -151,6 +198,16 @@ int main(void)
      * new requirement for TM4C129 devices.
      */
     SysCtlVCOGet(SYSCTL_XTAL_25MHZ, &ui32PLLRate);
+#if USBMIDI_HOST
+    USBHCDFeatureSet(0, USBLIB_FEATURE_CPUCLK, &g_ui32SysClock);
+    USBHCDFeatureSet(0, USBLIB_FEATURE_USBPLL, &ui32PLLRate);
+
+    /*
+     * Initialize the USB stack as a host, for USB MIDI devices plugged into us.
+     */
+    USBStackModeSet(0, eUSBModeHost, 0);
+    USBHMIDI_Init();
+#else
     USBDCDFeatureSet(0, USBLIB_FEATURE_CPUCLK, &g_ui32SysClock);
     USBDCDFeatureSet(0, USBLIB_FEATURE_USBPLL, &ui32PLLRate);
 
@@ -173,6 +230,7 @@ int main(void)
     MAP_GPIOPinTypeGPIOInput(GPIO_PORTQ_BASE, GPIO_PIN_4);
 #endif
     USBMIDI_Init(0);
+#endif
 
     //
     // Enable processor interrupts.
@@ -185,7 +243,7 @@ int main(void)
     //
     UARTStdioConfig(0, 115200, g_ui32SysClock);
 
-    UARTprintf("Hello, world!\nClock frequency is %u\n", g_ui32SysClock);
+    CONSOLE_printf("Hello, world!\nClock frequency is %u\n", g_ui32SysClock);
 
     // Enable LCD
     LcdInit();
@@ -204,15 +262,22 @@ int main(void)
     	 */
     	if( USBMIDI_IsConnected() ) {
     		if( wasConnected == false ) {
-    			UARTprintf("Connected to bus!\n");
+    			CONSOLE_printf("Connected to bus!\n");
     			wasConnected = true;
     		}
     	} else {
     		if( wasConnected == true ) {
-    			UARTprintf("Disconnected from bus!\n");
+    			CONSOLE_printf("Disconnected from bus!\n");
     			wasConnected = false;
     		}
     	}
+#if USBMIDI_REMOTE_WAKEUP
+    	/*
+    	 * Report how long the host took to wake up for DIN input.
+    	 */
+    	if( USBMIDI_WakeReport(&resumeMs, &firstEventMs) )
+    		CONSOLE_printf("Woke the host: resumed in %u ms, first event in %u ms\n", resumeMs, firstEventMs);
+#endif
         /*
          *  Handle encoder.
          */
@@ -229,7 +294,8 @@ int main(void)
             msg[0] = MIDI_MSG_NOTEON;
             msg[1] = 0x60;    // middle C
             msg[2] = 0x00;    // off velocity
-            MIDIUART_writeMessage(&mpuart7, msg, 3);
+            if( ctlport )
+                MIDIUART_writeMessage(ctlport, msg, 3);
             txmsg.header = USB_MIDI_HEADER(1, USB_MIDI_CIN_NOTEOFF );
             txmsg.byte1 = msg[0];
             txmsg.byte2 = msg[1];
@@ -243,7 +309,8 @@ int main(void)
             msg[0] = MIDI_MSG_NOTEON;
             msg[1] = 0x60;    // middle C
             msg[2] = 0x40;    // on velocity
-            MIDIUART_writeMessage(&mpuart7, msg, 3);
+            if( ctlport )
+                MIDIUART_writeMessage(ctlport, msg, 3);
             txmsg.header = USB_MIDI_HEADER(1, USB_MIDI_CIN_NOTEON );
             txmsg.byte1 = msg[0];
             txmsg.byte2 = msg[1];
@@ -257,7 +324,8 @@ int main(void)
              msg[0] = MIDI_MSG_NOTEON;
              msg[1] = 0x44;    // some note!
              msg[2] = 0x00;    // off velocity
-             MIDIUART_writeMessage(&mpuart7, msg, 3);
+             if( ctlport )
+                 MIDIUART_writeMessage(ctlport, msg, 3);
              txmsg.header = USB_MIDI_HEADER(1, USB_MIDI_CIN_NOTEOFF );
              txmsg.byte1 = msg[0];
              txmsg.byte2 = msg[1];
@@ -271,7 +339,8 @@ int main(void)
              msg[0] = MIDI_MSG_NOTEON;
              msg[1] = 0x44;    // some note
              msg[2] = 0x40;    // on velocity
-             MIDIUART_writeMessage(&mpuart7, msg, 3);
+             if( ctlport )
+                 MIDIUART_writeMessage(ctlport, msg, 3);
              txmsg.header = USB_MIDI_HEADER(1, USB_MIDI_CIN_NOTEON );
              txmsg.byte1 = msg[0];
              txmsg.byte2 = msg[1];
@@ -280,17 +349,23 @@ int main(void)
          }
 
         /*
-         * Check for incoming serial MIDI messages and handle them.
-         * For right now, this just sets the state of the LEDs.
+         * Check for incoming serial MIDI messages and send them to the host.
+         * Two control changes also set the state of the LEDs.
          */
         MIDI_Rx_Task();
 
         /*
          * Check for incoming USB MIDI messages.
-         * Convert them to ASCII and transmit out the debug UART.
+         * Send each cable's messages out the serial port with its cable number.
          */
         MIDI_USB_Rx_Task();
 
+#if USBMIDI_HOST
+        /*
+         * Run the USB host, and send what its USB MIDI devices play out the DIN ports.
+         */
+        MIDI_USBH_Rx_Task();
+#endif
 
     }
 }
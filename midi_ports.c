@@ -0,0 +1,184 @@
+/*
+ * midi_ports.c
+ *
+ *  Created on: Aug 13, 2020
+ *      Author: andy
+ *
+ * The serial MIDI ports in this build, described by a table.
+ *
+ * Most of the UART MIDI code is shared, and each function takes a pointer to
+ * a structure which holds all relevant information about both the UART itself
+ * and the software FIFOs used to manage messages.
+ *
+ * However, each UART has its own interrupt vector. Since we can't "call" an ISR
+ * and include the pointer to that structure, that structure has to be global,
+ * and each UART needs its own small ISR. MIDI_UART_PORT(n) makes both for UART n,
+ * for each UART enabled in pconfig.h.
+ *
+ * The table has one entry per enabled port, with the UART, its pins, and how the
+ * port runs. The pins are the ones used on our boards. If a board routes a UART
+ * to its other pins (UART2 on PD4/PD5, say), change them here.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "inc/hw_memmap.h"
+#include "inc/hw_ints.h"
+#include "driverlib/rom.h"
+#include "driverlib/rom_map.h"
+#include "driverlib/sysctl.h"
+#include "driverlib/gpio.h"
+#include "driverlib/pin_map.h"
+#include "driverlib/uart.h"
+#include "driverlib/udma.h"
+#include "pconfig.h"
+#include "midi_uart.h"
+#include "midi_ports.h"
+#include "midi_softports.h"
+
+/**
+ * Instantiate the midiport_t structure and the ISR for UART n.
+ * The structure is initialized in the call to MIDIUART_Init().
+ */
+#define MIDI_UART_PORT(n)                               \
+    midiport_t mpuart##n;                               \
+    void MIDIUART##n##_IntHandler(void)                 \
+    {                                                   \
+        MIDIUART_intHandler(&mpuart##n);                \
+    }
+
+/**
+ * One entry in the port table.
+ */
+#define MIDI_UART_DESC(n, gpio, rx, tx, dmachan)                            \
+    {                                                                       \
+        &mpuart##n,                                                         \
+        UART##n##_BASE,                                                     \
+        SYSCTL_PERIPH_UART##n,                                              \
+        INT_UART##n,                                                        \
+        SYSCTL_PERIPH_GPIO##gpio,                                           \
+        GPIO_PORT##gpio##_BASE,                                             \
+        GPIO_PIN_##rx,                                                      \
+        GPIO_PIN_##tx,                                                      \
+        GPIO_P##gpio##rx##_U##n##RX,                                        \
+        GPIO_P##gpio##tx##_U##n##TX,                                        \
+        dmachan,                                                            \
+        MIDI_UART##n##_CN,                                                  \
+        MIDI_UART##n##_TXMODE,                                              \
+        MIDI_UART##n##_RUNSTATUS                                            \
+    }
+
+#if MIDI_UART0_ENABLE
+MIDI_UART_PORT(0)
+#endif
+#if MIDI_UART1_ENABLE
+MIDI_UART_PORT(1)
+#endif
+#if MIDI_UART2_ENABLE
+MIDI_UART_PORT(2)
+#endif
+#if MIDI_UART3_ENABLE
+MIDI_UART_PORT(3)
+#endif
+#if MIDI_UART4_ENABLE
+MIDI_UART_PORT(4)
+#endif
+#if MIDI_UART5_ENABLE
+MIDI_UART_PORT(5)
+#endif
+#if MIDI_UART6_ENABLE
+MIDI_UART_PORT(6)
+#endif
+#if MIDI_UART7_ENABLE
+MIDI_UART_PORT(7)
+#endif
+
+#if MIDI_UART1_ENABLE
+#error UART1 is on PB0 and PB1, which are USB0ID and USB0VBUS on this board
+#endif
+
+#if MIDI_UART_NUM_PORTS > 0
+const MIDIUART_portdesc_t MIDIPORTS_table[MIDI_UART_NUM_PORTS] =
+{
+#if MIDI_UART0_ENABLE
+    MIDI_UART_DESC(0, A, 0, 1, UDMA_CH9_UART0TX),
+#endif
+#if MIDI_UART1_ENABLE
+    MIDI_UART_DESC(1, B, 0, 1, UDMA_CH23_UART1TX),
+#endif
+#if MIDI_UART2_ENABLE
+    MIDI_UART_DESC(2, A, 6, 7, UDMA_CH13_UART2TX),
+#endif
+#if MIDI_UART3_ENABLE
+    MIDI_UART_DESC(3, A, 4, 5, UDMA_CH17_UART3TX),
+#endif
+#if MIDI_UART4_ENABLE
+    MIDI_UART_DESC(4, A, 2, 3, UDMA_CH19_UART4TX),
+#endif
+#if MIDI_UART5_ENABLE
+    MIDI_UART_DESC(5, C, 6, 7, UDMA_CH7_UART5TX),
+#endif
+#if MIDI_UART6_ENABLE
+    MIDI_UART_DESC(6, P, 0, 1, UDMA_CH11_UART6TX),
+#endif
+#if MIDI_UART7_ENABLE
+    MIDI_UART_DESC(7, C, 4, 5, UDMA_CH21_UART7TX),
+#endif
+};
+#endif
+
+/**
+ * Set up every serial MIDI port in the table.
+ *
+ * @param[in] sysclkfreq    The clock frequency as set by SysCtlClockFreqSet().
+ *
+ * Each port is brought up in EOT mode by MIDIUART_Init(), then switched to the
+ * transmit mode its table entry asks for.
+ */
+void MIDIPORTS_Init(uint32_t sysclkfreq)
+{
+#if MIDI_UART_NUM_PORTS > 0
+    const MIDIUART_portdesc_t *desc;
+    uint32_t idx;
+
+    for( idx = 0; idx < MIDI_UART_NUM_PORTS; idx++ )
+    {
+        desc = &MIDIPORTS_table[idx];
+
+        MIDIUART_Init(desc, sysclkfreq);
+
+        switch( desc->txmode )
+        {
+        case MU_TXMODE_DMA:
+            MIDIUART_enableTxDMA(desc->port, desc->txdmachan, MIDI_UART_TXLEVEL, MIDI_UART_RXLEVEL);
+            break;
+        case MU_TXMODE_FIFO:
+            MIDIUART_enableFIFO(desc->port, MIDI_UART_TXLEVEL, MIDI_UART_RXLEVEL);
+            break;
+        default:
+            break;
+        }
+
+        MIDIUART_setRunningStatus(desc->port, desc->runstatus);
+    }
+#else
+    (void) sysclkfreq;
+#endif
+}
+
+/**
+ * Find the serial MIDI port with the given cable number. The UART ports are
+ * looked at first, then the soft ports.
+ */
+midiport_t *MIDIPORTS_byCable(uint8_t cable)
+{
+#if MIDI_UART_NUM_PORTS > 0
+    uint32_t idx;
+
+    for( idx = 0; idx < MIDI_UART_NUM_PORTS; idx++ )
+    {
+        if( MIDIPORTS_table[idx].cablenum == cable )
+            return MIDIPORTS_table[idx].port;
+    }
+#endif
+    return MIDISOFT_byCable(cable);
+}
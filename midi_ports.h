@@ -0,0 +1,111 @@
+/*
+ * midi_ports.h
+ *
+ *  Created on: Aug 13, 2020
+ *      Author: andy
+ *
+ * The serial MIDI ports in this build. Which UARTs are MIDI ports is set in
+ * pconfig.h, with MIDI_UARTn_ENABLE.
+ *
+ * For each enabled UART n there is a port structure, mpuartn, and an ISR,
+ * MIDIUARTn_IntHandler(). The startup code puts MIDI_UARTn_VECTOR in the vector
+ * table, which is that ISR if the port is enabled and the default handler if not.
+ */
+
+#ifndef MIDI_PORTS_H_
+#define MIDI_PORTS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pconfig.h"
+#include "midi_uart.h"
+
+/**
+ * How many serial MIDI ports there are.
+ */
+#define MIDI_UART_NUM_PORTS (MIDI_UART0_ENABLE + MIDI_UART1_ENABLE + MIDI_UART2_ENABLE + \
+                             MIDI_UART3_ENABLE + MIDI_UART4_ENABLE + MIDI_UART5_ENABLE + \
+                             MIDI_UART6_ENABLE + MIDI_UART7_ENABLE)
+
+/**
+ * Declare the port structure and ISR for UART n.
+ */
+#define MIDI_UART_PORT_DECLARE(n)               \
+    extern midiport_t mpuart##n;                \
+    extern void MIDIUART##n##_IntHandler(void)
+
+#if MIDI_UART0_ENABLE
+MIDI_UART_PORT_DECLARE(0);
+#define MIDI_UART0_VECTOR MIDIUART0_IntHandler
+#else
+#define MIDI_UART0_VECTOR IntDefaultHandler
+#endif
+
+#if MIDI_UART1_ENABLE
+MIDI_UART_PORT_DECLARE(1);
+#define MIDI_UART1_VECTOR MIDIUART1_IntHandler
+#else
+#define MIDI_UART1_VECTOR IntDefaultHandler
+#endif
+
+#if MIDI_UART2_ENABLE
+MIDI_UART_PORT_DECLARE(2);
+#define MIDI_UART2_VECTOR MIDIUART2_IntHandler
+#else
+#define MIDI_UART2_VECTOR IntDefaultHandler
+#endif
+
+#if MIDI_UART3_ENABLE
+MIDI_UART_PORT_DECLARE(3);
+#define MIDI_UART3_VECTOR MIDIUART3_IntHandler
+#else
+#define MIDI_UART3_VECTOR IntDefaultHandler
+#endif
+
+#if MIDI_UART4_ENABLE
+MIDI_UART_PORT_DECLARE(4);
+#define MIDI_UART4_VECTOR MIDIUART4_IntHandler
+#else
+#define MIDI_UART4_VECTOR IntDefaultHandler
+#endif
+
+#if MIDI_UART5_ENABLE
+MIDI_UART_PORT_DECLARE(5);
+#define MIDI_UART5_VECTOR MIDIUART5_IntHandler
+#else
+#define MIDI_UART5_VECTOR IntDefaultHandler
+#endif
+
+#if MIDI_UART6_ENABLE
+MIDI_UART_PORT_DECLARE(6);
+#define MIDI_UART6_VECTOR MIDIUART6_IntHandler
+#else
+#define MIDI_UART6_VECTOR IntDefaultHandler
+#endif
+
+#if MIDI_UART7_ENABLE
+MIDI_UART_PORT_DECLARE(7);
+#define MIDI_UART7_VECTOR MIDIUART7_IntHandler
+#else
+#define MIDI_UART7_VECTOR IntDefaultHandler
+#endif
+
+/**
+ * The port table, one entry for each enabled port, in UART order.
+ */
+extern const MIDIUART_portdesc_t MIDIPORTS_table[];
+
+/**
+ * Set up every port in the table: UART, pins, transmit mode and running status.
+ * Call after DMA_Init(), since a port may want a uDMA channel.
+ * @param sysclkfreq is the clock frequency as set by SysCtlClockFreqSet().
+ */
+void MIDIPORTS_Init(uint32_t sysclkfreq);
+
+/**
+ * Find the serial MIDI port, UART or soft, with the given cable number.
+ * @return the port, or 0 if no port has that cable number.
+ */
+midiport_t *MIDIPORTS_byCable(uint8_t cable);
+
+#endif /* MIDI_PORTS_H_ */
@@ -3,6 +3,10 @@
  *
  *  Created on: Jun 24, 2020
  *      Author: andy
+ *
+ * Mods:
+ * 2020-08-19 andy. Every serial port's messages go to the host, on the port's
+ *  cable, a batch at a time. They are no longer printed on the debug console.
  */
 
 
@@ -14,53 +18,114 @@
 
 #include "midi.h"
 #include "midi_uart.h"
-#include "midi_uart7.h"
+#include "midi_ports.h"
 #include "pconfig.h"
 
 #include "usb_midi.h"
+#include "usbmidi.h"
 #include "midi_rx_task.h"
 
-#include "utils/uartstdio.h"
+/**
+ * How many messages we take from the serial port each time through.
+ * Sixteen is what fits in one USB packet.
+ */
+#define MIDI_RX_BATCH 16
 
 /**
- * Check for incoming MIDI messages and parse them.
- *
- * For the time being, we handle two control-change messages, and they simply
- * control the two LEDs. We won't bother dealing with cable numbers or the
- * Code Index Number. Just inspect the three bytes of the message packet.
+ * The cable numbers a port can have.
+ */
+#define MIDI_RX_CABLES 16
+
+/**
+ * The cable whose port goes first the next time through.
+ */
+static uint8_t MIDI_Rx_first;
+
+/**
+ * Two control-change messages simply control the two LEDs. We won't bother
+ * dealing with cable numbers or the Code Index Number. Just inspect the three
+ * bytes of the message packet.
  * Byte 1 is Status. Look for MIDI_MSG_CTRLCHANGE.
  * Byte 2 is the control number. Look for MIDI_CC_GP5 for LED0 and MIDI_CC_GP6 for LED1.
  * Byte 3 is the intensity of the LED. 64 and greater is on, 63 and less is off.
  */
-void MIDI_Rx_Task(void)
+static void MIDI_Rx_leds(const USBMIDI_Message_t *msg)
 {
-    static USBMIDI_Message_t msg;
     uint8_t led;
 
-    if( MIDIUART_readMessage(&mpuart7, &msg) )
+    if( msg->byte1 == MIDI_MSG_CTRLCHANGE )
+    {
+        switch( msg->byte2 )
+        {
+        case MIDI_CC_GP5:
+            if( msg->byte3 > 63)
+                led = LED_LED0;
+            else
+                led = 0;
+            MAP_GPIOPinWrite(LED_PORT, LED_LED0, led);
+            break;
+
+        case MIDI_CC_GP6:
+            if( msg->byte3 > 63)
+                led = LED_LED1;
+            else
+                led = 0;
+            MAP_GPIOPinWrite(LED_PORT, LED_LED1, led);
+            break;
+        }
+    }
+}
+
+/**
+ * Check for incoming MIDI messages on every serial port, and send them to the host.
+ *
+ * Each port's parser already puts the port's cable number in the packets, so they
+ * go to the IN endpoint FIFO as they are, up to MIDI_RX_BATCH at a time, with one
+ * USBMIDI_InEpMsgWriteBatch() call. We never take more from a port than the FIFO
+ * has room for, so nothing is lost there: if the host falls behind, the bytes wait
+ * in the port's receive ring instead. The ports take turns going first, so when
+ * the FIFO is short of room, the same port isn't always the one left waiting.
+ *
+ * The first message of a batch starts the IN endpoint's flush deadline, so a
+ * message goes to the host within USBMIDI_IN_FLUSH_FRAMES frames of being read,
+ * even if it doesn't fill a packet. A full packet goes right away.
+ */
+void MIDI_Rx_Task(void)
+{
+    USBMIDI_Message_t msgs[MIDI_RX_BATCH];
+    midiport_t *port;
+    uint32_t count;
+    uint32_t max;
+    uint32_t i;
+    uint8_t cable;
+    uint8_t n;
+
+    cable = MIDI_Rx_first;
+    for( n = 0; n < MIDI_RX_CABLES; n++ )
     {
-        if( msg.byte1 == MIDI_MSG_CTRLCHANGE )
+        port = MIDIPORTS_byCable(cable);
+        if( port )
         {
-            switch( msg.byte2 )
+            max = MIDI_RX_BATCH;
+            if( USBMIDI_IsConnected() )
             {
-            case MIDI_CC_GP5:
-                if( msg.byte3 > 63)
-                    led = LED_LED0;
-                else
-                    led = 0;
-                MAP_GPIOPinWrite(LED_PORT, LED_LED0, led);
-                break;
-
-            case MIDI_CC_GP6:
-                if( msg.byte3 > 63)
-                    led = LED_LED1;
-                else
-                    led = 0;
-                MAP_GPIOPinWrite(LED_PORT, LED_LED1, led);
-                break;
+                max = USBMIDI_InEpSpace();
+                if( max > MIDI_RX_BATCH )
+                    max = MIDI_RX_BATCH;
             }
+
+            count = MIDIUART_readMessages(port, msgs, max);
+            for( i = 0; i < count; i++ )
+                MIDI_Rx_leds(&msgs[i]);
+
+            if( count )
+                USBMIDI_InEpMsgWriteBatch(msgs, count);
         }
-        UARTprintf("%02x : %02x : %02x : %02x\n", msg.header, msg.byte1, msg.byte2, msg.byte3);
+
+        if( ++cable == MIDI_RX_CABLES )
+            cable = 0;
     }
-}
 
+    if( ++MIDI_Rx_first == MIDI_RX_CABLES )
+        MIDI_Rx_first = 0;
+}
@@ -0,0 +1,306 @@
+/*
+ * midi_softports.c
+ *
+ *  Created on: Aug 14, 2020
+ *      Author: andy
+ *
+ * Soft serial MIDI ports, for when we need more ports than the chip has UARTs.
+ *
+ * Each port is a tSoftUART from utils/softuart.c, on two spare GPIO pins. Its
+ * midiport_t is set up with MIDIUART_InitSoft(), and from then on the port is
+ * used just like a UART port: MIDIUART_writeMessage(), MIDIUART_readMessages()
+ * and the rest.
+ *
+ * All of the soft ports share one timer, which interrupts at four times the MIDI
+ * bit rate, 125 kHz. Every fourth tick is a bit time for the transmitters. The
+ * receivers use all of the ticks:
+ *
+ * - While a receiver is waiting for a start bit, each tick looks at its pin. A low
+ *   pin is a start bit, which began sometime in the last quarter bit.
+ * - The first data bit is sampled five ticks later, so 1.25 to 1.5 bit times
+ *   after the falling edge, and every four ticks after that, up to the stop bit.
+ *   Then the received byte is moved into the port's receive ring buffer, and the
+ *   receiver goes back to looking for a start bit.
+ *
+ * So there are no GPIO edge interrupts, and the work done per tick for each
+ * port is small and the same every time, which keeps the timer ISR's cost easy
+ * to predict as ports are added.
+ *
+ * The soft UART library still turns on the receive pin's GPIO interrupt at the
+ * end of each byte, since it expects to be driven by edge interrupts. We never
+ * enable that GPIO port's interrupt in the NVIC, so put the receive pins on a
+ * GPIO port that nothing else takes interrupts from.
+ *
+ * The timer ISR should not be held off by other interrupts for more than a tick
+ * or so. It is set to priority 0, the highest. Everything else is at 0 too unless
+ * set otherwise, so a long ISR elsewhere should be moved to a lower priority.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "inc/hw_memmap.h"
+#include "inc/hw_ints.h"
+#include "driverlib/rom.h"
+#include "driverlib/rom_map.h"
+#include "driverlib/sysctl.h"
+#include "driverlib/gpio.h"
+#include "driverlib/timer.h"
+#include "driverlib/interrupt.h"
+#include "utils/softuart.h"
+#include "pconfig.h"
+#include "midi_uart.h"
+#include "midi_softports.h"
+
+#if MIDI_SOFT_NUM_PORTS > 0
+
+/**
+ * Timer ticks per MIDI bit.
+ */
+#define MIDI_SOFT_OVERSAMPLE 4
+
+/**
+ * Ticks from seeing the start bit to sampling the first data bit.
+ */
+#define MIDI_SOFT_FIRSTSAMPLE 5
+
+/**
+ * Bits sampled after the start bit: eight data bits and the stop bit.
+ */
+#define MIDI_SOFT_RXBITS 9
+
+/**
+ * Soft UART buffer sizes. Each holds one less than this.
+ * The transmit buffer holds the byte being sent and the one after it, so bytes go
+ * out back to back, and Real Time bytes wait behind at most one other byte.
+ */
+#define MIDI_SOFT_TXBUF_SIZE 3
+#define MIDI_SOFT_RXBUF_SIZE 4
+
+/**
+ * This describes one soft port: its pins and cable number.
+ */
+typedef struct
+{
+    midiport_t *port;             //!< the port's working data
+    uint32_t rxperiph;            //!< SysCtl peripheral for the receive pin's GPIO port
+    uint32_t rxbase;              //!< receive pin's GPIO port
+    uint8_t rxpin;                //!< receive pin, GPIO_PIN_x
+    uint32_t txperiph;            //!< SysCtl peripheral for the transmit pin's GPIO port
+    uint32_t txbase;              //!< transmit pin's GPIO port
+    uint8_t txpin;                //!< transmit pin, GPIO_PIN_x
+    uint8_t cablenum;             //!< USB-MIDI cable number
+} MIDISOFT_portdesc_t;
+
+/**
+ * The working data of a soft port, apart from its midiport_t.
+ */
+typedef struct
+{
+    tSoftUART uart;                             //!< the soft UART
+    uint8_t txbuf[MIDI_SOFT_TXBUF_SIZE];        //!< its transmit buffer
+    uint16_t rxbuf[MIDI_SOFT_RXBUF_SIZE];       //!< its receive buffer, data and flags
+    uint8_t rxcount;              //!< ticks until the next sample, 0 while looking for a start bit
+    uint8_t rxbits;               //!< bits left to sample in this byte
+} MIDISOFT_state_t;
+
+/**
+ * One entry in the port table.
+ */
+#define MIDI_SOFT_DESC(n, rxgpio, rx, txgpio, tx)                           \
+    {                                                                       \
+        &mpsoft##n,                                                         \
+        SYSCTL_PERIPH_GPIO##rxgpio,                                         \
+        GPIO_PORT##rxgpio##_BASE,                                           \
+        GPIO_PIN_##rx,                                                      \
+        SYSCTL_PERIPH_GPIO##txgpio,                                         \
+        GPIO_PORT##txgpio##_BASE,                                           \
+        GPIO_PIN_##tx,                                                      \
+        MIDI_SOFT##n##_CN                                                   \
+    }
+
+#if MIDI_SOFT0_ENABLE
+midiport_t mpsoft0;
+#endif
+#if MIDI_SOFT1_ENABLE
+midiport_t mpsoft1;
+#endif
+#if MIDI_SOFT2_ENABLE
+midiport_t mpsoft2;
+#endif
+#if MIDI_SOFT3_ENABLE
+midiport_t mpsoft3;
+#endif
+
+/**
+ * The soft port table. The pins are spare ones on our boards, change them here.
+ */
+static const MIDISOFT_portdesc_t MIDISOFT_table[MIDI_SOFT_NUM_PORTS] =
+{
+#if MIDI_SOFT0_ENABLE
+    MIDI_SOFT_DESC(0, K, 4, K, 5),
+#endif
+#if MIDI_SOFT1_ENABLE
+    MIDI_SOFT_DESC(1, K, 6, K, 7),
+#endif
+#if MIDI_SOFT2_ENABLE
+    MIDI_SOFT_DESC(2, E, 0, E, 1),
+#endif
+#if MIDI_SOFT3_ENABLE
+    MIDI_SOFT_DESC(3, E, 2, E, 3),
+#endif
+};
+
+static MIDISOFT_state_t MIDISOFT_state[MIDI_SOFT_NUM_PORTS];
+
+/**
+ * Which of the four ticks in a bit time this is. The transmitters run on tick 0.
+ */
+static uint8_t MIDISOFT_phase;
+
+/**
+ * ISR for the soft port timer.
+ *
+ * First, on every fourth tick, each transmitter sends its next bit. The soft UART
+ * writes the pin first thing, so the bit edges don't move around with the work
+ * done here. If the soft UART has room, MIDIUART_txHandler() gives it the next
+ * byte from the Real Time lane or the message FIFO.
+ *
+ * Then each receiver either looks for a start bit or counts down to its next
+ * sample. After the stop bit is sampled, MIDIUART_rxHandler() moves the byte into
+ * the port's receive ring buffer.
+ */
+void MIDISOFT_TimerIntHandler(void)
+{
+    const MIDISOFT_portdesc_t *desc;
+    MIDISOFT_state_t *state;
+    uint32_t idx;
+
+    MAP_TimerIntClear(MIDI_SOFT_TIMER_BASE, TIMER_TIMA_TIMEOUT);
+
+    if( 0 == MIDISOFT_phase )
+    {
+        for( idx = 0; idx < MIDI_SOFT_NUM_PORTS; idx++ )
+        {
+            state = &MIDISOFT_state[idx];
+            SoftUARTTxTimerTick(&state->uart);
+            if( SoftUARTSpaceAvail(&state->uart) )
+            {
+                MIDIUART_txHandler(MIDISOFT_table[idx].port, UART_INT_TX);
+            }
+        }
+    }
+    MIDISOFT_phase++;
+    if( MIDI_SOFT_OVERSAMPLE == MIDISOFT_phase )
+        MIDISOFT_phase = 0;
+
+    for( idx = 0; idx < MIDI_SOFT_NUM_PORTS; idx++ )
+    {
+        desc = &MIDISOFT_table[idx];
+        state = &MIDISOFT_state[idx];
+
+        if( 0 == state->rxcount )
+        {
+            // looking for a start bit.
+            if( 0 == MAP_GPIOPinRead(desc->rxbase, desc->rxpin) )
+            {
+                SoftUARTRxTick(&state->uart, true);
+                state->rxcount = MIDI_SOFT_FIRSTSAMPLE;
+                state->rxbits = MIDI_SOFT_RXBITS;
+            }
+        }
+        else if( 0 == --state->rxcount )
+        {
+            SoftUARTRxTick(&state->uart, false);
+            if( --state->rxbits )
+            {
+                state->rxcount = MIDI_SOFT_OVERSAMPLE;
+            }
+            else
+            {
+                // that was the stop bit, the byte is in.
+                MIDIUART_rxHandler(desc->port);
+            }
+        }
+    }
+}
+
+#endif
+
+/**
+ * Set up every soft port in the table, and start the timer.
+ *
+ * @param[in] sysclkfreq    The clock frequency as set by SysCtlClockFreqSet().
+ */
+void MIDISOFT_Init(uint32_t sysclkfreq)
+{
+#if MIDI_SOFT_NUM_PORTS > 0
+    const MIDISOFT_portdesc_t *desc;
+    MIDISOFT_state_t *state;
+    uint32_t idx;
+
+    for( idx = 0; idx < MIDI_SOFT_NUM_PORTS; idx++ )
+    {
+        desc = &MIDISOFT_table[idx];
+        state = &MIDISOFT_state[idx];
+
+        MAP_SysCtlPeripheralEnable(desc->rxperiph);
+        while (!MAP_SysCtlPeripheralReady(desc->rxperiph))
+            ;
+        MAP_SysCtlPeripheralEnable(desc->txperiph);
+        while (!MAP_SysCtlPeripheralReady(desc->txperiph))
+            ;
+
+        // SoftUARTConfigSet() sets up the pins and turns the soft UART on.
+        SoftUARTInit(&state->uart);
+        SoftUARTTxGPIOSet(&state->uart, desc->txbase, desc->txpin);
+        SoftUARTRxGPIOSet(&state->uart, desc->rxbase, desc->rxpin);
+        SoftUARTTxBufferSet(&state->uart, state->txbuf, MIDI_SOFT_TXBUF_SIZE);
+        SoftUARTRxBufferSet(&state->uart, state->rxbuf, MIDI_SOFT_RXBUF_SIZE);
+        SoftUARTConfigSet(&state->uart, (SOFTUART_CONFIG_WLEN_8 | SOFTUART_CONFIG_STOP_ONE |
+                                         SOFTUART_CONFIG_PAR_NONE));
+
+        // an input with nothing plugged in should idle high.
+        MAP_GPIOPadConfigSet(desc->rxbase, desc->rxpin, GPIO_STRENGTH_2MA, GPIO_PIN_TYPE_STD_WPU);
+
+        state->rxcount = 0;
+        state->rxbits = 0;
+
+        MIDIUART_InitSoft(desc->port, &state->uart, desc->cablenum);
+        MIDIUART_setRunningStatus(desc->port, MIDI_SOFT_RUNSTATUS);
+    }
+
+    /*
+     * The timer runs at four times 31,250 bps.
+     */
+    MIDISOFT_phase = 0;
+    MAP_SysCtlPeripheralEnable(MIDI_SOFT_TIMER_PERIPH);
+    while (!MAP_SysCtlPeripheralReady(MIDI_SOFT_TIMER_PERIPH))
+        ;
+    MAP_TimerConfigure(MIDI_SOFT_TIMER_BASE, TIMER_CFG_PERIODIC);
+    MAP_TimerLoadSet(MIDI_SOFT_TIMER_BASE, TIMER_A, (sysclkfreq / (31250 * MIDI_SOFT_OVERSAMPLE)) - 1);
+    MAP_TimerIntEnable(MIDI_SOFT_TIMER_BASE, TIMER_TIMA_TIMEOUT);
+    MAP_IntPrioritySet(MIDI_SOFT_TIMER_INT, 0x00);
+    MAP_IntEnable(MIDI_SOFT_TIMER_INT);
+    MAP_TimerEnable(MIDI_SOFT_TIMER_BASE, TIMER_A);
+#else
+    (void) sysclkfreq;
+#endif
+}
+
+/**
+ * Find the soft port with the given cable number.
+ */
+midiport_t *MIDISOFT_byCable(uint8_t cable)
+{
+#if MIDI_SOFT_NUM_PORTS > 0
+    uint32_t idx;
+
+    for( idx = 0; idx < MIDI_SOFT_NUM_PORTS; idx++ )
+    {
+        if( MIDISOFT_table[idx].cablenum == cable )
+            return MIDISOFT_table[idx].port;
+    }
+#else
+    (void) cable;
+#endif
+    return 0;
+}
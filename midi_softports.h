@@ -0,0 +1,63 @@
+/*
+ * midi_softports.h
+ *
+ *  Created on: Aug 14, 2020
+ *      Author: andy
+ *
+ * Soft serial MIDI ports, on spare GPIO pins, using utils/softuart.c.
+ * Which soft ports there are is set in pconfig.h, with MIDI_SOFTn_ENABLE.
+ *
+ * Each soft port n has a port structure, mpsoftn, which is used with the
+ * MIDIUART_ functions just like a UART port's.
+ */
+
+#ifndef MIDI_SOFTPORTS_H_
+#define MIDI_SOFTPORTS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pconfig.h"
+#include "midi_uart.h"
+
+/**
+ * How many soft MIDI ports there are.
+ */
+#define MIDI_SOFT_NUM_PORTS (MIDI_SOFT0_ENABLE + MIDI_SOFT1_ENABLE + \
+                             MIDI_SOFT2_ENABLE + MIDI_SOFT3_ENABLE)
+
+#if MIDI_SOFT0_ENABLE
+extern midiport_t mpsoft0;
+#endif
+#if MIDI_SOFT1_ENABLE
+extern midiport_t mpsoft1;
+#endif
+#if MIDI_SOFT2_ENABLE
+extern midiport_t mpsoft2;
+#endif
+#if MIDI_SOFT3_ENABLE
+extern midiport_t mpsoft3;
+#endif
+
+/**
+ * The startup code puts this in the vector table for the soft port timer.
+ */
+#if MIDI_SOFT_NUM_PORTS > 0
+extern void MIDISOFT_TimerIntHandler(void);
+#define MIDI_SOFT_TIMER_VECTOR MIDISOFT_TimerIntHandler
+#else
+#define MIDI_SOFT_TIMER_VECTOR IntDefaultHandler
+#endif
+
+/**
+ * Set up every soft port, and start the timer that runs them.
+ * @param sysclkfreq is the clock frequency as set by SysCtlClockFreqSet().
+ */
+void MIDISOFT_Init(uint32_t sysclkfreq);
+
+/**
+ * Find the soft port with the given cable number.
+ * @return the port, or 0 if no soft port has that cable number.
+ */
+midiport_t *MIDISOFT_byCable(uint8_t cable);
+
+#endif /* MIDI_SOFTPORTS_H_ */
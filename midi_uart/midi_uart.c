@@ -25,6 +25,10 @@
  *
  * *** Reading messages from the MIDI IN port ***
  *
+ * The receive interrupt moves each incoming byte into the port's receive ring
+ * buffer (see MIDIUART_rxHandler()), so bytes are not lost if the main loop
+ * is busy for a while.
+ *
  * On a periodic basis, the function called MIDIUART_readMessage() should be called.
  * When that function returns true, the argument msg will contain a new four-byte
  * USB-MIDI message packet.
@@ -38,7 +42,9 @@
 #include "driverlib/uart.h"
 #include "driverlib/sysctl.h"
 #include "driverlib/interrupt.h"
+#include "driverlib/udma.h"
 #include "inc/hw_types.h"
+#include "inc/hw_uart.h"
 #include "inc/hw_nvic.h"
 #include "pconfig.h"
 
@@ -46,43 +52,94 @@
 #include "midi_uart.h"
 
 /**
- * Set up the serial port for MIDI operation.
- * This populates the port structure with the necessary details.
- * Set up the serial port for MIDI operation.
- * This populates the port structure with the necessary details.
- * @param port is the port structure that should be passed to all functions.
- * @param uartbase is the base address of the UART's register space
- * @param scperiph is the corresponding peripheral number passed to SysCtl functions
- * @param sysclkfreq is the clock frequency as set by SysCtlClockFreqSet().
- * @param cablenum is the USB "cable number" we use to distinguish this port from the USB perspective
+ * Put a port structure in its starting state: empty rings, parser idle,
+ * transmitter idle, no running status.
  *
- * The pins are configured (for now) in PinoutSet() in pinout.c.
+ * @param[out] port     Pointer to the structure which holds this port's data.
+ * @param[in] cablenum  The USB-MIDI cable number for this port.
  */
-void MIDIUART_Init(midiport_t *port, uint32_t uartbase, uint32_t scperiph, uint32_t sysclkfreq, uint8_t cablenum, uint32_t intnum)
+static void MIDIUART_initPortData(midiport_t *port, uint8_t cablenum)
 {
-    /*
-     * Initialize the port structure.
-     */
-    port->uartbase = uartbase;
-    port->uartint = intnum;
+    port->uartbase = 0;
+    port->uartint = 0;
     port->cablenum = cablenum;
+    port->txmode = MU_TXMODE_EOT;
+    port->txdmachan = 0;
+    port->softuart = 0;
 
     port->cin = 0;
     port->bytecnt = 0;
     port->bytesinpacket = 0;
     port->rxstate = MU_IDLE;
+    port->rxmsg.header = 0;
+    port->rxmsg.byte1 = 0;
+    port->rxmsg.byte2 = 0;
+    port->rxmsg.byte3 = 0;
+    port->rxfifohead = 0;
+    port->rxfifotail = 0;
+    port->rxdropped = 0;
     port->txfifohead = 0;
     port->txfifotail = 0;
     port->txidle = 1;           // start in mode where we are not transmitting.
+    port->txdmacount = 0;
+    port->txdmart = false;
+    port->txrthead = 0;
+    port->txrttail = 0;
+    port->txrunstatus = false;
+    port->txlaststatus = 0;
+    port->thrucount = 0;
+    port->thrumerge = false;
+    port->thrulen = 0;
+    port->thruneed = 0;
+    port->thrustatus = 0;
+    port->thrusysex = false;
+    port->thrudropped = 0;
+}
+
+/**
+ * Set up the serial port for MIDI operation.
+ * This populates the port structure with the necessary details.
+ * @param desc describes the port: the UART, its pins, and desc->port, the port
+ *        structure that should be passed to all functions.
+ * @param sysclkfreq is the clock frequency as set by SysCtlClockFreqSet().
+ *
+ * The port starts in EOT mode. The transmit mode and running status in desc
+ * are applied by the caller, see MIDIPORTS_Init().
+ */
+void MIDIUART_Init(const MIDIUART_portdesc_t *desc, uint32_t sysclkfreq)
+{
+    midiport_t *port = desc->port;
+    uint32_t uartbase = desc->uartbase;
+
+    /*
+     * Initialize the port structure.
+     */
+    MIDIUART_initPortData(port, desc->cablenum);
+    port->uartbase = uartbase;
+    port->uartint = desc->uartint;
+
 
     /*
      * Set up the port hardware.
      *
      * First, enable the peripheral itself.
      */
-    MAP_SysCtlPeripheralEnable(scperiph);
-    while (!MAP_SysCtlPeripheralReady(scperiph))
+    MAP_SysCtlPeripheralEnable(desc->uartperiph);
+    while (!MAP_SysCtlPeripheralReady(desc->uartperiph))
+        ;
+    MAP_SysCtlPeripheralEnable(desc->gpioperiph);
+    while (!MAP_SysCtlPeripheralReady(desc->gpioperiph))
         ;
+
+    /*
+     * Hand the pins to the UART. The receive pin gets a pull-up, so an input
+     * with nothing plugged in idles high instead of receiving garbage.
+     */
+    MAP_GPIOPinConfigure(desc->rxpinconfig);
+    MAP_GPIOPinConfigure(desc->txpinconfig);
+    MAP_GPIOPinTypeUART(desc->gpiobase, desc->rxpin | desc->txpin);
+    MAP_GPIOPadConfigSet(desc->gpiobase, desc->rxpin, GPIO_STRENGTH_2MA, GPIO_PIN_TYPE_STD_WPU);
+
     /*
      * Configure the UART for 31,250 bps, 8-N-1 operation.
      */
@@ -95,79 +152,877 @@ void MIDIUART_Init(midiport_t *port, uint32_t uartbase, uint32_t scperiph, uint3
 
     /*
      * Specify which interrupts will be used, and enable them.
-     * We only care about the transmit interrupt.
+     * The transmit interrupt feeds the transmitter from the message FIFO.
+     * The receive interrupt fills the receive ring buffer, and the overrun
+     * interrupt lets us count bytes the UART itself dropped.
      */
-    MAP_UARTIntEnable(uartbase, UART_INT_TX);
-    MAP_IntEnable(intnum);
-    // enable pullup.
-    MAP_GPIOPadConfigSet(GPIO_PORTC_BASE, GPIO_PIN_4, GPIO_STRENGTH_2MA, GPIO_PIN_TYPE_STD_WPU);
+    MAP_UARTIntEnable(uartbase, UART_INT_TX | UART_INT_RX | UART_INT_OE);
+    MAP_IntEnable(desc->uartint);
     /*
      * Enable the UART.
+     * UARTEnable() also turns on the FIFOs, which we do not use. With the receive
+     * FIFO on, the receive interrupt would not fire until it was half full.
      */
     ROM_UARTEnable(uartbase);
+    MAP_UARTFIFODisable(uartbase);
 }
 
 /**
- * Write the given message to the MIDI OUT message FIFO.
+ * Set up a soft UART as a MIDI port.
+ *
+ * @param[out] port     Pointer to the structure which holds this port's data.
+ * @param[in] softuart  The soft UART, already set up for 8-N-1 with its pins
+ *                      and buffers. See midi_softports.c.
+ * @param[in] cablenum  The USB-MIDI cable number for this port.
+ *
+ * A soft port has no interrupt of its own. The timer that ticks the soft UART
+ * calls MIDIUART_rxHandler() when a byte has come in and MIDIUART_txHandler()
+ * when the soft UART has room, so bytes move the same way as for a UART port.
+ */
+void MIDIUART_InitSoft(midiport_t *port, tSoftUART *softuart, uint8_t cablenum)
+{
+    MIDIUART_initPortData(port, cablenum);
+    port->softuart = softuart;
+    port->txmode = MU_TXMODE_SOFT;
+}
+
+/**
+ * Switch a port to FIFO operation.
+ *
+ * @param[in,out] port  Pointer to the structure which holds this port's data.
+ * @param[in] txlevel   Transmit interrupt level, UART_FIFO_TX1_8 ... UART_FIFO_TX7_8.
+ * @param[in] rxlevel   Receive interrupt level, UART_FIFO_RX1_8 ... UART_FIFO_RX7_8.
+ *
+ * In FIFO mode the transmit interrupt fires when the transmit FIFO drains down
+ * through txlevel, and the ISR then refills it from the message FIFO, so a busy
+ * port takes one interrupt per several bytes instead of one per byte.
+ *
+ * The receive interrupt fires when the receive FIFO fills up to rxlevel. The
+ * receive timeout interrupt picks up the stragglers when fewer bytes than that
+ * arrive and the line goes quiet for 32 bit times.
+ *
+ * Call this after MIDIUART_Init(). Ports that want an interrupt at the end of
+ * each byte (for accurate output timing) should stay in the default EOT mode.
+ */
+void MIDIUART_enableFIFO(midiport_t *port, uint32_t txlevel, uint32_t rxlevel)
+{
+    // Quiet the port while we change things around.
+    MAP_IntDisable(port->uartint);
+
+    MAP_UARTFIFOLevelSet(port->uartbase, txlevel, rxlevel);
+    MAP_UARTTxIntModeSet(port->uartbase, UART_TXINT_MODE_FIFO);
+    MAP_UARTFIFOEnable(port->uartbase);
+    MAP_UARTIntEnable(port->uartbase, UART_INT_TX | UART_INT_RX | UART_INT_RT | UART_INT_OE);
+    port->txmode = MU_TXMODE_FIFO;
+
+    MAP_IntEnable(port->uartint);
+}
+
+/**
+ * Switch a port to uDMA transmit operation.
+ *
+ * @param[in,out] port  Pointer to the structure which holds this port's data.
+ * @param[in] dmachan   Channel assignment for this UART's transmitter, for
+ *                      example UDMA_CH21_UART7TX.
+ * @param[in] txlevel   Transmit FIFO level, UART_FIFO_TX1_8 ... UART_FIFO_TX6_8.
+ * @param[in] rxlevel   Receive interrupt level, UART_FIFO_RX1_8 ... UART_FIFO_RX7_8.
+ *
+ * The port is first put into FIFO mode, since the UART makes its uDMA requests
+ * based on the transmit FIFO level. The receiver works just as it does in FIFO
+ * mode.
+ *
+ * The transmit interrupt is not used. Instead, MIDIUART_txHandler() hands the
+ * uDMA the longest contiguous run of bytes in the message FIFO, and when that
+ * run is done the UART raises UART_INT_DMATX and we hand over the next one.
+ * The CPU never touches the individual bytes.
+ *
+ * The arbitration size is 4 bytes, so the transmit level must leave at least
+ * that much room in the UART FIFO, which means UART_FIFO_TX6_8 or lower.
+ */
+void MIDIUART_enableTxDMA(midiport_t *port, uint32_t dmachan, uint32_t txlevel, uint32_t rxlevel)
+{
+    MIDIUART_enableFIFO(port, txlevel, rxlevel);
+
+    MAP_IntDisable(port->uartint);
+
+    // The channel number is the low byte of the assignment.
+    port->txdmachan = dmachan & 0xFF;
+    port->txdmacount = 0;
+    port->txdmart = false;
+    port->txrthead = 0;
+    port->txrttail = 0;
+    port->txrunstatus = false;
+    port->txlaststatus = 0;
+
+    MAP_uDMAChannelAssign(dmachan);
+    MAP_uDMAChannelAttributeDisable(port->txdmachan,
+                                    UDMA_ATTR_ALTSELECT | UDMA_ATTR_USEBURST |
+                                    UDMA_ATTR_HIGH_PRIORITY | UDMA_ATTR_REQMASK);
+    MAP_uDMAChannelControlSet(port->txdmachan | UDMA_PRI_SELECT,
+                              UDMA_SIZE_8 | UDMA_SRC_INC_8 | UDMA_DST_INC_NONE |
+                              UDMA_ARB_4);
+
+    // the transmit interrupt is replaced by the uDMA-done interrupt.
+    MAP_UARTIntDisable(port->uartbase, UART_INT_TX);
+    MAP_UARTDMAEnable(port->uartbase, UART_DMA_TX);
+    MAP_UARTIntEnable(port->uartbase, UART_INT_DMATX);
+    port->txmode = MU_TXMODE_DMA;
+
+    MAP_IntEnable(port->uartint);
+}
+
+/**
+ * Turn running-status compression on or off.
+ *
+ * @param[in,out] port  Pointer to the structure which holds this port's data.
+ * @param[in] enable    true to leave out repeated status bytes.
+ *
+ * Either way, we forget the running status, so the next channel message
+ * goes out with its status byte.
+ */
+void MIDIUART_setRunningStatus(midiport_t *port, bool enable)
+{
+    port->txlaststatus = 0;
+    port->txrunstatus = enable;
+}
+
+/**
+ * Set up MIDI Thru from this port's input to the outputs of other ports.
+ *
+ * @param[in,out] port  Pointer to the structure for the port whose input is sent thru.
+ * @param[in] dests     The ports to send it to. This may include port itself.
+ * @param[in] ndests    How many ports are in dests, up to MIDI_THRU_MAX_DEST.
+ *                      0 turns thru off.
+ * @param[in] merge     false to copy bytes, true to copy whole messages.
+ *
+ * Thru is done by the receive ISR, as each byte comes in, so it doesn't wait for
+ * the main loop, and however busy the main loop is, thru keeps up.
+ *
+ * Without merge, each byte is written to each destination right away, so the
+ * thru delay is one byte time, plus however long the byte sits in the receive
+ * FIFO in FIFO mode. Nothing else may write to those destinations, as their
+ * messages would land in the middle of ours.
+ *
+ * With merge, the ISR frames the input into whole messages (running status
+ * filled in) and writes each one with MIDIUART_tryWriteMessage(), which is all
+ * or nothing. So the main loop can write its own messages to the same port and
+ * they won't be broken up. The delay is then one message. Real Time bytes still
+ * go right away, since they can go anywhere. A SysEx can be far longer than we
+ * could hold in the ISR, so in merge mode SysEx is not sent thru.
+ *
+ * If a destination is full, what would have gone to it is dropped and counted in
+ * port->thrudropped. The ISR can't wait for room.
+ */
+void MIDIUART_setThru(midiport_t *port, midiport_t * const *dests, uint8_t ndests, bool merge)
+{
+    bool bIntStatus;
+    uint8_t idx;
+
+    if( ndests > MIDI_THRU_MAX_DEST )
+        ndests = MIDI_THRU_MAX_DEST;
+
+    // the receive ISR reads all of this, so change it all at once.
+    bIntStatus = MAP_IntMasterDisable();
+
+    for( idx = 0; idx < ndests; idx++ )
+    {
+        port->thrudest[idx] = dests[idx];
+    }
+    port->thrucount = ndests;
+    port->thrumerge = merge;
+    port->thrulen = 0;
+    port->thruneed = 0;
+    port->thrustatus = 0;
+    port->thrusysex = false;
+
+    if( !bIntStatus )
+        MAP_IntMasterEnable();
+}
+
+/**
+ * Send a Real Time message ahead of the message FIFO.
+ *
+ * @param[in,out] port  Pointer to the structure which holds this port's data.
+ * @param[in] rtbyte    The Real Time message, 0xF8 - 0xFF.
+ * @return true if the byte was queued, false if the lane was full.
+ *
+ * Real Time messages may be sent between any two bytes of any other message, so
+ * MIDIUART_txHandler() always sends from this lane before the message FIFO. In EOT
+ * mode that means a clock waits at most one byte time (320 us) no matter how much
+ * is queued. In FIFO and DMA modes it also waits for whatever the UART FIFO or the
+ * current uDMA run already holds, so ports that carry clock should use EOT mode.
+ *
+ * This never blocks. A full lane means clocks are coming faster than we can send
+ * them, and a late clock is no better than a lost one.
+ *
+ * The transmit ISR is the only one that writes txrttail. But txrthead has more
+ * than one writer: the main loop, and the receive ISR of a port that thrus to this
+ * one (MIDIUART_thruByte()). So interrupts are masked while the byte goes in and
+ * txrthead is bumped, as for the message FIFO, or one writer could overwrite the
+ * other's byte.
+ */
+bool MIDIUART_writeRealTime(midiport_t *port, uint8_t rtbyte)
+{
+    bool bIntStatus;
+    uint8_t nexthead;
+
+    bIntStatus = MAP_IntMasterDisable();
+
+    nexthead = port->txrthead + 1;
+    if( MIDI_TX_RT_FIFO_SIZE == nexthead )
+        nexthead = 0;
+
+    if( nexthead == port->txrttail )
+    {
+        if( !bIntStatus )
+            MAP_IntMasterEnable();
+        return false;
+    }
+
+    port->txrtfifo[port->txrthead] = rtbyte;
+    port->txrthead = nexthead;
+
+    if( !bIntStatus )
+        MAP_IntMasterEnable();
+
+    // if the serial port is idle, kick-start it by tripping its interrupt.
+    // A soft port's timer looks for new bytes on every bit, so it needs no kick.
+    if( port->txidle && (MU_TXMODE_SOFT != port->txmode) )
+    {
+        MAP_IntTrigger(port->uartint);
+    }
+
+    return true;
+}
+
+/**
+ * How many more bytes the transmit message FIFO can take right now.
+ *
+ * @param[in]  port     Pointer to the structure which holds this port's data.
+ * @return The free space in bytes. It can only grow until the next write.
+ */
+uint8_t MIDIUART_txSpace(midiport_t *port)
+{
+    uint8_t thishead;
+    uint8_t thistail;
+
+    thishead = port->txfifohead;
+    thistail = port->txfifotail;
+
+    if( thishead >= thistail )
+        return (MIDI_TX_FIFO_SIZE - 1) - (thishead - thistail);
+    else
+        return (thistail - thishead) - 1;
+}
+
+/**
+ * Queue a message on the MIDI OUT message FIFO if there is room for all of it,
+ * applying running status. The caller has interrupts masked, and has already
+ * sent a lone Real Time byte to its own lane. See MIDIUART_tryWriteMessage().
+ *
+ * @param[in]  port     Pointer to the structure which holds this port's data.
+ * @param[in]  msg      Pointer to an array of bytes that comprise a MIDI message.
+ * @param[in]  msize    The number of bytes in that message.
+ * @return true if the whole message was queued, false if nothing was.
+ */
+static bool MIDIUART_txQueue(midiport_t *port, const uint8_t *msg, uint8_t msize)
+{
+    uint8_t thishead;
+    uint8_t newstatus;
+
+    newstatus = port->txlaststatus;
+    if( port->txrunstatus )
+    {
+        if( *msg >= MIDI_MSG_TIMINGCLOCK )
+        {
+            // Real Time, no effect on running status.
+        }
+        else if( *msg >= MIDI_MSG_SOX )
+        {
+            // System Common or SysEx, which cancels running status.
+            newstatus = 0;
+        }
+        else if( *msg >= MIDI_MSG_NOTEOFF )
+        {
+            if( *msg == newstatus )
+            {
+                // receiver already has this status, skip it.
+                msg++;
+                msize--;
+            } else {
+                newstatus = *msg;
+            }
+        }
+    }
+
+    // Check to see if there is room in the FIFO for all of it.
+    if( MIDIUART_txSpace(port) < msize )
+        return false;
+
+    // Yes, there is room. Write the bytes to the message FIFO.
+    port->txlaststatus = newstatus;
+    thishead = port->txfifohead;
+    while( msize > 0 )
+    {
+        port->txmsgfifo[thishead] = *msg++;
+        thishead++;
+        if( MIDI_TX_FIFO_SIZE == thishead )
+            thishead = 0;
+        --msize; // one less byte in this message to send.
+    }
+
+    // bump write pointer.
+    port->txfifohead = thishead;
+
+    return true;
+}
+
+/**
+ * If the serial port is idle, kick-start it by tripping its interrupt, after
+ * something has been queued. A soft port's timer looks for new bytes on every
+ * bit, so it needs no kick.
+ *
+ * @param[in]  port     Pointer to the structure which holds this port's data.
+ */
+static inline void MIDIUART_txKick(midiport_t *port)
+{
+    if( port->txidle && (MU_TXMODE_SOFT != port->txmode) )
+    {
+        // enable unprivileged access to SWTRIG register.
+        //HWREG(NVIC_CFG_CTRL) |= NVIC_CFG_CTRL_MAIN_PEND;
+        MAP_IntTrigger(port->uartint);
+        //HWREG(NVIC_CFG_CTRL) &= ~NVIC_CFG_CTRL_MAIN_PEND;
+    }
+}
+
+/**
+ * Try to write the given message to the MIDI OUT message FIFO, all or nothing.
  *
  * @param[in]  port     Pointer to the structure which holds this port's data.
  * @param[in]  msg      Pointer to an array of bytes that comprise a MIDI message.
  * @param[in]  msize    The number of bytes in that message.
+ * @return true if the whole message was queued, false if there was not room
+ *         for it, in which case nothing was queued ("would block").
  *
- * This function will block if there is no room in the FIFO for the message.
+ * A message that is a single Real Time byte is handed to MIDIUART_writeRealTime()
+ * instead, so it doesn't wait behind everything in the FIFO.
+ *
+ * If running status is on, the status byte is checked first:
+ *  - A channel message (0x80 - 0xEF) with the same status as the last one sent
+ *    goes out without it. Otherwise it becomes the new running status.
+ *  - System Common and SysEx (0xF0 - 0xF7) cancel running status, so the next
+ *    channel message is sent in full.
+ *  - Real Time (0xF8 - 0xFF) may go out between any two bytes and leaves it alone.
+ *  - A message that starts with a data byte (SysEx continued from an earlier
+ *    call) is sent as is.
+ * Since the FIFO is sent in order, the last status we queued is the last one
+ * that goes out on the wire. The running status is only updated if the message
+ * is actually queued.
  *
- * After pushing a byte to the message FIFO, we check to see if the serial transmitter
- * is idle (not sending anything). If so, then we force a software trigger for the
- * serial port. The ISR will then check to see if there's anything in the message
- * FIFO, and since there will be, it'll send that along.
+ * Interrupts are masked while we check for room, copy the message in and bump
+ * the write pointer, so a second writer (an ISR, say) can't slip its bytes in
+ * between ours, and the transmitter never sees half a message. The write pointer
+ * is bumped once, after all of the bytes are in.
+ *
+ * After that, we check to see if the serial transmitter is idle (not sending
+ * anything). If so, then we force a software trigger for the serial port. The ISR
+ * will then check to see if there's anything in the message FIFO, and since there
+ * will be, it'll send that along.
  *
  * The serial transmitter's ISR is the only place that pops the message FIFO.
+ */
+bool MIDIUART_tryWriteMessage(midiport_t *port, uint8_t *msg, uint8_t msize)
+{
+    bool bIntStatus;
+    bool queued;
+
+    if( 0 == msize )
+        return true;
+
+    // A lone Real Time byte takes the fast lane.
+    if( (1 == msize) && (*msg >= MIDI_MSG_TIMINGCLOCK) )
+    {
+        return MIDIUART_writeRealTime(port, *msg);
+    }
+
+    bIntStatus = MAP_IntMasterDisable();
+    queued = MIDIUART_txQueue(port, msg, msize);
+    if( !bIntStatus )
+        MAP_IntMasterEnable();
+
+    if( queued )
+        MIDIUART_txKick(port);
+
+    return queued;
+}
+
+/**
+ * Write the given message to the MIDI OUT message FIFO.
  *
- * We capture the current state of the head and tail pointers for use in the
- * comparisons to ensure that they don't change in the middle of that comparison.
+ * @param[in]  port     Pointer to the structure which holds this port's data.
+ * @param[in]  msg      Pointer to an array of bytes that comprise a MIDI message.
+ * @param[in]  msize    The number of bytes in that message.
+ *
+ * This function will block if there is no room in the FIFO for the message.
+ * It waits until MIDIUART_tryWriteMessage() can queue the whole thing.
+ *
+ * A message longer than the FIFO can ever hold (a big SysEx) is queued in
+ * FIFO-sized pieces, so it may be interleaved with another writer's messages.
  */
 void MIDIUART_writeMessage(midiport_t *port, uint8_t *msg, uint8_t msize)
+{
+    uint8_t chunk;
+
+    while( msize > 0 )
+    {
+        chunk = msize;
+        if( chunk > MIDI_TX_FIFO_SIZE - 1 )
+            chunk = MIDI_TX_FIFO_SIZE - 1;
+
+        while( !MIDIUART_tryWriteMessage(port, msg, chunk) )
+        {
+            // wait for the transmitter to make some room.
+        }
+
+        msg += chunk;
+        msize -= chunk;
+    }
+}
+
+/**
+ * How many MIDI bytes a USB-MIDI event packet carries, by its Code Index Number.
+ * CIN 0 and 1 are reserved, so they carry nothing. SysEx packets (4 to 7) carry
+ * whatever bytes are in them, status or data.
+ */
+static const uint8_t MIDIUART_cinLength[16] =
+{
+    0, 0, 2, 3,     // reserved, cable events, 2- and 3-byte System Common
+    3, 1, 2, 3,     // SysEx starts or continues, ends with 1, 2 or 3 bytes
+    3, 3, 3, 3,     // note off, note on, poly pressure, control change
+    2, 2, 3, 1      // program change, channel pressure, pitch bend, single byte
+};
+
+/**
+ * Try to write the MIDI bytes of a USB-MIDI event packet to the MIDI OUT message
+ * FIFO, all or nothing, with MIDIUART_tryWriteMessage(). The cable number is not
+ * looked at, the caller has picked the port.
+ *
+ * @param[in]  port     Pointer to the structure which holds this port's data.
+ * @param[in]  msg      The event packet.
+ * @return true if it was queued, or carries nothing. false if there was not room.
+ */
+bool MIDIUART_tryWriteEvent(midiport_t *port, const USBMIDI_Message_t *msg)
+{
+    return MIDIUART_tryWriteMessage(port, (uint8_t *) &msg->byte1,
+                                    MIDIUART_cinLength[msg->header & 0x0F]);
+}
+
+/**
+ * Write the MIDI bytes of a run of USB-MIDI event packets to the MIDI OUT message
+ * FIFO, each one whole, in order, until one doesn't fit. The cable numbers are
+ * not looked at, the caller has picked the port.
+ *
+ * This is MIDIUART_tryWriteEvent() for a whole run at once: interrupts are masked
+ * once for the run, not once per event, and the transmitter is kicked once at
+ * the end. Each packet's length comes from MIDIUART_cinLength[], so the bytes
+ * are copied as they are. A SysEx message is several packets (CIN 4, then one of
+ * 5, 6 or 7 at the end), and each of them carries its own bytes, status or data,
+ * so they go out just as they come. Real Time bytes go to their own lane.
+ *
+ * @param[in]  port     Pointer to the structure which holds this port's data.
+ * @param[in]  msgs     The event packets.
+ * @param[in]  count    How many there are.
+ * @return how many were written. Fewer than count means the FIFO is full, and
+ *         the rest should be tried again later.
+ */
+uint32_t MIDIUART_tryWriteEvents(midiport_t *port, const USBMIDI_Message_t *msgs, uint32_t count)
+{
+    bool bIntStatus;
+    uint32_t idx;
+    uint8_t msize;
+
+    bIntStatus = MAP_IntMasterDisable();
+
+    for( idx = 0; idx < count; idx++ )
+    {
+        msize = MIDIUART_cinLength[msgs[idx].header & 0x0F];
+        if( 0 == msize )
+            continue;
+
+        if( (1 == msize) && (msgs[idx].byte1 >= MIDI_MSG_TIMINGCLOCK) )
+        {
+            if( !MIDIUART_writeRealTime(port, msgs[idx].byte1) )
+                break;
+        }
+        else if( !MIDIUART_txQueue(port, &msgs[idx].byte1, msize) )
+        {
+            break;
+        }
+    }
+
+    if( !bIntStatus )
+        MAP_IntMasterEnable();
+
+    if( idx )
+        MIDIUART_txKick(port);
+
+    return idx;
+}
+
+/**
+ * Write a stream of bytes to the MIDI OUT message FIFO as they are, as many as
+ * fit, for a raw stream such as a SysEx dump coming in pieces.
+ *
+ * @param[in]  port     Pointer to the structure which holds this port's data.
+ * @param[in]  buf      The bytes.
+ * @param[in]  size     How many there are.
+ * @return how many were queued.
+ *
+ * The bytes needn't be whole messages, so they aren't looked at. We can't tell
+ * what status the receiver is left with, so running status is cancelled, and the
+ * next message written goes in full.
+ */
+uint32_t MIDIUART_tryWriteRaw(midiport_t *port, const uint8_t *buf, uint32_t size)
 {
     bool bIntStatus;
+    uint8_t thishead;
+    uint32_t idx;
+
+    bIntStatus = MAP_IntMasterDisable();
+
+    if( size > MIDIUART_txSpace(port) )
+        size = MIDIUART_txSpace(port);
+
+    thishead = port->txfifohead;
+    for( idx = 0; idx < size; idx++ )
+    {
+        port->txmsgfifo[thishead] = buf[idx];
+        thishead++;
+        if( MIDI_TX_FIFO_SIZE == thishead )
+            thishead = 0;
+    }
+    port->txfifohead = thishead;
+    port->txlaststatus = 0;
+
+    if( !bIntStatus )
+        MAP_IntMasterEnable();
+
+    if( size )
+        MIDIUART_txKick(port);
+
+    return size;
+}
+
+/**
+ * Put one received byte in the receive ring buffer, or count it as dropped if
+ * the ring is full.
+ *
+ * @param[in,out] port  Pointer to the structure which holds this port's data.
+ * @param[in] newbyte   The byte.
+ */
+static void MIDIUART_thruByte(midiport_t *port, uint8_t newbyte);
+
+static inline void MIDIUART_rxPush(midiport_t *port, uint8_t newbyte)
+{
+    uint8_t nexthead;
+
+    nexthead = port->rxfifohead + 1;
+    if( MIDI_RX_FIFO_SIZE == nexthead )
+        nexthead = 0;
+
+    if( nexthead == port->rxfifotail )
+    {
+        // no room in the ring, lose this byte.
+        port->rxdropped++;
+    } else {
+        // write the byte before bumping the pointer, so the parser never
+        // sees the new head before the byte is there.
+        port->rxfifo[port->rxfifohead] = newbyte;
+        port->rxfifohead = nexthead;
+    }
+}
+
+/**
+ * Receive interrupt service for a serial MIDI port.
+ *
+ * @param[in,out] port  Pointer to the structure which holds this port's data.
+ *
+ * This is called from the port's ISR. Read every byte the UART has for us and
+ * push each one into the receive ring buffer. The ISR is the only place that
+ * writes rxfifohead, and MIDIUART_readMessages() is the only place that writes
+ * rxfifotail, so neither side needs to disable interrupts.
+ *
+ * If the ring is full, the new byte is dropped and counted. A UART overrun
+ * (a byte arrived before we read the previous one) is counted the same way.
+ */
+void MIDIUART_rxHandler(midiport_t *port)
+{
+    int32_t newbyte;
+
+    if( MU_TXMODE_SOFT == port->txmode )
+    {
+        while( SoftUARTCharsAvail(port->softuart) )
+        {
+            // the receive flags come along in the upper byte.
+            newbyte = SoftUARTCharGetNonBlocking(port->softuart);
+
+            // did the soft UART lose a byte before this one?
+            if( newbyte & (SOFTUART_RXERROR_OVERRUN << 8) )
+            {
+                port->rxdropped++;
+            }
+
+            // a break shows up as a zero byte, which is not MIDI.
+            if( !(newbyte & (SOFTUART_RXERROR_BREAK << 8)) )
+            {
+                MIDIUART_rxPush(port, (uint8_t) newbyte);
+                if( port->thrucount )
+                    MIDIUART_thruByte(port, (uint8_t) newbyte);
+            }
+        }
+        return;
+    }
+
+    while( MAP_UARTCharsAvail(port->uartbase) )
+    {
+        newbyte = MAP_UARTCharGetNonBlocking(port->uartbase);
+
+        // did the UART lose a byte before this one?
+        if( MAP_UARTRxErrorGet(port->uartbase) & UART_RXERROR_OVERRUN )
+        {
+            port->rxdropped++;
+            MAP_UARTRxErrorClear(port->uartbase);
+        }
+
+        MIDIUART_rxPush(port, (uint8_t) newbyte);
+        if( port->thrucount )
+            MIDIUART_thruByte(port, (uint8_t) newbyte);
+    }
+}
+
+/**
+ * Hand the next contiguous run of the message FIFO to the uDMA.
+ *
+ * @param[in,out] port  Pointer to the structure which holds this port's data.
+ *
+ * The run goes from the read pointer to either the write pointer or the end
+ * of the buffer, whichever comes first. If the write pointer has wrapped, the
+ * rest goes in the next run. The read pointer is not moved until the run is
+ * done, so MIDIUART_writeMessage() still sees those bytes as taken.
+ *
+ * A byte waiting in the Real Time lane is sent first, as a run of its own.
+ */
+static void MIDIUART_txStartDMA(midiport_t *port)
+{
     uint8_t thishead;
     uint8_t thistail;
+    uint8_t *src;
 
-    while( msize > 0 )
+    // Real Time first. It gets a run of its own, one byte long.
+    if( port->txrttail != port->txrthead )
+    {
+        port->txdmart = true;
+        port->txdmacount = 1;
+        src = &port->txrtfifo[port->txrttail];
+    }
+    else
     {
         thishead = port->txfifohead;
         thistail = port->txfifotail;
 
-        // Check to see if there is room in the FIFO.
-        if( ((thishead + 1) % MIDI_TX_FIFO_SIZE) != thistail )
+        if( thishead == thistail )
         {
-            // Yes, there is room.
-        	// Write the byte to the message FIFO.
-        	port->txmsgfifo[port->txfifohead] = *msg++;
+            // nothing more to load into transmitter, so ..
+            port->txdmacount = 0;
+            port->txidle = 1;
+            return;
+        }
 
-        	// bump write pointer.
-        	bIntStatus = MAP_IntMasterDisable();
-        	port->txfifohead++;
-        	if( MIDI_TX_FIFO_SIZE == port->txfifohead )
-        	{
-        		port->txfifohead = 0;
-        	}
+        port->txdmart = false;
+        if( thishead > thistail )
+            port->txdmacount = thishead - thistail;
+        else
+            port->txdmacount = MIDI_TX_FIFO_SIZE - thistail;
+        src = &port->txmsgfifo[thistail];
+    }
 
-        	--msize; // one less byte in this message to send.
+    // so message-fifo write won't try to kick-start.
+    port->txidle = 0; // busy!
 
-        	if( !bIntStatus )
-                MAP_IntMasterEnable();
+    MAP_uDMAChannelTransferSet(port->txdmachan | UDMA_PRI_SELECT, UDMA_MODE_BASIC,
+                               src, (void *) (port->uartbase + UART_O_DR),
+                               port->txdmacount);
+    MAP_uDMAChannelEnable(port->txdmachan);
+}
+
+/**
+ * Load one byte into the transmitter, the UART or the soft UART.
+ */
+static inline void MIDIUART_txPut(midiport_t *port, uint8_t txbyte)
+{
+    if( MU_TXMODE_SOFT == port->txmode )
+        SoftUARTCharPutNonBlocking(port->softuart, txbyte);
+    else
+        MAP_UARTCharPutNonBlocking(port->uartbase, txbyte);
+}
 
-            // if the serial port is idle, kick-start it by tripping its interrupt.
-            if( port->txidle )
+/**
+ * Can the transmitter take another byte in this go? Only in the modes with
+ * a FIFO to fill. In EOT mode it's one byte per interrupt.
+ */
+static inline bool MIDIUART_txRoom(midiport_t *port)
+{
+    switch( port->txmode )
+    {
+    case MU_TXMODE_FIFO:
+        return MAP_UARTSpaceAvail(port->uartbase);
+    case MU_TXMODE_SOFT:
+        return SoftUARTSpaceAvail(port->softuart);
+    default:
+        return false;
+    }
+}
+
+/**
+ * Transmit interrupt service for a serial MIDI port.
+ *
+ * @param[in,out] port  Pointer to the structure which holds this port's data.
+ * @param[in] status    The masked UART interrupt status read by the ISR. This is
+ *                      zero when the ISR was invoked by the software trigger.
+ *
+ * The transmitter is only touched when it asked for more (UART_INT_TX, or
+ * UART_INT_DMATX in DMA mode) or when it is idle, which is the kick-start from
+ * a writer. A receive interrupt in the middle of a byte must
+ * not load another one in EOT mode.
+ *
+ * In EOT mode, pop one byte from the message FIFO and send it. In FIFO mode,
+ * keep popping until the message FIFO is empty or the UART's FIFO is full.
+ * In DMA mode, retire the run the uDMA just finished and start the next one.
+ * In every mode, the Real Time lane is emptied before the message FIFO.
+ *
+ * If the message FIFO runs dry, set the idle flag so the next write will
+ * kick-start us. In FIFO mode this must also happen when we only partly filled
+ * the UART FIFO, as it may never drain down through the trigger level and
+ * we would not get another interrupt.
+ *
+ * This is the only place that writes txfifotail and txrttail, so we don't need
+ * to disable interrupts. The heads have several writers: the main loop through
+ * MIDIUART_tryWriteMessage() (and so MIDIUART_writeMessage()),
+ * MIDIUART_tryWriteEvents(), MIDIUART_tryWriteRaw() and MIDIUART_writeRealTime(),
+ * the USB interrupt through MIDIUART_tryWriteRaw(), and the receive ISR of a port
+ * that thrus to this one. Each of them masks interrupts while it checks for room,
+ * writes its bytes and bumps the head, so they can't get in each other's way. We
+ * only ever see a head that has been bumped past whole writes.
+ */
+void MIDIUART_txHandler(midiport_t *port, uint32_t status)
+{
+    uint8_t thistail;
+
+    if( MU_TXMODE_DMA == port->txmode )
+    {
+        if( status & UART_INT_DMATX )
+        {
+            // the last run is out of the buffer, give its space back.
+            if( port->txdmart )
             {
-                // enable unprivileged access to SWTRIG register.
-                //HWREG(NVIC_CFG_CTRL) |= NVIC_CFG_CTRL_MAIN_PEND;
-                MAP_IntTrigger(port->uartint);
-                //HWREG(NVIC_CFG_CTRL) &= ~NVIC_CFG_CTRL_MAIN_PEND;
+                thistail = port->txrttail + 1;
+                if( MIDI_TX_RT_FIFO_SIZE == thistail )
+                    thistail = 0;
+                port->txrttail = thistail;
             }
+            else
+            {
+                thistail = port->txfifotail + port->txdmacount;
+                if( thistail >= MIDI_TX_FIFO_SIZE )
+                    thistail -= MIDI_TX_FIFO_SIZE;
+                port->txfifotail = thistail;
+            }
+            MIDIUART_txStartDMA(port);
+        }
+        else if( port->txidle )
+        {
+            MIDIUART_txStartDMA(port);
+        }
+        return;
+    }
+
+    if( !(status & UART_INT_TX) && !port->txidle )
+        return;
 
-    	}
+    do {
+        if( port->txrttail != port->txrthead )
+        {
+            // Real Time goes first, wherever we are in the message FIFO.
+            thistail = port->txrttail;
+            MIDIUART_txPut(port, port->txrtfifo[thistail]);
+            thistail++;
+            if( MIDI_TX_RT_FIFO_SIZE == thistail )
+                thistail = 0;
+            port->txrttail = thistail;
+        }
+        else if( port->txfifotail != port->txfifohead )
+        {
+            // Pop the message FIFO, send that byte.
+            thistail = port->txfifotail;
+            MIDIUART_txPut(port, port->txmsgfifo[thistail]);
+
+            // bump read pointer.
+            thistail++;
+            if( MIDI_TX_FIFO_SIZE == thistail )
+                thistail = 0;
+            port->txfifotail = thistail;
+        }
+        else
+        {
+            // nothing more to load into transmitter, so ..
+            port->txidle = 1;
+            break;
+        }
+
+        // so message-fifo write won't try to kick-start.
+        port->txidle = 0; // busy!
+
+    } while( MIDIUART_txRoom(port) );
+}
+
+/**
+ * The body of a serial MIDI port's ISR.
+ *
+ * @param[in] port  Pointer to the structure which holds this port's data.
+ *
+ * Each UART has its own interrupt vector, and an ISR can't take an argument, so
+ * midi_ports.c makes a little ISR for each port which just calls this with that
+ * port's structure.
+ *
+ * The ISR is invoked for the transmitter under two conditions:
+ *
+ * a) By a software trigger. If the transmitter is idle when a new byte is written
+ *    to the message FIFO, a software trigger is fired. A software trigger shows
+ *    none of the UART's interrupts as active.
+ *
+ * b) When the transmitter wants more, which depends on the transmit mode.
+ *
+ * Either way MIDIUART_txHandler() sorts it out. The receive, receive timeout and
+ * overrun interrupts move the received bytes into the receive ring buffer.
+ *
+ * Each side of each ring buffer has only one writer, so there is no need to mask
+ * interrupts here.
+ */
+void MIDIUART_intHandler(midiport_t *port)
+{
+    uint32_t status;
+
+    // Which interrupts are active? Clear them:
+    status = MAP_UARTIntStatus(port->uartbase, true);
+    MAP_UARTIntClear(port->uartbase, status);
+
+    // Empty the receiver first, it can't wait.
+    if( status & (UART_INT_RX | UART_INT_RT | UART_INT_OE) )
+    {
+        MIDIUART_rxHandler(port);
     }
+
+    MIDIUART_txHandler(port, status);
 }
 
 /**
@@ -248,77 +1103,287 @@ void MIDIUART_writeMessage(midiport_t *port, uint8_t *msg, uint8_t msize)
  *******************************************************************************/
 
 /**
- * Build a complete MIDI message in the USB-MIDI packet format from bytes received
+ * Status byte decoder table.
+ * For every possible status byte, this gives the Code Index Number of the USB-MIDI
+ * packet it starts and the number of data bytes that follow it. Entries for data
+ * bytes (0x00 - 0x7F) are not used. SOX and Real Time (0xF8 - 0xFF) are handled
+ * separately by the parser.
+ */
+typedef struct
+{
+    uint8_t cin;        //!< Code Index Number for a packet with this status
+    uint8_t datalen;    //!< number of data bytes which follow this status
+} MIDIUART_statusinfo_t;
+
+/*
+ * Sixteen identical table entries, one for each MIDI channel.
+ */
+#define MU_X16(c, n)    { c, n }, { c, n }, { c, n }, { c, n }, \
+                        { c, n }, { c, n }, { c, n }, { c, n }, \
+                        { c, n }, { c, n }, { c, n }, { c, n }, \
+                        { c, n }, { c, n }, { c, n }, { c, n }
+
+static const MIDIUART_statusinfo_t MIDIUART_statusTable[256] =
+{
+    // 0x00 - 0x7F are data bytes.
+    MU_X16(0, 0), MU_X16(0, 0), MU_X16(0, 0), MU_X16(0, 0),
+    MU_X16(0, 0), MU_X16(0, 0), MU_X16(0, 0), MU_X16(0, 0),
+    // Channel Voice messages, one row of 16 channels each.
+    MU_X16(USB_MIDI_CIN_NOTEOFF, 2),        // 0x80
+    MU_X16(USB_MIDI_CIN_NOTEON, 2),         // 0x90
+    MU_X16(USB_MIDI_CIN_POLYKEYPRESS, 2),   // 0xA0
+    MU_X16(USB_MIDI_CIN_CTRLCHANGE, 2),     // 0xB0
+    MU_X16(USB_MIDI_CIN_PROGCHANGE, 1),     // 0xC0
+    MU_X16(USB_MIDI_CIN_CHANPRESSURE, 1),   // 0xD0
+    MU_X16(USB_MIDI_CIN_PITCHBEND, 2),      // 0xE0
+    // System Common and Real Time messages.
+    { USB_MIDI_CIN_SYSEXSTART, 0 },             // 0xF0 SOX, handled by the parser
+    { USB_MIDI_CIN_SYSCOM2, 1 },                // 0xF1 MTC quarter frame
+    { USB_MIDI_CIN_SYSCOM3, 2 },                // 0xF2 song position pointer
+    { USB_MIDI_CIN_SYSCOM2, 1 },                // 0xF3 song select
+    { USB_MIDI_CIN_SYSEND1, 0 },                // 0xF4 undefined
+    { USB_MIDI_CIN_SYSEND1, 0 },                // 0xF5 undefined
+    { USB_MIDI_CIN_SYSEND1, 0 },                // 0xF6 tune request
+    { USB_MIDI_CIN_SINGLEBYTE, 0 },             // 0xF7 EOX
+    { USB_MIDI_CIN_SINGLEBYTE, 0 },             // 0xF8 timing clock
+    { USB_MIDI_CIN_SINGLEBYTE, 0 },             // 0xF9 undefined
+    { USB_MIDI_CIN_SINGLEBYTE, 0 },             // 0xFA start
+    { USB_MIDI_CIN_SINGLEBYTE, 0 },             // 0xFB continue
+    { USB_MIDI_CIN_SINGLEBYTE, 0 },             // 0xFC stop
+    { USB_MIDI_CIN_SINGLEBYTE, 0 },             // 0xFD undefined
+    { USB_MIDI_CIN_SINGLEBYTE, 0 },             // 0xFE active sensing
+    { USB_MIDI_CIN_SINGLEBYTE, 0 }              // 0xFF system reset
+};
+
+/**
+ * Send one received byte thru to the port's thru destinations.
+ *
+ * @param[in,out] port  Pointer to the structure for the port that received it.
+ * @param[in] newbyte   The byte.
+ *
+ * This is called from the receive ISR. See MIDIUART_setThru().
+ *
+ * Without merge, the byte is simply written to each destination. With merge,
+ * it is added to the message being framed in port->thrumsg, and the message is
+ * written when it is complete. A data byte with no message started uses the
+ * running status of the input, so each message written has its status byte.
+ * The destination may then leave it out again, if it uses running status.
+ */
+static void MIDIUART_thruByte(midiport_t *port, uint8_t newbyte)
+{
+    uint8_t *msg;
+    uint8_t msize;
+    uint8_t idx;
+
+    if( !port->thrumerge || (newbyte >= MIDI_MSG_TIMINGCLOCK) )
+    {
+        // as is, and Real Time is always as is.
+        msg = &newbyte;
+        msize = 1;
+    }
+    else
+    {
+        if( newbyte >= MIDI_MSG_NOTEOFF )
+        {
+            // a status byte starts a new message, and ends any SysEx.
+            port->thrulen = 0;
+            port->thrusysex = (MIDI_MSG_SOX == newbyte);
+            if( newbyte >= MIDI_MSG_SOX )
+            {
+                // System Common and SysEx cancel running status.
+                port->thrustatus = 0;
+                if( port->thrusysex || (MIDI_MSG_EOX == newbyte) )
+                    return;
+            }
+            else
+            {
+                port->thrustatus = newbyte;
+            }
+            port->thrumsg[0] = newbyte;
+            port->thrulen = 1;
+            port->thruneed = 1 + MIDIUART_statusTable[newbyte].datalen;
+        }
+        else
+        {
+            if( port->thrusysex )
+                return;
+
+            if( 0 == port->thrulen )
+            {
+                // running status, if there is any.
+                if( 0 == port->thrustatus )
+                    return;
+                port->thrumsg[0] = port->thrustatus;
+                port->thrulen = 1;
+                port->thruneed = 1 + MIDIUART_statusTable[port->thrustatus].datalen;
+            }
+            port->thrumsg[port->thrulen++] = newbyte;
+        }
+
+        if( port->thrulen < port->thruneed )
+            return;
+
+        // it's whole.
+        msg = port->thrumsg;
+        msize = port->thruneed;
+        port->thrulen = 0;
+    }
+
+    for( idx = 0; idx < port->thrucount; idx++ )
+    {
+        if( !MIDIUART_tryWriteMessage(port->thrudest[idx], msg, msize) )
+            port->thrudropped++;
+    }
+}
+
+/**
+ * Take the next byte from the receive ring if it is there and isn't Real Time,
+ * which is every byte the state machine would take as the next one of a packet.
+ *
+ * @param[in] port      Pointer to the structure which holds this port's data.
+ * @param[in,out] tail  The parser's copy of the ring's read pointer.
+ * @param[in] head      The ring's write pointer.
+ * @param[out] newbyte  The byte.
+ * @return True if there was such a byte.
+ */
+static inline bool MIDIUART_rxNext(const midiport_t *port, uint8_t *tail, uint8_t head, uint8_t *newbyte)
+{
+    if ((*tail == head) || (port->rxfifo[*tail] >= MIDI_MSG_TIMINGCLOCK))
+        return false;
+
+    *newbyte = port->rxfifo[*tail];
+    (*tail)++;
+    if (MIDI_RX_FIFO_SIZE == *tail) {
+        *tail = 0;
+    }
+    return true;
+}
+
+/**
+ * Build complete MIDI messages in the USB-MIDI packet format from bytes received
  * from the serial MIDI IN port. The USB-MIDI packet format is chosen for convenience
  * and in ease of parsing.
  *
- * This method should be called on a periodic basis. Bytes received from the serial
- * port go into the port's FIFO. This ensures that we don't lose message bytes while
- * we are busy doing other things.
+ * Every byte in the ring is run through the state machine, and each packet it
+ * completes is copied to the next slot in msgs. Real Time bytes skip the state
+ * machine and become single-byte packets right away, so a clock in the middle of
+ * a note or a SysEx doesn't break it. We stop when the ring is empty or
+ * msgs is full. A message whose bytes have not all arrived stays in the port
+ * structure (port->rxmsg) and is finished on a later call. It is kept there rather
+ * than with the caller because running status and SysEx continuation need what
+ * was in the previous packet.
  *
- * When this method is called, the port->rxstate of that FIFO is checked, and if one or
- * more bytes are waiting, we pop them and build a message packet. After an entire
- * packet has been received, the function returns true.
+ * The rest of a message is usually in the ring already, so a state that wants
+ * another byte takes it with MIDIUART_rxNext() and falls through to the next
+ * state, instead of going round the loop once per byte.
  *
- * This function will not return until there are no more bytes in the serial receiver
- * FIFO. It may require multiple calls to this function to complete a message.
+ * The state machine and the packet under construction are copied into locals on
+ * entry and written back on the way out, so the compiler can keep them in registers
+ * instead of going back to the port structure for every byte. Likewise the ring's
+ * read pointer is written back once, so the ISR sees the space freed all at once.
  *
- * To support more than one serial MIDI port, we have a parameter midiport which
- * is a pointer to a structure that has info necessary to distinguish this port
- * from another. All of the port status and port->rxstate machine info are in that structure.
+ * This is inlined into MIDIUART_readMessages() and MIDIUART_readMessage(), so the
+ * latter gets a copy of its own with max fixed at one, and doesn't pay for the
+ * batch loop.
  *
- * @param[in] uartbase  The base address of the UART peripheral used for MIDI.
- * @param[in,out] msg   The assembled USB-MIDI message packet is returned here.
- * @return True when msg contains an entire USB-MIDI message packet.
+ * @param[in,out] port  Pointer to the structure which holds this port's data.
+ * @param[out] msgs     Array to hold the assembled USB-MIDI message packets.
+ * @param[in] max       The number of packets msgs can hold.
+ * @return The number of packets written to msgs.
  */
-bool MIDIUART_readMessage(midiport_t *port, USBMIDI_Message_t *msg)
+#if defined(ewarm)
+#pragma inline=forced
+#elif defined(ccs)
+#pragma FUNC_ALWAYS_INLINE(MIDIUART_parse)
+#else
+static inline uint32_t MIDIUART_parse(midiport_t *port, USBMIDI_Message_t *msgs, uint32_t max)
+    __attribute__ ((always_inline));
+#endif
+static inline uint32_t MIDIUART_parse(midiport_t *port, USBMIDI_Message_t *msgs, uint32_t max)
 {
-    // these are newly assigned at every call.
-    bool done;                                  //!< indicates packet finished or not, the return value
+    uint32_t count;                             //!< packets written to msgs, the return value
+    bool done;                                  //!< indicates packet finished or not
     uint8_t newbyte;                            //!< This was read from the FIFO
+    uint8_t thishead;                           //!< write location in the receive ring
+    uint8_t thistail;                           //!< next read location in the receive ring
+    USBMIDI_Message_t msg;                      //!< the packet under construction
+    MIDIUART_rxstate_t rxstate;                 //!< local copies of the parser state
+    uint8_t cin;
+    uint8_t bytecnt;
+    uint8_t bytesinpacket;
 
-    // start not done, obviously. This will be set as necessary.
+    count = 0;
     done = false;
+    thishead = port->rxfifohead;
+    thistail = port->rxfifotail;
+
+    msg = port->rxmsg;
+    rxstate = port->rxstate;
+    cin = port->cin;
+    bytecnt = port->bytecnt;
+    bytesinpacket = port->bytesinpacket;
 
-    // now stay here until we've read and handled an entire packet, or we've
-    // emptied the receive FIFO and we have to wait for more bytes.
+    // now stay here until we've filled the caller's array, or we've
+    // emptied the receive ring and we have to wait for more bytes.
 
-    while (!done && MAP_UARTCharsAvail(port->uartbase))
+    while ((count < max) && (thistail != thishead))
     {
-        // Get the next byte in the FIFO. The port->rxstate decoder will decide what it is
+        // Get the next byte in the ring. The rxstate decoder will decide what it is
         // and what to do with it.
-        newbyte = MAP_UARTCharGet(port->uartbase);
+        newbyte = port->rxfifo[thistail];
+        thistail++;
+        if (MIDI_RX_FIFO_SIZE == thistail) {
+            thistail = 0;
+        }
 
-        switch (port->rxstate) {
+        // Real Time messages can land between any two bytes, even in the middle
+        // of another message or a SysEx. Send each one on as a packet of its own
+        // and carry on with whatever we were building.
+        if (newbyte >= MIDI_MSG_TIMINGCLOCK) {
+            msgs[count].header = USB_MIDI_HEADER(port->cablenum, USB_MIDI_CIN_SINGLEBYTE);
+            msgs[count].byte1 = newbyte;
+            msgs[count].byte2 = 0x00;
+            msgs[count].byte3 = 0x00;
+            count++;
+            continue;
+        }
+
+        switch (rxstate) {
             case MU_IDLE :
                 // clear byte2 and byte3 here, on the chance that this newest message
                 // will not need them.
-                msg->byte2 = 0x00;
-                msg->byte3 = 0x00;
+                msg.byte2 = 0x00;
+                msg.byte3 = 0x00;
 
                 // Is it a SOX byte?
                 if (newbyte == MIDI_MSG_SOX) {
                     // SYSEX messages require at least one data byte before EOX, so
-                    // we must fetch it. At this point we don't know which port->cin to use.
+                    // we must fetch it. At this point we don't know which cin to use.
                     // But we do know that byte1 is the SOX byte.
-                    msg->byte1 = MIDI_MSG_SOX;
-                    port->rxstate = MU_SYSEX1;
+                    msg.byte1 = MIDI_MSG_SOX;
+                    rxstate = MU_SYSEX1;
 
                 } else if (newbyte < 0x80) {
-                    // running status now active. Use the previous port->cin/CN and
+                    // running status now active. Use the previous cin/CN and
                     // byte1 (the previous status). The byte we just read is
                     // byte2 of the packet.
-                    msg->byte2 = newbyte;
+                    msg.byte2 = newbyte;
 
                     // See if we need one more byte to complete the packet.
                     // If so, wait for it, otherwise this packet is done.
-                    if (port->bytesinpacket == 2) {
-                        // yes, one more data byte to fetch:
-                        port->rxstate = MU_DATABYTE3;
+                    if (bytesinpacket == 2) {
+                        // yes, one more data byte to fetch. Take it now if it's here.
+                        if (MIDIUART_rxNext(port, &thistail, thishead, &newbyte)) {
+                            msg.byte3 = newbyte;
+                            rxstate = MU_IDLE;
+                            done = true;
+                        } else {
+                            rxstate = MU_DATABYTE3;
+                        }
                     } else {
                         // no more for this packet, send it. Note we cleared byte
-                        // at entry to this port->rxstate.
-                        port->rxstate = MU_IDLE;
+                        // at entry to this rxstate.
+                        rxstate = MU_IDLE;
                         done = true;
                     } // bytes in packet
 
@@ -327,157 +1392,108 @@ bool MIDIUART_readMessage(midiport_t *port, USBMIDI_Message_t *msg)
                     // not SOX, but it is some kind of status.
                     // What is it? This will let us fill in the Code Index Number
                     // as well as determining how many data bytes will follow.
-                    // Make sure to mask off the channel number.
+                    // The status table is indexed by the whole byte, channel and all.
                     // The "single byte" message cannot originate from the UART, as far
                     // as I can tell.
 
-                    switch (newbyte & 0xF0) {
-                    case MIDI_MSG_NOTEOFF :
-                        port->cin = USB_MIDI_CIN_NOTEOFF;
-                        port->bytesinpacket = 2;
-                        break;
-                    case MIDI_MSG_NOTEON :
-                        port->cin = USB_MIDI_CIN_NOTEON;
-                        port->bytesinpacket = 2;
-                        break;
-                    case MIDI_MSG_POLYPRESSURE :
-                        port->cin = USB_MIDI_CIN_POLYKEYPRESS;
-                        port->bytesinpacket = 2;
-                        break;
-                    case MIDI_MSG_CTRLCHANGE :
-                        port->cin = USB_MIDI_CIN_CTRLCHANGE;
-                        port->bytesinpacket = 2;
-                        break;
-                    case MIDI_MSG_PROGCHANGE :
-                        port->cin = USB_MIDI_CIN_PROGCHANGE;
-                        port->bytesinpacket = 1;
-                        break;
-                    case MIDI_MSG_CHANNELPRESSURE :
-                        port->cin = USB_MIDI_CIN_CHANPRESSURE;
-                        port->bytesinpacket = 1;
-                        break;
-                    case MIDI_MSG_PITCHBEND :
-                        port->cin = USB_MIDI_CIN_PITCHBEND;
-                        port->bytesinpacket = 2;
-                        break;
-                    case MIDI_MSG_SOX :
-                        // this is cheating, because I don't handle SOX here, but I need
-                        // to handle the other System Common messages.
-                        switch (newbyte) {
-                        case  MIDI_MSG_MTCQF :
-                        case  MIDI_MSG_SS :
-                            // two-byte System Common (one data byte)
-                            port->cin = USB_MIDI_CIN_SYSCOM2;
-                            port->bytesinpacket = 1;
-                            break;
-                        case MIDI_MSG_SPP :
-                            // three byte System Common (two data bytes)
-                            port->cin = USB_MIDI_CIN_SYSCOM3;
-                            port->bytesinpacket = 2;
-                            break;
-                        case MIDI_MSG_F4 :
-                        case MIDI_MSG_F5 :
-                        case MIDI_MSG_TUNEREQ :
-                            // one byte System Common (no data byte)
-                            port->cin = USB_MIDI_CIN_SYSEND1;
-                            port->bytesinpacket = 0;
-                            break;
-                        default :
-                            // the rest are Real Time messages with no data.
-                            port->cin = USB_MIDI_CIN_SINGLEBYTE;
-                            port->bytesinpacket = 0;
-                            break;
-                        } // inner switch (if MIDI_MSG_SOX)
-                        break;
-                    default:
-                        // not possible.
-                        break;
-                    } // switch (newbyte & 0xF0)
+                    cin = MIDIUART_statusTable[newbyte].cin;
+                    bytesinpacket = MIDIUART_statusTable[newbyte].datalen;
 
                     // now we know how many bytes we need to fetch from the FIFO
-                    // to finish up this packet, so set the next port->rxstate properly.
-                    if (0 == port->bytesinpacket) {
+                    // to finish up this packet, so set the next rxstate properly.
+                    if (0 == bytesinpacket) {
                         // we do not need to fetch any more bytes for this packet.
                         done = true;
-                        port->rxstate = MU_IDLE;
+                        rxstate = MU_IDLE;
                     } else {
                         // we need to fill at least mep->byte2 and possibly byte3
-                        port->bytecnt = port->bytesinpacket;
-                        port->rxstate = MU_DATABYTE2;
+                        bytecnt = bytesinpacket;
+                        rxstate = MU_DATABYTE2;
                     }
 
                     // The status byte is byte 1 of our packet.
-                    msg->byte1 = newbyte;
+                    msg.byte1 = newbyte;
 
                     // and we know the event header byte from the Code Index Number
                     // we set above.
-                    msg->header = USB_MIDI_HEADER(port->cablenum, port->cin);
+                    msg.header = USB_MIDI_HEADER(port->cablenum, cin);
 
                 } // if newbyte
-                break; // out of idle.
+
+                // with its first data byte already in the ring, go straight on to it.
+                if ((MU_DATABYTE2 != rxstate) || !MIDIUART_rxNext(port, &thistail, thishead, &newbyte)) {
+                    break; // out of idle.
+                }
+                // fall through
 
             case MU_DATABYTE2 :
                 // the next thing in the FIFO is byte2 of the midi event packet.
-                msg->byte2 = newbyte;
-                --(port->bytecnt);
+                msg.byte2 = newbyte;
+                --bytecnt;
 
                 // if there is one more byte in this packet, we have to read it,
                 // otherwise we are done.
-                if (port->bytecnt) {
-                    port->rxstate = MU_DATABYTE3;
+                if (bytecnt) {
+                    rxstate = MU_DATABYTE3;
                 } else {
-                    port->rxstate = MU_IDLE;
+                    rxstate = MU_IDLE;
                     done = true;
                 }
-                break;
+                if (done || !MIDIUART_rxNext(port, &thistail, thishead, &newbyte)) {
+                    break;
+                }
+                // fall through
 
             case MU_DATABYTE3 :
                 // get the last byte of the packet from the serial receive FIFO,
                 // and we are done. we no longer care about bytecnt.
-                msg->byte3 = newbyte;
+                msg.byte3 = newbyte;
                 done = true;
-                port->rxstate = MU_IDLE;
+                rxstate = MU_IDLE;
                 break;
 
             case MU_SYSEX1 :
                 // we are here because we got a SOX byte. There must be at least
                 // one data byte in a SYSEX packet, so read it from the FIFO.
-                msg->byte2 = newbyte;
+                msg.byte2 = newbyte;
 
                 // if this byte is EOX, then this is that special two-byte SysEx
                 // packet, which means we are done. it also means we know which
-                // port->cin to assign.
-                if (msg->byte2 == MIDI_MSG_EOX) {
-                    msg->header = USB_MIDI_HEADER(port->cablenum, USB_MIDI_CIN_SYSEND2);
+                // cin to assign.
+                if (msg.byte2 == MIDI_MSG_EOX) {
+                    msg.header = USB_MIDI_HEADER(port->cablenum, USB_MIDI_CIN_SYSEND2);
                     done = true;
-                    port->rxstate = MU_IDLE;
+                    rxstate = MU_IDLE;
                 } else {
                     // there is at least one more data byte, so go fetch it.
-                    port->rxstate = MU_SYSEX2;
+                    rxstate = MU_SYSEX2;
                 }
-                break;
+                if (done || !MIDIUART_rxNext(port, &thistail, thishead, &newbyte)) {
+                    break;
+                }
+                // fall through
 
             case MU_SYSEX2 :
                 // we are here because we are in a SysEx packet and there is another
                 // byte for it. This will fill the MIDI packet byte 3.
-                msg->byte3 = newbyte;
+                msg.byte3 = newbyte;
 
                 // if this byte is EOX, then we have the special three-byte SysEx
-                // packet, which means we are done. It also means we know which port->cin
+                // packet, which means we are done. It also means we know which cin
                 // to assign.
-                if (msg->byte3 == MIDI_MSG_EOX) {
-                    msg->header = USB_MIDI_HEADER(port->cablenum, USB_MIDI_CIN_SYSEND3);
-                    port->rxstate = MU_IDLE;
+                if (msg.byte3 == MIDI_MSG_EOX) {
+                    msg.header = USB_MIDI_HEADER(port->cablenum, USB_MIDI_CIN_SYSEND3);
+                    rxstate = MU_IDLE;
                 } else {
                     // it's not the end of the packet. There is more. But we have
                     // completely filled our MIDI packet, so send it off.
-                    msg->header = USB_MIDI_HEADER(port->cablenum, USB_MIDI_CIN_SYSEXSTART);
+                    msg.header = USB_MIDI_HEADER(port->cablenum, USB_MIDI_CIN_SYSEXSTART);
                     // but we know that the next byte in the serial receive FIFO is
                     // part of the SysEx message, so go get it.
-                    port->rxstate = MU_SYSEX1;
+                    rxstate = MU_SYSEX1;
                 }
 
-                // in any case if we are in this port->rxstate we've filled an entire packet
+                // in any case if we are in this rxstate we've filled an entire packet
                 // so send it.
                 done = true;
 
@@ -486,9 +1502,62 @@ bool MIDIUART_readMessage(midiport_t *port, USBMIDI_Message_t *msg)
             default :
                 // never get here.
                 break;
-        } // end of port->rxstate register switch
+        } // end of rxstate register switch
+
+        if (done) {
+            msgs[count++] = msg;
+            done = false;
+        }
     } // end of while (we've got something to read and process
 
-    // tell caller if we have a complete packet or not.
-    return done;
+    // Only bump the read pointer after the bytes have been fetched, so the
+    // ISR can't overwrite them.
+    port->rxfifotail = thistail;
+
+    port->rxmsg = msg;
+    port->rxstate = rxstate;
+    port->cin = cin;
+    port->bytecnt = bytecnt;
+    port->bytesinpacket = bytesinpacket;
+
+    return count;
+}
+
+/**
+ * Build complete MIDI messages in the USB-MIDI packet format from bytes received
+ * from the serial MIDI IN port, as many as are waiting and fit in msgs.
+ *
+ * This method should be called on a periodic basis. Bytes received from the serial
+ * port go into the port's receive ring. This ensures that we don't lose message bytes
+ * while we are busy doing other things. See MIDIUART_parse().
+ *
+ * @param[in,out] port  Pointer to the structure which holds this port's data.
+ * @param[out] msgs     Array to hold the assembled USB-MIDI message packets.
+ * @param[in] max       The number of packets msgs can hold.
+ * @return The number of packets written to msgs.
+ */
+uint32_t MIDIUART_readMessages(midiport_t *port, USBMIDI_Message_t *msgs, uint32_t max)
+{
+    return MIDIUART_parse(port, msgs, max);
+}
+
+/**
+ * Build one complete MIDI message in the USB-MIDI packet format from bytes received
+ * from the serial MIDI IN port.
+ *
+ * Bytes are popped from the receive ring until a packet is complete or the ring is
+ * empty. It may require multiple calls to this function to complete a message.
+ * See MIDIUART_readMessages() to fetch everything that is waiting in one call.
+ *
+ * To support more than one serial MIDI port, we have a parameter midiport which
+ * is a pointer to a structure that has info necessary to distinguish this port
+ * from another. All of the port status and port->rxstate machine info are in that structure.
+ *
+ * @param[in,out] port  Pointer to the structure which holds this port's data.
+ * @param[out] msg      The assembled USB-MIDI message packet is returned here.
+ * @return True when msg contains an entire USB-MIDI message packet.
+ */
+bool MIDIUART_readMessage(midiport_t *port, USBMIDI_Message_t *msg)
+{
+    return (MIDIUART_parse(port, msg, 1) != 0);
 }
@@ -9,6 +9,25 @@
  *  2020-01-21 andy. The midiport_t structure now has the transmit ring buffer included.
  *  2020-01-29 andy. message FIFO has only head and tail pointers, we no longer maintain
  *                      a separate count.
+ *  2020-08-04 andy. Receiver is now interrupt driven. The ISR drains the UART into a
+ *                      receive ring buffer in midiport_t, and the parser reads from that.
+ *  2020-08-05 andy. Optional FIFO mode, selected per port with MIDIUART_enableFIFO().
+ *  2020-08-06 andy. Optional uDMA transmit mode, selected with MIDIUART_enableTxDMA().
+ *                      The transmit mode is now an enum instead of a flag.
+ *  2020-08-07 andy. Table-driven status decoder. MIDIUART_readMessages() drains the
+ *                      whole receive ring in one call. The packet being built lives here.
+ *  2020-08-10 andy. Optional running-status compression on transmit.
+ *  2020-08-11 andy. Real Time bytes are pulled out of the receive stream wherever they
+ *                      land, and have their own transmit lane which goes first.
+ *  2020-08-12 andy. Non-blocking, all-or-nothing MIDIUART_tryWriteMessage() and
+ *                      MIDIUART_txSpace().
+ *  2020-08-13 andy. Ports are described by a const MIDIUART_portdesc_t, which has the
+ *                      pins too. The ISR body is shared, see MIDIUART_intHandler().
+ *  2020-08-14 andy. A port can be a soft UART (utils/softuart.c), MU_TXMODE_SOFT.
+ *  2020-08-17 andy. MIDI Thru from the receive ISR, see MIDIUART_setThru().
+ *  2020-08-18 andy. MIDIUART_tryWriteEvent() writes the bytes of a USB-MIDI event packet.
+ *  2020-08-19 andy. MIDIUART_tryWriteEvents() writes a run of event packets at once.
+ *  2020-08-19 andy. MIDIUART_tryWriteRaw() writes bytes that aren't whole messages.
  */
 
 #ifndef MIDI_UART_MIDI_UART_H_
@@ -18,6 +37,7 @@
 #include <stdbool.h>
 #include "midi.h"
 #include "usbmidi_types.h"
+#include "utils/softuart.h"
 
 /**
  * Size of the message transmit FIFO, in bytes.
@@ -26,6 +46,31 @@
 #define MIDI_TX_FIFO_SIZE 64
 #endif
 
+/**
+ * Size of the receive ring buffer, in bytes.
+ * The ring holds one less than this many bytes. 64 bytes is about 20 ms of
+ * back-to-back traffic at 31.25 kbps, which is how long the main loop may stall
+ * before we start dropping bytes.
+ */
+#ifndef MIDI_RX_FIFO_SIZE
+#define MIDI_RX_FIFO_SIZE 64
+#endif
+
+/**
+ * Size of the Real Time transmit lane, in bytes.
+ * This holds one less than this many bytes.
+ */
+#ifndef MIDI_TX_RT_FIFO_SIZE
+#define MIDI_TX_RT_FIFO_SIZE 8
+#endif
+
+/**
+ * Most ports one port's input can be sent thru to.
+ */
+#ifndef MIDI_THRU_MAX_DEST
+#define MIDI_THRU_MAX_DEST 4
+#endif
+
 /**
   *  \enum MIDIUART_rxstate_t
   *  Define states in the receiver state machine.
@@ -38,42 +83,146 @@ typedef enum {
     MU_SYSEX2       //!< next byte in is 2nd sysex byte or EOX, put in mep->byte3
 } MIDIUART_rxstate_t; //!< receive state register.
 
+/**
+  *  \enum MIDIUART_txmode_t
+  *  How the transmitter is fed from the message FIFO.
+  */
+typedef enum {
+    MU_TXMODE_EOT,  //!< FIFOs off, one byte per end-of-transmission interrupt
+    MU_TXMODE_FIFO, //!< FIFOs on, refill up to 16 bytes per transmit interrupt
+    MU_TXMODE_DMA,  //!< FIFOs on, uDMA moves spans of the message FIFO to the UART
+    MU_TXMODE_SOFT  //!< no UART, a soft UART ticked by a timer, both directions
+} MIDIUART_txmode_t;
+
 /**
  * This structure contains all of the status and control information
  * needed by a particular serial MIDI port.
  * A pointer to this stucture is passed to the UART MIDI functions.
  * Instances of this structure should be declared as volatile.
  */
-typedef struct
+typedef struct midiport_s
 {
 	/* Configuration */
     uint32_t uartbase;            //!< base address of the UART peripheral used by this port
     uint32_t uartint;             //!< NVIC entry for this UART's interrupt.
     uint8_t cablenum;             //!< cable number of this port, used for USB-MIDI connections
+    MIDIUART_txmode_t txmode;     //!< how the transmitter is fed
+    uint32_t txdmachan;           //!< uDMA channel number, used in MU_TXMODE_DMA
+    tSoftUART *softuart;          //!< the soft UART, used in MU_TXMODE_SOFT
 
     // "private" members, do not change from user code. These is for the receiver.
     uint8_t cin;                  //!< Code Index Number for this packet
     uint8_t bytecnt;              //!< iterator for data bytes in this packet
     uint8_t bytesinpacket;        //!< set by status parser for running status.
     MIDIUART_rxstate_t rxstate;   //!< state register
+    USBMIDI_Message_t rxmsg;      //!< the packet being built by the parser
 
-    // ... and these are for the transmitter.
+    // Receive ring buffer. The ISR is the only writer of rxfifohead and the
+    // parser is the only writer of rxfifotail, so no locking is needed.
+    uint8_t rxfifo[MIDI_RX_FIFO_SIZE];  //!< Receive ring buffer
+    uint8_t rxfifohead;           //!< write location, owned by the ISR
+    uint8_t rxfifotail;           //!< read location, owned by the parser
+    uint32_t rxdropped;           //!< bytes lost because the ring or the UART overflowed
+
+    // ... and these are for the transmitter. The transmit ISR is the only writer
+    // of txfifotail and txrttail. txfifohead and txrthead are written by the main
+    // loop, the USB interrupt (raw streams) and other ports' receive ISRs (thru),
+    // so every writer masks interrupts while it queues. See MIDIUART_txHandler().
     uint8_t txmsgfifo[MIDI_TX_FIFO_SIZE];	//!< Transmit fifo buffer
     uint8_t txfifohead;			  //!< write location
     uint8_t txfifotail;			  //!< read location
     uint8_t txidle;               //!< true when idle
+    uint8_t txdmacount;           //!< bytes handed to the uDMA, still counted in the FIFO
+    bool txdmart;                 //!< true when the uDMA run came from the Real Time lane
+    uint8_t txrtfifo[MIDI_TX_RT_FIFO_SIZE]; //!< Real Time lane, sent ahead of txmsgfifo
+    uint8_t txrthead;             //!< Real Time lane write location
+    uint8_t txrttail;             //!< Real Time lane read location
+    bool txrunstatus;             //!< true to leave out repeated status bytes
+    uint8_t txlaststatus;         //!< running status on the wire, 0 if none
+
+    // MIDI Thru, done by the receive ISR. See MIDIUART_setThru().
+    struct midiport_s *thrudest[MIDI_THRU_MAX_DEST]; //!< ports our input is copied to
+    uint8_t thrucount;            //!< how many of those, 0 for no thru
+    bool thrumerge;               //!< true to send only whole messages
+    uint8_t thrumsg[3];           //!< merge mode: the message being framed
+    uint8_t thrulen;              //!< merge mode: bytes in thrumsg so far
+    uint8_t thruneed;             //!< merge mode: bytes in the whole message
+    uint8_t thrustatus;           //!< merge mode: running status of the input, 0 if none
+    bool thrusysex;               //!< merge mode: true inside a SysEx, which isn't sent
+    uint32_t thrudropped;         //!< bytes or messages a destination had no room for
 } midiport_t;
 
 /**
- * Set up the serial port for MIDI operation.
- * This populates the port structure with the necessary details.
- * @param port is the port structure that should be passed to all functions.
- * @param uartbase is the base address of the UART's register space
- * @param scperiph is the corresponding peripheral number passed to SysCtl functions
+ * This structure describes one serial MIDI port: which UART, which pins, and
+ * how it should run. The table of these lives in midi_ports.c and is const,
+ * the working data for the port is in the midiport_t it points to.
+ */
+typedef struct
+{
+    midiport_t *port;             //!< the port's working data
+    uint32_t uartbase;            //!< base address of the UART peripheral
+    uint32_t uartperiph;          //!< SysCtl peripheral number for the UART
+    uint32_t uartint;             //!< NVIC entry for the UART's interrupt
+    uint32_t gpioperiph;          //!< SysCtl peripheral number for the GPIO port with the pins
+    uint32_t gpiobase;            //!< base address of that GPIO port
+    uint8_t rxpin;                //!< receive pin, GPIO_PIN_x
+    uint8_t txpin;                //!< transmit pin, GPIO_PIN_x
+    uint32_t rxpinconfig;         //!< pin mux setting for receive, GPIO_Pxn_UnRX
+    uint32_t txpinconfig;         //!< pin mux setting for transmit, GPIO_Pxn_UnTX
+    uint32_t txdmachan;           //!< uDMA channel assignment for the transmitter
+    uint8_t cablenum;             //!< USB-MIDI cable number
+    MIDIUART_txmode_t txmode;     //!< how the transmitter is fed
+    bool runstatus;               //!< true to use running status on output
+} MIDIUART_portdesc_t;
+
+/**
+ * Set up the serial port for MIDI operation, in EOT mode.
+ * This populates the port structure with the necessary details, and sets up
+ * the pins, with a pull-up on the receive pin.
+ * @param desc describes the port. desc->port is the structure that should be passed to all functions.
  * @param sysclkfreq is the clock frequency as set by SysCtlClockFreqSet().
- * @param cablenum is the USB "cable number" we use to distinguish this port from the USB perspective
  */
-void MIDIUART_Init(midiport_t *port, uint32_t uartbase, uint32_t scperiph, uint32_t sysclkfreq, uint8_t cablenum, uint32_t intnum);
+void MIDIUART_Init(const MIDIUART_portdesc_t *desc, uint32_t sysclkfreq);
+
+/**
+ * Set up a soft UART as a MIDI port. The soft UART must already be set up,
+ * and something must tick it. See midi_softports.c.
+ * @param port is the port structure that should be passed to all functions.
+ * @param softuart is the soft UART.
+ * @param cablenum is the USB "cable number" for this port.
+ */
+void MIDIUART_InitSoft(midiport_t *port, tSoftUART *softuart, uint8_t cablenum);
+
+/**
+ * Switch the port from one-byte-per-interrupt operation to FIFO operation.
+ * The transmitter then loads up to 16 bytes per interrupt, and the receiver
+ * interrupts at a FIFO level or after a receive timeout.
+ * Ports which need end-of-transmission timing simply don't call this.
+ * @param port is the structure for this port, already set up by MIDIUART_Init().
+ * @param txlevel is the transmit interrupt level, one of UART_FIFO_TXn_8.
+ * @param rxlevel is the receive interrupt level, one of UART_FIFO_RXn_8.
+ */
+void MIDIUART_enableFIFO(midiport_t *port, uint32_t txlevel, uint32_t rxlevel);
+
+/**
+ * Feed the transmitter with the uDMA controller instead of the CPU.
+ * The port is switched to FIFO mode as well, as the uDMA requests depend on it.
+ * DMA_Init() must have been called first.
+ * @param port is the structure for this port, already set up by MIDIUART_Init().
+ * @param dmachan is the channel assignment for this UART's transmitter, UDMA_CHn_UARTxTX.
+ * @param txlevel is the transmit FIFO level, one of UART_FIFO_TXn_8.
+ * @param rxlevel is the receive interrupt level, one of UART_FIFO_RXn_8.
+ */
+void MIDIUART_enableTxDMA(midiport_t *port, uint32_t dmachan, uint32_t txlevel, uint32_t rxlevel);
+
+/**
+ * Turn running-status compression on the transmitter on or off.
+ * When on, a channel message whose status byte matches the last one sent goes
+ * out without it.
+ * @param port is the structure for this port.
+ * @param enable is true to compress, false to send every status byte.
+ */
+void MIDIUART_setRunningStatus(midiport_t *port, bool enable);
 
 /**
  * Write the given message to the transmit message FIFO.
@@ -85,6 +234,100 @@ void MIDIUART_Init(midiport_t *port, uint32_t uartbase, uint32_t scperiph, uint3
  */
 void MIDIUART_writeMessage(midiport_t *port, uint8_t *msg, uint8_t msize);
 
+/**
+ * Copy everything this port receives to the transmitters of other ports,
+ * from the receive ISR, so thru doesn't wait on the main loop. What the port
+ * receives still goes to MIDIUART_readMessages() as well.
+ * @param port is the structure for the port whose input is sent thru.
+ * @param dests is an array of the ports to send it to. It can include port itself.
+ * @param ndests is how many, up to MIDI_THRU_MAX_DEST. 0 turns thru off.
+ * @param merge is false to copy each byte as it arrives, for a destination no one
+ *        else writes to. true to copy only whole messages, so other messages can
+ *        be written to the destination too. SysEx is not sent thru in merge mode.
+ */
+void MIDIUART_setThru(midiport_t *port, midiport_t * const *dests, uint8_t ndests, bool merge);
+
+/**
+ * Write the given message to the transmit message FIFO if there is room for
+ * all of it. Otherwise write none of it and return false, so the caller can
+ * hold the message and try again later instead of waiting here.
+ * @param port is the structure for this port.
+ * @param msg is a pointer to an array of bytes to write to the FIFO.
+ * @param msize is the number of bytes in this message to write to the FIFO.
+ * @return true if the message was queued, false if it would have blocked.
+ */
+bool MIDIUART_tryWriteMessage(midiport_t *port, uint8_t *msg, uint8_t msize);
+
+/**
+ * Write the MIDI bytes carried by a USB-MIDI event packet, as many as its Code
+ * Index Number says, with MIDIUART_tryWriteMessage(). All or nothing.
+ * @param port is the structure for this port.
+ * @param msg is the event packet. Its cable number is not looked at.
+ * @return true if the bytes were queued, false if it would have blocked.
+ */
+bool MIDIUART_tryWriteEvent(midiport_t *port, const USBMIDI_Message_t *msg);
+
+/**
+ * Write the MIDI bytes of a run of USB-MIDI event packets, each one whole, until
+ * one doesn't fit, with interrupts masked once for the lot.
+ * @param port is the structure for this port.
+ * @param msgs is the event packets. Their cable numbers are not looked at.
+ * @param count is how many there are.
+ * @return how many were queued. The rest should be tried again later.
+ */
+uint32_t MIDIUART_tryWriteEvents(midiport_t *port, const USBMIDI_Message_t *msgs, uint32_t count);
+
+/**
+ * Write a stream of bytes as they are, such as part of a SysEx dump, as many as
+ * fit. They needn't be whole messages. Running status is cancelled.
+ * @param port is the structure for this port.
+ * @param buf is the bytes.
+ * @param size is how many there are.
+ * @return how many were queued.
+ */
+uint32_t MIDIUART_tryWriteRaw(midiport_t *port, const uint8_t *buf, uint32_t size);
+
+/**
+ * Return the number of bytes the transmit message FIFO can take right now.
+ * A message of that size or smaller will not block.
+ * @param port is the structure for this port.
+ */
+uint8_t MIDIUART_txSpace(midiport_t *port);
+
+/**
+ * Send a Real Time message (0xF8 - 0xFF) ahead of anything waiting in the
+ * transmit message FIFO. This does not block; if the lane is full, the byte
+ * is dropped and this returns false.
+ * @param port is the structure for this port.
+ * @param rtbyte is the Real Time message.
+ */
+bool MIDIUART_writeRealTime(midiport_t *port, uint8_t rtbyte);
+
+/**
+ * Receive interrupt service.
+ * Call this from the port's ISR. It moves every byte waiting in the UART
+ * into the port's receive ring buffer.
+ * @param port is the structure for this port.
+ */
+void MIDIUART_rxHandler(midiport_t *port);
+
+/**
+ * Transmit interrupt service.
+ * Call this from the port's ISR, with the interrupt status it read. It loads
+ * the transmitter from the message FIFO, one byte in EOT mode, until the
+ * UART FIFO is full in FIFO mode, or one contiguous span at a time in DMA mode.
+ * @param port is the structure for this port.
+ * @param status is the masked interrupt status, zero for a software trigger.
+ */
+void MIDIUART_txHandler(midiport_t *port, uint32_t status);
+
+/**
+ * The body of a MIDI UART's ISR. Reads and clears the UART's interrupt status,
+ * then calls MIDIUART_rxHandler() and MIDIUART_txHandler() as needed.
+ * @param port is the structure for this port.
+ */
+void MIDIUART_intHandler(midiport_t *port);
+
 /**
  * Attempt to read a message that was received on the serial MIDI port.
  * Pass a pointer to the structure that will hold the received message.
@@ -96,6 +339,18 @@ void MIDIUART_writeMessage(midiport_t *port, uint8_t *msg, uint8_t msize);
  */
 bool MIDIUART_readMessage(midiport_t *port, USBMIDI_Message_t *msg);
 
+/**
+ * Read every message that can be built from the bytes received so far.
+ * Pass an array that will hold the received messages and its size.
+ * The return is the number of complete messages put in the array.
+ * An incomplete message is kept in the port until its last byte arrives.
+ *
+ * @param[in,out] port
+ * @param[out] msgs
+ * @param[in] max
+ */
+uint32_t MIDIUART_readMessages(midiport_t *port, USBMIDI_Message_t *msgs, uint32_t max);
+
 
 
 
@@ -3,31 +3,62 @@
  *
  *  Created on: Jul 28, 2020
  *      Author: andy
+ *
+ * Bridge from the USB host's OUT cables to the DIN ports.
+ *
+ * Mods:
+ * 2020-08-19 andy. Each cable's messages go out the DIN port with its cable
+ *  number, instead of to the debug console.
+ * 2020-08-19 andy. Keep the USBMIDI_VENDOR raw stream going as its port drains.
  */
 
 #include <stdint.h>
 #include <stdbool.h>
 
-#include "utils/uartstdio.h"
-#include "utils/ustdlib.h"
-
 #include "usb_midi.h"
 #include "usb_midi_fifo.h"
+#include "midi_uart.h"
+#include "midi_ports.h"
 #include "midi_usb_rx_task.h"
 #include "usbmidi.h"
+#include "pconfig.h"
 
 /**
- * Pop the USB OUT receive FIFO for as long as there is something to pop.
+ * Take each cable's messages where they sit in its USB OUT queue, and write them
+ * to the DIN port whose cable number is the cable's, a run at a time, with
+ * MIDIUART_tryWriteEvents(). A cable with no port has its messages dropped.
+ *
+ * If the port fills up, the rest of the cable's messages stay queued until the
+ * next time through. Once the cable's queue is full, the USB ISR holds back the
+ * cable's messages in the OUT packet and NAKs the host's next one, so the host
+ * waits for the DIN port instead of us dropping anything. The messages for the
+ * other cables in that packet carry on meanwhile.
  */
 void MIDI_USB_Rx_Task(void)
 {
-	USBMIDI_Message_t msg;
+	const USBMIDI_Message_t *msg;
+	midiport_t *port;
+	uint32_t count;
+	uint32_t done;
+	uint8_t cable;
 
-	while( USBMIDI_OutEpFIFO_Pop(&msg) )
+	for( cable = 0; cable < USBMIDI_NUM_CABLES_OUT; cable++ )
 	{
-		UARTprintf("%02x : %02x : %02x : %02x\n", msg.header, msg.byte1, msg.byte2, msg.byte3);
-	}
-}
+		port = MIDIPORTS_byCable(cable);
 
+		while( (count = USBMIDI_OutCableReadSpan(cable, &msg)) != 0 )
+		{
+			done = count;
+			if( port )
+				done = MIDIUART_tryWriteEvents(port, msg, count);
+			USBMIDI_OutCableReadCommit(cable, done);
 
+			if( done < count )
+				break;
+		}
+	}
 
+#if USBMIDI_VENDOR
+	USBMIDI_RawResume();
+#endif
+}
@@ -0,0 +1,189 @@
+/*
+ * midi_usbh_rx_task.c
+ *
+ *  Created on: Aug 18, 2020
+ *      Author: andy
+ *
+ * Bridge from USB MIDI devices on our USB host to the DIN ports.
+ *
+ * Mods:
+ * 2020-08-19 andy. Several devices behind a hub. Each has its own cable numbers,
+ *  they take turns, and a SysEx message holds its port until it ends.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pconfig.h"
+#include "usb_midi.h"
+#include "midi_uart.h"
+#include "midi_ports.h"
+#include "midi_usbh_rx_task.h"
+#include "usbhmidi.h"
+
+/**
+ * The most messages we take from one device before it is the next one's turn.
+ */
+#define MIDI_USBH_BATCH 16
+
+/**
+ * The number of cables there can be.
+ */
+#define MIDI_USBH_CABLES 16
+
+/**
+ * Each device slot's first DIN cable number. See pconfig.h.
+ */
+static const uint8_t MIDI_USBH_cableBase[USBHMIDI_MAX_DEVICES] = {
+	USBHMIDI_DEV0_CN, USBHMIDI_DEV1_CN, USBHMIDI_DEV2_CN, USBHMIDI_DEV3_CN
+};
+
+/**
+ * For each DIN cable number, one more than the device whose SysEx message is
+ * going out on it, or 0 if there is none.
+ */
+static uint8_t MIDI_USBH_sysexOwner[MIDI_USBH_CABLES];
+
+/**
+ * The device that goes first the next time through.
+ */
+static uint32_t MIDI_USBH_first;
+
+/**
+ * Whether device dev may write msg to the port for DIN cable cn now, and keep
+ * track of who owns the port's SysEx. While one device's SysEx goes out, the
+ * other devices' messages for that port wait, as they would break into the
+ * middle of it. Real Time bytes are the exception, as MIDI allows them anywhere.
+ */
+static bool MIDI_USBH_mayWrite(uint32_t dev, uint8_t cn, const USBMIDI_Message_t *msg)
+{
+	uint8_t cin = USB_MIDI_CODE_INDEX_NUMBER(msg->header);
+	uint8_t owner = MIDI_USBH_sysexOwner[cn];
+
+	if( (USB_MIDI_CIN_SINGLEBYTE == cin) && (msg->byte1 >= 0xF8) )
+		return true;
+
+	return (0 == owner) || (owner == dev + 1);
+}
+
+/**
+ * Note what a message that went out does to its port's SysEx owner.
+ */
+static void MIDI_USBH_wrote(uint32_t dev, uint8_t cn, const USBMIDI_Message_t *msg)
+{
+	switch( USB_MIDI_CODE_INDEX_NUMBER(msg->header) )
+	{
+	case USB_MIDI_CIN_SYSEXSTART:
+		MIDI_USBH_sysexOwner[cn] = dev + 1;
+		break;
+	case USB_MIDI_CIN_SYSEND1:
+	case USB_MIDI_CIN_SYSEND2:
+	case USB_MIDI_CIN_SYSEND3:
+		MIDI_USBH_sysexOwner[cn] = 0;
+		break;
+	case USB_MIDI_CIN_SINGLEBYTE:
+		break;
+	default:
+		// a status byte ends a SysEx message that never got its EOX.
+		if( MIDI_USBH_sysexOwner[cn] == dev + 1 )
+			MIDI_USBH_sysexOwner[cn] = 0;
+		break;
+	}
+}
+
+/**
+ * Give up the SysEx ports held by a device that has gone.
+ */
+static void MIDI_USBH_release(uint32_t dev)
+{
+	uint8_t cn;
+
+	for( cn = 0; cn < MIDI_USBH_CABLES; cn++ )
+	{
+		if( MIDI_USBH_sysexOwner[cn] == dev + 1 )
+			MIDI_USBH_sysexOwner[cn] = 0;
+	}
+}
+
+/**
+ * Take up to MIDI_USBH_BATCH of device dev's messages where they sit, and write
+ * each one whole to the DIN port for its cable. A message for a cable the device
+ * doesn't have, or that no port has, is dropped.
+ *
+ * If a port has no room, or another device's SysEx has it, the device's messages
+ * stop there until the next time through, so they go out in order. Meanwhile the
+ * device's FIFO fills, and then the device is made to wait.
+ */
+static void MIDI_USBH_drain(uint32_t dev)
+{
+	const USBMIDI_Message_t *msg;
+	midiport_t *port;
+	uint32_t budget;
+	uint32_t count;
+	uint32_t idx;
+	uint8_t cable;
+	uint8_t cn;
+
+	if( !USBHMIDI_IsConnected(dev) )
+	{
+		MIDI_USBH_release(dev);
+		return;
+	}
+
+	budget = MIDI_USBH_BATCH;
+	while( budget && ((count = USBHMIDI_ReadSpan(dev, &msg)) != 0) )
+	{
+		if( count > budget )
+			count = budget;
+
+		for( idx = 0; idx < count; idx++ )
+		{
+			cable = USB_MIDI_CABLE_NUMBER(msg[idx].header);
+			if( cable >= USBHMIDI_NumCables(dev) )
+				continue;
+
+			cn = MIDI_USBH_cableBase[dev] + cable;
+			if( cn >= MIDI_USBH_CABLES )
+				continue;
+
+			port = MIDIPORTS_byCable(cn);
+			if( !port )
+				continue;
+
+			if( !MIDI_USBH_mayWrite(dev, cn, &msg[idx]) )
+				break;
+			if( !MIDIUART_tryWriteEvent(port, &msg[idx]) )
+				break;
+			MIDI_USBH_wrote(dev, cn, &msg[idx]);
+		}
+		USBHMIDI_ReadCommit(dev, idx);
+		budget -= idx;
+
+		if( idx < count )
+			break;
+	}
+}
+
+/**
+ * Run the USB host, then give each device a turn of up to MIDI_USBH_BATCH
+ * messages, starting with a different one each time, so one busy device can't
+ * keep the others off the ports they share.
+ */
+void MIDI_USBH_Rx_Task(void)
+{
+	uint32_t dev;
+	uint32_t n;
+
+	USBHMIDI_Task();
+
+	dev = MIDI_USBH_first;
+	for( n = 0; n < USBHMIDI_MAX_DEVICES; n++ )
+	{
+		MIDI_USBH_drain(dev);
+		if( ++dev == USBHMIDI_MAX_DEVICES )
+			dev = 0;
+	}
+
+	if( ++MIDI_USBH_first == USBHMIDI_MAX_DEVICES )
+		MIDI_USBH_first = 0;
+}
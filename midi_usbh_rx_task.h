@@ -0,0 +1,18 @@
+/*
+ * midi_usbh_rx_task.h
+ *
+ *  Created on: Aug 18, 2020
+ *      Author: andy
+ */
+
+#ifndef MIDI_USBH_RX_TASK_H_
+#define MIDI_USBH_RX_TASK_H_
+
+/**
+ * Run the USB host, and send what the USB MIDI devices on it play out the DIN
+ * ports. Device slot d's cable c goes to the port whose cable number is
+ * USBHMIDI_DEVd_CN + c (pconfig.h).
+ */
+void MIDI_USBH_Rx_Task(void);
+
+#endif /* MIDI_USBH_RX_TASK_H_ */
@@ -16,6 +16,7 @@
 #include "driverlib/timer.h"
 #include "driverlib/interrupt.h"
 #include "driverlib/uart.h"
+#include "driverlib/udma.h"
 
 /**
  * Character LCD interface is all on Port M.
@@ -59,12 +60,196 @@
 #define QEI_SCOPE_PIN GPIO_PIN_3
 
 /**
- * Support for MIDI over UART7.
+ * Serial MIDI ports.
+ *
+ * Set MIDI_UARTn_ENABLE to 1 for each UART that is a DIN MIDI port. The port
+ * table and the ISRs in midi_ports.c are built from these, and the pins each
+ * UART uses are in that table. UART0 is the debug console, so leave it off.
+ * UART1 can't be used on this board: its pins, PB0 and PB1, are USB0ID and
+ * USB0VBUS, and the TM4C1294NCPDT has U1TX nowhere else.
+ *
+ * For each enabled port:
+ *  MIDI_UARTn_CN is its USB-MIDI cable number.
+ *  MIDI_UARTn_TXMODE is MU_TXMODE_EOT for an interrupt at the end of every byte,
+ *      MU_TXMODE_FIFO to run with the UART's FIFOs, which cuts the interrupt load,
+ *      or MU_TXMODE_DMA to feed the transmitter with the uDMA (FIFOs on as well).
+ *  MIDI_UARTn_RUNSTATUS is 1 to leave out repeated status bytes on output.
  */
-#define MIDI_UART7_BASE UART7_BASE
-#define MIDI_UART7_SYSCTL_PERIPH SYSCTL_PERIPH_UART7
-#define MIDI_UART7_INT INT_UART7
+#define MIDI_UART0_ENABLE 0
+
+#define MIDI_UART1_ENABLE 0
+#define MIDI_UART1_CN 1
+#define MIDI_UART1_TXMODE MU_TXMODE_FIFO
+#define MIDI_UART1_RUNSTATUS 1
+
+#define MIDI_UART2_ENABLE 0
+#define MIDI_UART2_CN 2
+#define MIDI_UART2_TXMODE MU_TXMODE_FIFO
+#define MIDI_UART2_RUNSTATUS 1
+
+#define MIDI_UART3_ENABLE 0
+#define MIDI_UART3_CN 3
+#define MIDI_UART3_TXMODE MU_TXMODE_FIFO
+#define MIDI_UART3_RUNSTATUS 1
+
+#define MIDI_UART4_ENABLE 0
+#define MIDI_UART4_CN 4
+#define MIDI_UART4_TXMODE MU_TXMODE_FIFO
+#define MIDI_UART4_RUNSTATUS 1
+
+#define MIDI_UART5_ENABLE 0
+#define MIDI_UART5_CN 5
+#define MIDI_UART5_TXMODE MU_TXMODE_FIFO
+#define MIDI_UART5_RUNSTATUS 1
+
+#define MIDI_UART6_ENABLE 0
+#define MIDI_UART6_CN 6
+#define MIDI_UART6_TXMODE MU_TXMODE_FIFO
+#define MIDI_UART6_RUNSTATUS 1
+
+#define MIDI_UART7_ENABLE 1
 #define MIDI_UART7_CN 0
+#define MIDI_UART7_TXMODE MU_TXMODE_FIFO
+#define MIDI_UART7_RUNSTATUS 1
+
+/**
+ * FIFO levels for ports in FIFO or DMA mode.
+ * The receive level is kept low because a three-byte message that doesn't
+ * reach the level has to wait for the receive timeout (32 bit times, ~1 ms).
+ */
+#define MIDI_UART_TXLEVEL UART_FIFO_TX2_8
+#define MIDI_UART_RXLEVEL UART_FIFO_RX1_8
+
+/**
+ * The cable number of the DIN port the buttons and the encoder play on. If no
+ * port has it, they only go to the host.
+ */
+#define MIDI_CONTROLS_CN 0
+
+/**
+ * Set to 1 to send the input of the port with cable number MIDI_THRU_CN thru to
+ * its own output, from the receive ISR. With MIDI_THRU_MERGE at 1 only whole
+ * messages are copied, so the buttons and the encoder can still send on that
+ * port. SysEx is not sent thru then.
+ */
+#define MIDI_THRU 0
+#define MIDI_THRU_CN 0
+#define MIDI_THRU_MERGE 1
+
+/**
+ * Soft serial MIDI ports, on spare GPIO pins, for more ports than there are UARTs.
+ *
+ * Set MIDI_SOFTn_ENABLE to 1 for each soft port, up to four. The pins are in
+ * the table in midi_softports.c. MIDI_SOFTn_CN is the port's cable number.
+ *
+ * All soft ports share one timer, which runs at four times the MIDI bit rate.
+ * Its interrupt vector is the Timer 2A slot in the startup code.
+ */
+#define MIDI_SOFT0_ENABLE 0
+#define MIDI_SOFT0_CN 8
+#define MIDI_SOFT1_ENABLE 0
+#define MIDI_SOFT1_CN 9
+#define MIDI_SOFT2_ENABLE 0
+#define MIDI_SOFT2_CN 10
+#define MIDI_SOFT3_ENABLE 0
+#define MIDI_SOFT3_CN 11
+
+#define MIDI_SOFT_TIMER_BASE TIMER2_BASE
+#define MIDI_SOFT_TIMER_PERIPH SYSCTL_PERIPH_TIMER2
+#define MIDI_SOFT_TIMER_INT INT_TIMER2A
+
+/**
+ * Set to 1 to leave out repeated status bytes on the soft ports' output.
+ */
+#define MIDI_SOFT_RUNSTATUS 1
+
+
+/**
+ * USB IN endpoint flush deadline, in USB frames (1 ms each).
+ * Messages for the host are sent as soon as there are 16 of them, a full packet.
+ * Fewer than that wait for more to join them, but no longer than this many
+ * start-of-frames after the first one was written. At 1 a lone message goes
+ * at the next SOF, so it waits less than a frame. 0 sends whenever the endpoint
+ * is free.
+ */
+#define USBMIDI_IN_FLUSH_FRAMES 1
+
+/**
+ * Set to 1 to move the MIDI IN endpoint's packets with the USB controller's own
+ * DMA, straight from the message FIFO into the endpoint FIFO. The CPU then only
+ * starts each transfer and finishes it off in the USB interrupt. OUT packets are
+ * always read by the CPU, which sorts their messages by cable as it goes.
+ */
+#define USBMIDI_DMA 0
+
+/**
+ * Set to 1 to give the MIDI endpoints two packet buffers each way. The host can then
+ * send an OUT packet while we still have the last one, and we can load an IN packet
+ * while the last one waits for the host.
+ */
+#define USBMIDI_DOUBLE_BUFFER 1
+
+/**
+ * How many virtual cables the USB MIDI interface has each way, 1 to 16.
+ * OUT cables carry messages from the host, and IN cables carry them to the host.
+ * The descriptors are made to match, see usbmidi_descriptors.h.
+ */
+#define USBMIDI_NUM_CABLES_OUT 2
+
+#define USBMIDI_NUM_CABLES_IN 2
+
+/**
+ * Set to 1 to give the MIDI Streaming interface an alternate setting 1 for USB
+ * MIDI 2.0 hosts, which carries Universal MIDI Packets. Hosts that don't know
+ * about it stay on alternate setting 0, USB-MIDI 1.0.
+ */
+#define USBMIDI_UMP 1
 
+/**
+ * Set to 1 to add a vendor-specific interface with one bulk OUT endpoint, for raw
+ * MIDI byte streams such as SysEx dumps. They go 64 bytes to a packet, with no
+ * event packet framing, straight into the transmit FIFO of the DIN port the host
+ * picks with a vendor request. See usb_midi/usbmidi.h.
+ */
+#define USBMIDI_VENDOR 0
+
+/**
+ * Set to 1 to make the USB device composite, with a CDC-ACM serial port next to
+ * MIDI for the debug console, instead of UART0. See usb_midi/usbcdc_console.h.
+ */
+#define USBMIDI_CDC 0
+
+/**
+ * Set to 1 to let DIN input wake a suspended host. While the bus is suspended,
+ * messages for the host wait in the IN endpoint FIFO (and then in the ports'
+ * receive rings), and the first one whose Code Index Number is in
+ * USBMIDI_WAKE_CINS makes us signal remote wakeup, if the host allows it. A Note
+ * On with velocity 0 doesn't count. On resume the waiting messages go at once.
+ * By default notes, controllers, program changes and pitch bends wake the host,
+ * and clock, Active Sensing, SysEx and note-offs don't.
+ */
+#define USBMIDI_REMOTE_WAKEUP 1
+#define USBMIDI_WAKE_CINS ((1 << USB_MIDI_CIN_NOTEON) | (1 << USB_MIDI_CIN_CTRLCHANGE) | \
+                           (1 << USB_MIDI_CIN_PROGCHANGE) | (1 << USB_MIDI_CIN_PITCHBEND))
+
+/**
+ * Set to 1 to make USB0 a host for class-compliant USB MIDI devices, such as
+ * USB-only keyboards, instead of a USB MIDI device. Up to four of them can be
+ * plugged into a hub. The board powers VBUS through USB0EPEN (PD6). See
+ * usb_midi/usbhmidi.h.
+ */
+#define USBMIDI_HOST 0
+
+/**
+ * With USBMIDI_HOST, where each device's cables go. The device in hub port n + 1
+ * (or plugged in directly, for n = 0) sends its cable c out the DIN port whose
+ * cable number is USBHMIDI_DEVn_CN + c. By default, each device's cable 0 has a
+ * DIN port of its own. Give two devices the same number to merge them onto one
+ * port.
+ */
+#define USBHMIDI_DEV0_CN 0
+#define USBHMIDI_DEV1_CN 1
+#define USBHMIDI_DEV2_CN 2
+#define USBHMIDI_DEV3_CN 3
 
 #endif /* PCONFIG_H_ */
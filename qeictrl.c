@@ -15,7 +15,7 @@
 
 #include "qeictrl.h"
 #include "midi.h"  // for message constants.
-#include "midi_uart7.h"   // for writing to the serial MIDI port.
+#include "midi_ports.h"   // for writing to the serial MIDI port.
 #include "pconfig.h"
 
 /**
@@ -72,6 +72,7 @@ void QEI_Task(void)
     uint32_t qei_newpos;                //!< new read from the encoder.
     static uint32_t qei_oldpos = 0;     //!< previously read from encoder for compare
     uint8_t msg[3];                     //!< MIDI message to send.
+    midiport_t *port;                   //!< DIN port to send it on.
 
 
     if( velflag )
@@ -87,7 +88,9 @@ void QEI_Task(void)
         msg[0] = MIDI_MSG_CTRLCHANGE;
         msg[1] = MIDI_CC_GP8;
         msg[2] = (uint8_t) qei_newpos;
-        MIDIUART_writeMessage(&mpuart7, msg, 3);
+        port = MIDIPORTS_byCable(MIDI_CONTROLS_CN);
+        if( port )
+            MIDIUART_writeMessage(port, msg, 3);
         // Save for next time through.
         qei_oldpos = qei_newpos;
     }
@@ -23,6 +23,9 @@
 //*****************************************************************************
 
 #include <stdint.h>
+#include "midi_ports.h"      // MIDI_UARTn_VECTOR, the serial MIDI port ISRs
+#include "midi_softports.h"  // MIDI_SOFT_TIMER_VECTOR, the soft MIDI port timer ISR
+#include "usbhmidi.h"         // USBMIDI_USB0_VECTOR, the USB device or host ISR
 
 //*****************************************************************************
 //
@@ -33,7 +36,6 @@ void ResetISR(void);
 static void NmiSR(void);
 static void FaultISR(void);
 static void IntDefaultHandler(void);
-extern void USB0DeviceIntHandler(void);
 extern void SysTickIntHandler(void);
 
 
@@ -59,7 +61,6 @@ extern uint32_t __STACK_TOP;
 //*****************************************************************************
 //extern void LcdTimerIntHandler(void);
 extern void QEIntHandler(void);
-extern void MIDIUART7_IntHandler(void);
 extern void ButtonIntHandler(void);
 
 //*****************************************************************************
@@ -94,8 +95,8 @@ void (* const g_pfnVectors[])(void) =
     IntDefaultHandler,                      // GPIO Port C
     IntDefaultHandler,                      // GPIO Port D
     IntDefaultHandler,                      // GPIO Port E
-    IntDefaultHandler,                      // UART0 Rx and Tx
-    IntDefaultHandler,                      // UART1 Rx and Tx
+    MIDI_UART0_VECTOR,                     // UART0 Rx and Tx
+    MIDI_UART1_VECTOR,                     // UART1 Rx and Tx
     IntDefaultHandler,                      // SSI0 Rx and Tx
     IntDefaultHandler,                      // I2C0 Master and Slave
     IntDefaultHandler,                      // PWM Fault
@@ -112,7 +113,7 @@ void (* const g_pfnVectors[])(void) =
     IntDefaultHandler,                      // Timer 0 subtimer B
     IntDefaultHandler,                      // Timer 1 subtimer A
     IntDefaultHandler,                      // Timer 1 subtimer B
-    IntDefaultHandler,                      // Timer 2 subtimer A
+    MIDI_SOFT_TIMER_VECTOR,                 // Timer 2 subtimer A
     IntDefaultHandler,                      // Timer 2 subtimer B
     IntDefaultHandler,                      // Analog Comparator 0
     IntDefaultHandler,                      // Analog Comparator 1
@@ -122,7 +123,7 @@ void (* const g_pfnVectors[])(void) =
     IntDefaultHandler,                      // GPIO Port F
     IntDefaultHandler,                      // GPIO Port G
     IntDefaultHandler,                      // GPIO Port H
-    IntDefaultHandler,                      // UART2 Rx and Tx
+    MIDI_UART2_VECTOR,                     // UART2 Rx and Tx
     IntDefaultHandler,                      // SSI1 Rx and Tx
     IntDefaultHandler,                      // Timer 3 subtimer A
     IntDefaultHandler,                      // Timer 3 subtimer B
@@ -131,7 +132,7 @@ void (* const g_pfnVectors[])(void) =
     IntDefaultHandler,                      // CAN1
     IntDefaultHandler,                      // Ethernet
     IntDefaultHandler,                      // Hibernate
-    USB0DeviceIntHandler,                      // USB0
+    USBMIDI_USB0_VECTOR,                    // USB0
     IntDefaultHandler,                      // PWM Generator 3
     IntDefaultHandler,                      // uDMA Software Transfer
     IntDefaultHandler,                      // uDMA Error
@@ -145,11 +146,11 @@ void (* const g_pfnVectors[])(void) =
     IntDefaultHandler,                      // GPIO Port L
     IntDefaultHandler,                      // SSI2 Rx and Tx
     IntDefaultHandler,                      // SSI3 Rx and Tx
-    IntDefaultHandler,                      // UART3 Rx and Tx
-    IntDefaultHandler,                      // UART4 Rx and Tx
-    IntDefaultHandler,                      // UART5 Rx and Tx
-    IntDefaultHandler,                      // UART6 Rx and Tx
-    MIDIUART7_IntHandler,                    // UART7 Rx and Tx
+    MIDI_UART3_VECTOR,                     // UART3 Rx and Tx
+    MIDI_UART4_VECTOR,                     // UART4 Rx and Tx
+    MIDI_UART5_VECTOR,                     // UART5 Rx and Tx
+    MIDI_UART6_VECTOR,                     // UART6 Rx and Tx
+    MIDI_UART7_VECTOR,                     // UART7 Rx and Tx
     IntDefaultHandler,                      // I2C2 Master and Slave
     IntDefaultHandler,                      // I2C3 Master and Slave
     IntDefaultHandler,                      // Timer 4 subtimer A
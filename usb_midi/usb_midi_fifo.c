@@ -8,10 +8,12 @@
  *  Mods:
  *  2019-10-30 ASP: support multiple instances of a FIFO by requiring a pointer to the FIFO structure
  *  	for each function call. All FIFOs are the same size.
+ *  2020-08-18 andy: single-producer, single-consumer, with no shared count. See usb_midi_fifo.h.
  */
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include "usb_midi.h"
 #include "usb_midi_fifo.h"
 
@@ -22,43 +24,153 @@ void USBMIDIFIFO_Init(USBMIDIFIFO_t *fifo)
 {
 	fifo->head = 0;
 	fifo->tail = 0;
-	fifo->count = 0;
 } // MIDIFIFO_Init()
 
 /**
  * Push a new message onto the FIFO.
- * @bug Do what in case of overflow?
  * @param msg The MIDI message to push onto the FIFO.
+ * @returns true if it was pushed, false if the FIFO was full and it was not.
  */
-void USBMIDIFIFO_Push(USBMIDIFIFO_t *fifo, USBMIDI_Message_t *msg)
+bool USBMIDIFIFO_Push(USBMIDIFIFO_t *fifo, const USBMIDI_Message_t *msg)
 {
-	fifo->msg[fifo->head] = *msg;
-	fifo->head++;
-	if (fifo->head >= MIDI_USB_FIFO_SIZE) {
-		fifo->head = 0;
-	}
-	fifo->count++;
+	uint32_t head = fifo->head;
+
+	if( (head - fifo->tail) >= MIDI_USB_FIFO_SIZE )
+		return false;
+
+	memcpy(&fifo->ev[head & MIDI_USB_FIFO_MASK], msg, 4);
+	fifo->head = head + 1;
+
+	return true;
 } // MIDIFIFO_Push()
 
 /**
  * Pop a message from the USB MIDI FIFO.
- * This fetches a message that was sent from the host on an OUT endpoint.
  * @returns true if we actually popped something, else false if the FIFO was
  * empty.
  * @param msg: this is the message popped from the FIFO.
  */
 bool USBMIDIFIFO_Pop(USBMIDIFIFO_t *fifo, USBMIDI_Message_t *msg)
 {
-	if (fifo->count == 0)
+	uint32_t tail = fifo->tail;
+
+	if( fifo->head == tail )
 		// nothing to pop, so caller doesn't parse any message.
 		return false;
 
-	*msg = fifo->msg[fifo->tail];
-	fifo->tail++;
-	if (fifo->tail >= MIDI_USB_FIFO_SIZE) {
-		fifo->tail = 0;
-	}
-	fifo->count--;
+	memcpy(msg, &fifo->ev[tail & MIDI_USB_FIFO_MASK], 4);
+	fifo->tail = tail + 1;
 
 	return true;
 } // MIDIFIFO_Pop()
+
+/**
+ * Push up to count four-byte event packets from buf.
+ * The copy is done in at most two pieces, either side of the wrap, and head is
+ * moved once at the end.
+ */
+uint32_t USBMIDIFIFO_PushBatch(USBMIDIFIFO_t *fifo, const uint8_t *buf, uint32_t count)
+{
+	uint32_t head = fifo->head;
+	uint32_t space;
+	uint32_t idx;
+	uint32_t first;
+
+	space = MIDI_USB_FIFO_SIZE - (head - fifo->tail);
+	if( count > space )
+		count = space;
+	if( 0 == count )
+		return 0;
+
+	idx = head & MIDI_USB_FIFO_MASK;
+	first = MIDI_USB_FIFO_SIZE - idx;
+	if( first > count )
+		first = count;
+
+	memcpy(&fifo->ev[idx], buf, first * 4);
+	if( count > first )
+		memcpy(&fifo->ev[0], buf + (first * 4), (count - first) * 4);
+
+	fifo->head = head + count;
+
+	return count;
+}
+
+/**
+ * Pop up to count four-byte event packets into buf.
+ * Like USBMIDIFIFO_PushBatch(), two pieces at most, and tail is moved once.
+ */
+uint32_t USBMIDIFIFO_PopBatch(USBMIDIFIFO_t *fifo, uint8_t *buf, uint32_t count)
+{
+	uint32_t tail = fifo->tail;
+	uint32_t used;
+	uint32_t idx;
+	uint32_t first;
+
+	used = fifo->head - tail;
+	if( count > used )
+		count = used;
+	if( 0 == count )
+		return 0;
+
+	idx = tail & MIDI_USB_FIFO_MASK;
+	first = MIDI_USB_FIFO_SIZE - idx;
+	if( first > count )
+		first = count;
+
+	memcpy(buf, &fifo->ev[idx], first * 4);
+	if( count > first )
+		memcpy(buf + (first * 4), &fifo->ev[0], (count - first) * 4);
+
+	fifo->tail = tail + count;
+
+	return count;
+}
+
+/**
+ * The oldest messages, up to the end of the storage.
+ */
+uint32_t USBMIDIFIFO_ReadSpan(const USBMIDIFIFO_t *fifo, const uint8_t **span)
+{
+	uint32_t tail = fifo->tail;
+	uint32_t used;
+	uint32_t idx;
+
+	used = fifo->head - tail;
+	idx = tail & MIDI_USB_FIFO_MASK;
+	*span = (const uint8_t *) &fifo->ev[idx];
+
+	if( used > (MIDI_USB_FIFO_SIZE - idx) )
+		used = MIDI_USB_FIFO_SIZE - idx;
+
+	return used;
+}
+
+void USBMIDIFIFO_ReadCommit(USBMIDIFIFO_t *fifo, uint32_t count)
+{
+	fifo->tail += count;
+}
+
+/**
+ * The free space after the newest message, up to the end of the storage.
+ */
+uint32_t USBMIDIFIFO_WriteSpan(USBMIDIFIFO_t *fifo, uint8_t **span)
+{
+	uint32_t head = fifo->head;
+	uint32_t space;
+	uint32_t idx;
+
+	space = MIDI_USB_FIFO_SIZE - (head - fifo->tail);
+	idx = head & MIDI_USB_FIFO_MASK;
+	*span = (uint8_t *) &fifo->ev[idx];
+
+	if( space > (MIDI_USB_FIFO_SIZE - idx) )
+		space = MIDI_USB_FIFO_SIZE - idx;
+
+	return space;
+}
+
+void USBMIDIFIFO_WriteCommit(USBMIDIFIFO_t *fifo, uint32_t count)
+{
+	fifo->head += count;
+}
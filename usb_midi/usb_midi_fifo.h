@@ -1,17 +1,26 @@
 /*
  * usb_midi_fifo.h
  *
- * This implements a FIFO for USB MIDI messages that are received from the host
- * via USB OUT transactions.
+ * This implements a FIFO for USB MIDI messages, one for each direction of the
+ * USB MIDI endpoints.
  *
- * The messages are pushed in a callback.
- * They are popped in the main program loop.
+ * Each FIFO has one producer and one consumer, and one of the two is usually the
+ * USB ISR. For the OUT endpoint, the ISR pushes and the main loop pops. For the
+ * IN endpoint, the main loop pushes and the ISR pops. The OUT endpoint has one
+ * FIFO per cable.
  *
  *  Created on: Oct 28, 2019
  *      Author: apeters
  *  Mods:
  *  2019-10-30 ASP: support multiple instances of a FIFO by requiring a pointer to the FIFO structure
  *  	for each function call. All FIFOs are the same size. The size is defined as MIDI_USB_FIFO_SIZE.
+ *  2020-08-18 andy: lock-free single-producer, single-consumer queue of 32-bit event words.
+ *  	There is no shared count any more. The head is written only by the producer and the tail
+ *  	only by the consumer, and both run freely, so the count is head - tail. Each word holds
+ *  	the four bytes of a USB-MIDI event packet in the order they go on the wire, so whole
+ *  	runs of events can be copied to and from endpoint buffers as bytes. There are batch
+ *  	push and pop functions for that, and span functions that give access to the FIFO's
+ *  	own storage.
  */
 
 #ifndef USB_MIDI_USB_MIDI_FIFO_H_
@@ -22,40 +31,134 @@
 
 #include "usb_midi.h"
 
-// How many messages will fit into our FIFO?
+// How many messages will fit into our FIFO? This must be a power of two.
 #ifndef MIDI_USB_FIFO_SIZE
 #define MIDI_USB_FIFO_SIZE 32
 #endif
 
+#if (MIDI_USB_FIFO_SIZE & (MIDI_USB_FIFO_SIZE - 1)) != 0
+#error MIDI_USB_FIFO_SIZE must be a power of two
+#endif
+
+#define MIDI_USB_FIFO_MASK (MIDI_USB_FIFO_SIZE - 1)
+
 /*
  * Define a software FIFO for the MIDI messages.
+ *
+ * head and tail count events, and are masked only to index ev[]. An event is
+ * written to ev[] before head is moved past it, and read before tail is.
  */
 typedef struct {
-	uint8_t head;									/*!< Index of the head of the FIFO  */
-	uint8_t tail;									/*!< Index of the tail of the FIFO  */
-	uint8_t count;									/*!< Number of messages in the FIFO */
-	USBMIDI_Message_t msg[MIDI_USB_FIFO_SIZE];		/*!< the buffer */
+	volatile uint32_t head;							/*!< Events pushed, ever. Written by the producer only */
+	volatile uint32_t tail;							/*!< Events popped, ever. Written by the consumer only */
+	uint32_t ev[MIDI_USB_FIFO_SIZE];				/*!< the buffer, one USB-MIDI event packet per word */
 } USBMIDIFIFO_t;
 
 /**
  * Initialize the MIDI message FIFO.
- * Clear the contents to make debug easier.
+ * Nobody may be using the FIFO while this is done.
  */
 void USBMIDIFIFO_Init(USBMIDIFIFO_t *fifo);
 
 /**
- * Push a new message onto the FIFO.
- * \param[in,out] msg: pointer to a USB MIDI message structure.
- * \bug Do what in case of overflow?
+ * How many messages are in the FIFO. Either side may ask; the producer may see
+ * fewer than this a moment later, and the consumer more.
+ */
+static inline uint32_t USBMIDIFIFO_Count(const USBMIDIFIFO_t *fifo)
+{
+	return fifo->head - fifo->tail;
+}
+
+/**
+ * How many more messages will fit into the FIFO.
+ */
+static inline uint32_t USBMIDIFIFO_Space(const USBMIDIFIFO_t *fifo)
+{
+	return MIDI_USB_FIFO_SIZE - (fifo->head - fifo->tail);
+}
+
+/**
+ * The i'th oldest message in the FIFO, as a word, without popping it. Consumer
+ * only, and i must be less than the count.
  */
-void USBMIDIFIFO_Push(USBMIDIFIFO_t *fifo, USBMIDI_Message_t *msg);
+static inline uint32_t USBMIDIFIFO_PeekWord(const USBMIDIFIFO_t *fifo, uint32_t i)
+{
+	return fifo->ev[(fifo->tail + i) & MIDI_USB_FIFO_MASK];
+}
+
+/**
+ * Push a new message onto the FIFO. Producer only.
+ * \param[in] msg: pointer to a USB MIDI message structure.
+ * \returns true if it was pushed, false if the FIFO was full.
+ */
+bool USBMIDIFIFO_Push(USBMIDIFIFO_t *fifo, const USBMIDI_Message_t *msg);
+
+/**
+ * Push a message that is already a word, its four bytes in wire order, as read
+ * from an endpoint FIFO register. Producer only.
+ * \returns true if it was pushed, false if the FIFO was full.
+ */
+static inline bool USBMIDIFIFO_PushWord(USBMIDIFIFO_t *fifo, uint32_t word)
+{
+	uint32_t head = fifo->head;
+
+	if( (head - fifo->tail) >= MIDI_USB_FIFO_SIZE )
+		return false;
+
+	fifo->ev[head & MIDI_USB_FIFO_MASK] = word;
+	fifo->head = head + 1;
+
+	return true;
+}
 
 /**
- * Pop a message from the MIDI Message FIFO.
+ * Pop a message from the MIDI Message FIFO. Consumer only.
  * \returns true if we actually popped something, else false if the FIFO was
  * empty.
  * \param[in,out] msg: The message is returned in the argument.
  */
 bool USBMIDIFIFO_Pop(USBMIDIFIFO_t *fifo, USBMIDI_Message_t *msg);
 
+/**
+ * Push up to count messages from a buffer of event packets, four bytes each, as
+ * they come from an OUT endpoint. Producer only.
+ * \returns how many were pushed, which is less than count if the FIFO filled up.
+ */
+uint32_t USBMIDIFIFO_PushBatch(USBMIDIFIFO_t *fifo, const uint8_t *buf, uint32_t count);
+
+/**
+ * Pop up to count messages into a buffer of event packets, four bytes each, as
+ * they go to an IN endpoint. Consumer only.
+ * \returns how many were popped.
+ */
+uint32_t USBMIDIFIFO_PopBatch(USBMIDIFIFO_t *fifo, uint8_t *buf, uint32_t count);
+
+/**
+ * Get the oldest run of messages in the FIFO that sits in one piece in the FIFO's
+ * storage, without popping them. Consumer only.
+ * \param[out] span: set to point at the first message's four bytes.
+ * \returns how many messages are in the run. There may be more after a wrap.
+ * Follow with USBMIDIFIFO_ReadCommit() for those that were used.
+ */
+uint32_t USBMIDIFIFO_ReadSpan(const USBMIDIFIFO_t *fifo, const uint8_t **span);
+
+/**
+ * Pop count messages that were read through USBMIDIFIFO_ReadSpan().
+ */
+void USBMIDIFIFO_ReadCommit(USBMIDIFIFO_t *fifo, uint32_t count);
+
+/**
+ * Get the free space in the FIFO's storage, in one piece, for the next messages to
+ * be written straight into. Producer only.
+ * \param[out] span: set to point at where the next message's four bytes go.
+ * \returns how many messages fit in the run. There may be more room after a wrap.
+ * Follow with USBMIDIFIFO_WriteCommit() for those that were written.
+ */
+uint32_t USBMIDIFIFO_WriteSpan(USBMIDIFIFO_t *fifo, uint8_t **span);
+
+/**
+ * Push count messages that were written through USBMIDIFIFO_WriteSpan().
+ */
+void USBMIDIFIFO_WriteCommit(USBMIDIFIFO_t *fifo, uint32_t count);
+
 #endif /* USB_MIDI_USB_MIDI_FIFO_H_ */
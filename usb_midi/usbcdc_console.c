@@ -0,0 +1,327 @@
+/*
+ * usbcdc_console.c
+ *
+ *  Created on: Aug 19, 2020
+ *      Author: andy
+ *
+ * The CDC-ACM debug console. See usbcdc_console.h.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+#include "inc/hw_memmap.h"
+#include "inc/hw_types.h"
+#include "driverlib/rom.h"
+#include "driverlib/rom_map.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/usb.h"
+#include "usblib/usblib.h"
+#include "usblib/device/usbdevice.h"
+#include "utils/ustdlib.h"
+
+#include "usbmidi_descriptors.h"
+#include "usbmidi_types.h"
+#include "usbcdc_console.h"
+#include "pconfig.h"
+
+#if USBMIDI_CDC
+
+/**
+ * CDC class requests, from the CDC PSTN subclass spec.
+ */
+#define USBCDC_SET_LINE_CODING 0x20
+#define USBCDC_GET_LINE_CODING 0x21
+#define USBCDC_SET_CONTROL_LINE_STATE 0x22
+
+/**
+ * SET_CONTROL_LINE_STATE's wValue bit for DTR, which the host sets when it opens the port.
+ */
+#define USBCDC_CONTROL_LINE_DTR 0x0001
+
+/**
+ * The size of the line coding structure.
+ */
+#define USBCDC_LINE_CODING_SIZE 7
+
+/**
+ * The line coding the host sets and gets back. It means nothing to us, as there is
+ * no real UART behind the port, but hosts want it to stick. 115200 8N1 to start with.
+ */
+static uint8_t g_pui8CDCLineCoding[USBCDC_LINE_CODING_SIZE] =
+{
+	0x00, 0xC2, 0x01, 0x00,		// dwDTERate, 115200
+	0,							// bCharFormat, 1 stop bit
+	0,							// bParityType, none
+	8							// bDataBits
+};
+
+/**
+ * True while the host has the port open.
+ */
+static volatile bool g_bCDCOpen;
+
+/**
+ * True while a packet is in the data IN endpoint, and how big it is.
+ */
+static volatile bool g_bCDCTxBusy;
+static uint32_t g_ui32CDCTxSize;
+
+/**
+ * True while a data OUT packet waits for room in the receive ring.
+ */
+static volatile bool g_bCDCRxHeld;
+
+/**
+ * The transmit ring and its storage.
+ */
+static uint8_t g_pui8CDCTxBuf[USBCDC_TX_BUFFER_SIZE];
+static tUSBBuffer g_sCDCTxBuffer;
+
+/**
+ * The receive ring and its storage.
+ */
+static uint8_t g_pui8CDCRxBuf[USBCDC_RX_BUFFER_SIZE];
+static tUSBRingBufObject g_sCDCRxRing;
+
+/**
+ * USBBuffer asks this how much it may send: a packet if the endpoint is free and
+ * the host is listening, else nothing.
+ */
+static uint32_t USBCDCTxAvailable(void *pvHandle)
+{
+	(void) pvHandle;
+
+	if( !g_bCDCOpen || g_bCDCTxBusy )
+		return 0;
+
+	return USBMIDI_EP_PACKET_SIZE;
+}
+
+/**
+ * USBBuffer hands us a packet's bytes, in one or two pieces. Load them into the
+ * endpoint, and send it after the last piece.
+ */
+static uint32_t USBCDCTxTransfer(void *pvHandle, uint8_t *pui8Data, uint32_t ui32Length, bool bLast)
+{
+	(void) pvHandle;
+
+	if( !g_bCDCTxBusy )
+		g_ui32CDCTxSize = 0;
+
+	MAP_USBEndpointDataPut(USB0_BASE, USB_EP_4, pui8Data, ui32Length);
+	g_ui32CDCTxSize += ui32Length;
+	g_bCDCTxBusy = true;
+
+	if( bLast )
+		MAP_USBEndpointDataSend(USB0_BASE, USB_EP_4, USB_TRANS_IN);
+
+	return ui32Length;
+}
+
+/**
+ * USBBuffer passes its events on to us. There is nothing to do with them.
+ */
+static uint32_t USBCDCTxEvent(void *pvCBData, uint32_t ui32Event, uint32_t ui32MsgParam, void *pvMsgData)
+{
+	(void) pvCBData;
+	(void) ui32Event;
+	(void) ui32MsgParam;
+	(void) pvMsgData;
+
+	return 0;
+}
+
+/**
+ * Set up the buffers.
+ */
+void USBCDC_Init(void)
+{
+	g_sCDCTxBuffer.bTransmitBuffer = true;
+	g_sCDCTxBuffer.pfnCallback = USBCDCTxEvent;
+	g_sCDCTxBuffer.pvCBData = 0;
+	g_sCDCTxBuffer.pfnTransfer = USBCDCTxTransfer;
+	g_sCDCTxBuffer.pfnAvailable = USBCDCTxAvailable;
+	g_sCDCTxBuffer.pvHandle = 0;
+	g_sCDCTxBuffer.pui8Buffer = g_pui8CDCTxBuf;
+	g_sCDCTxBuffer.ui32BufferSize = sizeof(g_pui8CDCTxBuf);
+	USBBufferInit(&g_sCDCTxBuffer);
+
+	// a terminal may not be expecting a zero-length packet, but a full last
+	// packet needs one to end the transfer.
+	USBBufferZeroLengthPacketInsert(&g_sCDCTxBuffer, true);
+
+	USBRingBufInit(&g_sCDCRxRing, g_pui8CDCRxBuf, sizeof(g_pui8CDCRxBuf));
+
+	USBCDC_Reset();
+}
+
+/**
+ * Start afresh when the configuration changes and when the bus goes away, since
+ * the endpoints have been reset. What was printed before the host opened the port,
+ * such as at power up, is kept for when it does. But if a packet was in flight,
+ * USBBuffer would wait forever for it to go, so then the ring is thrown away.
+ */
+void USBCDC_Reset(void)
+{
+	g_bCDCOpen = false;
+	if( g_bCDCTxBusy )
+		USBBufferFlush(&g_sCDCTxBuffer);
+	g_bCDCTxBusy = false;
+	g_bCDCRxHeld = false;
+	USBRingBufFlush(&g_sCDCRxRing);
+}
+
+/**
+ * True if the host has the port open.
+ */
+bool USBCDC_IsOpen(void)
+{
+	return g_bCDCOpen;
+}
+
+/**
+ * Queue bytes for the host, as many as fit. The USB interrupt takes them from the
+ * ring too, so it is masked while we write.
+ */
+uint32_t USBCDC_Write(const uint8_t *buf, uint32_t size)
+{
+	bool bIntStatus;
+	uint32_t written;
+
+	bIntStatus = MAP_IntMasterDisable();
+	written = USBBufferWrite(&g_sCDCTxBuffer, buf, size);
+	if( !bIntStatus )
+		MAP_IntMasterEnable();
+
+	return written;
+}
+
+/**
+ * Format into a line buffer with uvsnprintf(), and queue it.
+ */
+void USBCDC_printf(const char *fmt, ...)
+{
+	char line[USBCDC_PRINTF_MAX];
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = uvsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+
+	if( len > (int) sizeof(line) - 1 )
+		len = sizeof(line) - 1;
+	if( len > 0 )
+		USBCDC_Write((const uint8_t *) line, len);
+}
+
+/**
+ * Take the packet waiting in the data OUT endpoint if it fits in the receive ring.
+ * If it doesn't, it stays in the endpoint, and the host is NAKed until USBCDC_Read()
+ * makes room. Call from the USB ISR or with interrupts masked.
+ */
+void USBCDC_HandleOut(void)
+{
+	uint8_t packet[USBMIDI_EP_PACKET_SIZE];
+	uint32_t size;
+
+	if( !(MAP_USBEndpointStatus(USB0_BASE, USB_EP_4) & USB_DEV_RX_PKT_RDY) )
+		return;
+
+	size = MAP_USBEndpointDataAvail(USB0_BASE, USB_EP_4);
+	if( size > USBRingBufFree(&g_sCDCRxRing) )
+	{
+		g_bCDCRxHeld = true;
+		return;
+	}
+
+	MAP_USBEndpointDataGet(USB0_BASE, USB_EP_4, packet, &size);
+	USBRingBufWrite(&g_sCDCRxRing, packet, size);
+	g_bCDCRxHeld = false;
+	MAP_USBDevEndpointDataAck(USB0_BASE, USB_EP_4, true);
+}
+
+/**
+ * The data IN endpoint has sent its packet. Let USBBuffer drop those bytes and
+ * send the next ones.
+ */
+void USBCDC_HandleIn(void)
+{
+	g_bCDCTxBusy = false;
+	USBBufferEventCallback(&g_sCDCTxBuffer, USB_EVENT_TX_COMPLETE, g_ui32CDCTxSize, 0);
+}
+
+/**
+ * Take up to max bytes that the host sent, and then the packet that was waiting
+ * for room, if there was one.
+ */
+uint32_t USBCDC_Read(uint8_t *buf, uint32_t max)
+{
+	bool bIntStatus;
+	uint32_t size;
+
+	bIntStatus = MAP_IntMasterDisable();
+
+	size = USBRingBufUsed(&g_sCDCRxRing);
+	if( size > max )
+		size = max;
+	if( size )
+		USBRingBufRead(&g_sCDCRxRing, buf, size);
+
+	if( g_bCDCRxHeld )
+		USBCDC_HandleOut();
+
+	if( !bIntStatus )
+		MAP_IntMasterEnable();
+
+	return size;
+}
+
+/**
+ * The CDC class requests for the communications interface. Opening the port sets
+ * DTR, and then whatever is in the transmit ring starts to go.
+ * \returns false if the request isn't one of ours.
+ */
+bool USBCDC_HandleRequest(tUSBRequest *pUSBRequest)
+{
+	if( ((pUSBRequest->bmRequestType & USB_RTYPE_TYPE_M) != USB_RTYPE_CLASS) ||
+		((pUSBRequest->wIndex & 0xFF) != USBMIDI_CDC_COMM_INTERFACE) )
+		return false;
+
+	switch( pUSBRequest->bRequest )
+	{
+	case USBCDC_SET_LINE_CODING:
+		// the data stage ends up in USBCDC_HandleEP0Data().
+		USBDCDRequestDataEP0(0, g_pui8CDCLineCoding, USBCDC_LINE_CODING_SIZE);
+		MAP_USBDevEndpointDataAck(USB0_BASE, USB_EP_0, false);
+		return true;
+
+	case USBCDC_GET_LINE_CODING:
+		MAP_USBDevEndpointDataAck(USB0_BASE, USB_EP_0, false);
+		USBDCDSendDataEP0(0, g_pui8CDCLineCoding, USBCDC_LINE_CODING_SIZE);
+		return true;
+
+	case USBCDC_SET_CONTROL_LINE_STATE:
+		MAP_USBDevEndpointDataAck(USB0_BASE, USB_EP_0, true);
+		g_bCDCOpen = (pUSBRequest->wValue & USBCDC_CONTROL_LINE_DTR) != 0;
+		if( g_bCDCOpen )
+			USBBufferDataWritten(&g_sCDCTxBuffer, 0);
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/**
+ * The line coding from SET_LINE_CODING has arrived in g_pui8CDCLineCoding. The
+ * USB library acks it.
+ */
+void USBCDC_HandleEP0Data(uint32_t ui32DataSize)
+{
+	(void) ui32DataSize;
+}
+
+#endif
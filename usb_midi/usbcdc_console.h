@@ -0,0 +1,87 @@
+/*
+ * usbcdc_console.h
+ *
+ *  Created on: Aug 19, 2020
+ *      Author: andy
+ *
+ * A CDC-ACM serial port on our own USB device, next to the MIDI interfaces, for
+ * the debug console. Built in with USBMIDI_CDC in pconfig.h. The device is then
+ * composite: each function has an Interface Association Descriptor, and the host
+ * gives the MIDI interfaces to its MIDI driver and these two to its serial driver.
+ *
+ * What is printed goes into a ring buffer, usblib's USBBuffer, and the USB
+ * interrupt sends it to the host 64 bytes at a time, once the host has the port
+ * open (DTR set). Printing never waits: what doesn't fit in the buffer is dropped.
+ * So the console costs the main loop a copy into memory, where UARTprintf() on
+ * UART0 would wait for every byte to go at 115200 baud.
+ *
+ * What the host types is kept in a second ring, for USBCDC_Read(). If that is
+ * full, the host is NAKed until it isn't.
+ */
+
+#ifndef USB_MIDI_USBCDC_CONSOLE_H_
+#define USB_MIDI_USBCDC_CONSOLE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "usblib/usblib.h"
+#include "pconfig.h"
+
+/**
+ * The sizes of the transmit and receive rings.
+ */
+#define USBCDC_TX_BUFFER_SIZE 1024
+#define USBCDC_RX_BUFFER_SIZE 128
+
+/**
+ * Where the console goes: the CDC port if there is one, else UART0. In host mode
+ * we aren't a device, so it is UART0 then too.
+ */
+#if USBMIDI_CDC && !USBMIDI_HOST
+#define CONSOLE_printf USBCDC_printf
+#else
+#define CONSOLE_printf UARTprintf
+#endif
+
+/**
+ * Set up the buffers. USBMIDI_Init() does this.
+ */
+void USBCDC_Init(void);
+
+/**
+ * True if the host has the port open.
+ */
+bool USBCDC_IsOpen(void);
+
+/**
+ * Queue bytes for the host, as many as fit.
+ * \returns how many were queued.
+ */
+uint32_t USBCDC_Write(const uint8_t *buf, uint32_t size);
+
+/**
+ * printf to the host, with the formats ustdlib knows. A line longer than
+ * USBCDC_PRINTF_MAX bytes is cut short.
+ */
+#define USBCDC_PRINTF_MAX 128
+void USBCDC_printf(const char *fmt, ...);
+
+/**
+ * Take up to max bytes that the host sent.
+ * \returns how many there were.
+ */
+uint32_t USBCDC_Read(uint8_t *buf, uint32_t max);
+
+/**
+ * For usbmidi_handlers.c: the CDC class requests, the data stage of
+ * SET_LINE_CODING, the data endpoint's interrupts, and a fresh start when the
+ * configuration changes or the bus goes away.
+ */
+bool USBCDC_HandleRequest(tUSBRequest *pUSBRequest);
+void USBCDC_HandleEP0Data(uint32_t ui32DataSize);
+void USBCDC_HandleIn(void);
+void USBCDC_HandleOut(void);
+void USBCDC_Reset(void);
+
+#endif /* USB_MIDI_USBCDC_CONSOLE_H_ */
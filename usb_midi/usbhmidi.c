@@ -0,0 +1,401 @@
+/*
+ * usbhmidi.c
+ *
+ *  Created on: Aug 18, 2020
+ *      Author: andy
+ *
+ * USB MIDI host class driver. See usbhmidi.h.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "inc/hw_memmap.h"
+#include "inc/hw_types.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/rom.h"
+#include "driverlib/rom_map.h"
+#include "driverlib/gpio.h"
+#include "driverlib/usb.h"
+#include "usblib/usblib.h"
+#include "usblib/usbaudio.h"
+#include "usblib/host/usbhost.h"
+#include "usblib/host/usbhostpriv.h"
+#include "usblib/host/usbhhub.h"
+
+#include "usb_midi.h"
+#include "usb_midi_fifo.h"
+#include "usbhmidi.h"
+#include "pconfig.h"
+
+/**
+ * Most bytes in a bulk IN packet, at full speed.
+ */
+#define USBHMIDI_PACKET_SIZE 64
+
+/**
+ * Memory for the host stack to keep each device's configuration descriptor in.
+ * It is shared out between all of the devices it can have (MAX_USB_DEVICES, 5),
+ * so a hub and the four devices behind it each get a fifth of this.
+ */
+#define USBHMIDI_POOL_SIZE 2048
+
+/**
+ * Everything about one open USB MIDI device.
+ */
+typedef struct
+{
+	// the device, from the host stack. 0 while the slot is free.
+	tUSBHostDevice *psDevice;
+
+	// the pipe to the device's bulk IN endpoint.
+	uint32_t ui32InPipe;
+
+	// how many cables the device sends on, from its class-specific endpoint descriptor.
+	uint8_t ui8NumCables;
+
+	// the IN packet, read here by the USB ISR, and how many event packets are in it.
+	uint8_t pui8InBuf[USBHMIDI_PACKET_SIZE];
+	uint32_t ui32InCount;
+
+	// true while that packet waits for room in the FIFO. No IN is asked for meanwhile.
+	volatile bool bInHeld;
+
+	// the device's messages, pushed by the USB ISR and popped by the main loop.
+	USBMIDIFIFO_t sInFifo;
+} tUSBHMIDIInstance;
+
+static tUSBHMIDIInstance g_psUSBHMIDI[USBHMIDI_MAX_DEVICES];
+
+static uint8_t g_pui8HCDPool[USBHMIDI_POOL_SIZE];
+
+static void *USBHMIDIOpen(tUSBHostDevice *psDevice);
+static void USBHMIDIClose(void *pvInstance);
+
+/**
+ * The class driver. The host stack looks at a device's first interface, which for
+ * a USB MIDI device is Audio Control, or MIDI Streaming if it has no AC interface.
+ * Both are audio class. USBHMIDIOpen() turns down audio devices that aren't MIDI.
+ */
+static const tUSBHostClassDriver g_sUSBHostMIDIClassDriver =
+{
+	USB_CLASS_AUDIO,
+	USBHMIDIOpen,
+	USBHMIDIClose,
+	0
+};
+
+/**
+ * A hub is handled by the USB library's hub driver, which enumerates the devices
+ * on its ports. Each is then offered to us like one plugged in directly.
+ */
+static const tUSBHostClassDriver * const g_ppsHostClassDrivers[] =
+{
+	&g_sUSBHubClassDriver,
+	&g_sUSBHostMIDIClassDriver
+};
+
+/**
+ * Ask the device for its next IN packet. The USB ISR gets it in
+ * USBHMIDIPipeCallback().
+ */
+static void USBHMIDIRequestIn(tUSBHMIDIInstance *psInst)
+{
+	USBHCDPipeSchedule(psInst->ui32InPipe, psInst->pui8InBuf, USBHMIDI_PACKET_SIZE);
+}
+
+/**
+ * Push the held IN packet onto the FIFO if it all fits, and ask for the next.
+ * \returns true if it was pushed.
+ */
+static bool USBHMIDIPushIn(tUSBHMIDIInstance *psInst)
+{
+	if( psInst->ui32InCount > USBMIDIFIFO_Space(&psInst->sInFifo) )
+		return false;
+
+	USBMIDIFIFO_PushBatch(&psInst->sInFifo, psInst->pui8InBuf, psInst->ui32InCount);
+	psInst->bInHeld = false;
+	USBHMIDIRequestIn(psInst);
+
+	return true;
+}
+
+/**
+ * Bulk IN pipe events, from the USB ISR.
+ *
+ * USB_EVENT_RX_AVAILABLE: the host stack has read the packet into our buffer.
+ * Ack it, so the controller is free, then push its events and ask for the next
+ * packet. If they don't fit, hold the packet, and USBHMIDI_Task() pushes it once
+ * the main loop has made room.
+ *
+ * A stall or an error stops the polling. The device is most likely on its way out,
+ * and its disconnect closes the slot.
+ */
+static void USBHMIDIPipeCallback(uint32_t ui32Pipe, uint32_t ui32Event)
+{
+	tUSBHMIDIInstance *psInst;
+	uint32_t dev;
+
+	for( dev = 0; dev < USBHMIDI_MAX_DEVICES; dev++ )
+	{
+		psInst = &g_psUSBHMIDI[dev];
+		if( psInst->psDevice && (psInst->ui32InPipe == ui32Pipe) )
+			break;
+	}
+	if( USBHMIDI_MAX_DEVICES == dev )
+		return;
+
+	if( USB_EVENT_RX_AVAILABLE == ui32Event )
+	{
+		// a stray partial event at the end is dropped.
+		psInst->ui32InCount = USBHCDPipeTransferSizeGet(ui32Pipe) / 4;
+		USBHCDPipeDataAck(ui32Pipe);
+
+		psInst->bInHeld = true;
+		USBHMIDIPushIn(psInst);
+	}
+}
+
+/**
+ * Find the MIDI Streaming interface, alternate setting 0, in a configuration.
+ * \returns the interface descriptor, or 0 if there isn't one.
+ */
+static tInterfaceDescriptor *USBHMIDIFindStreaming(tConfigDescriptor *psConfig)
+{
+	tInterfaceDescriptor *psInterface;
+	uint32_t idx;
+
+	for( idx = 0; ; idx++ )
+	{
+		psInterface = USBDescGetInterface(psConfig, idx, USB_DESC_ANY);
+		if( 0 == psInterface )
+			return 0;
+
+		if( (USB_CLASS_AUDIO == psInterface->bInterfaceClass) &&
+			(USB_ASC_MIDI_STREAMING == psInterface->bInterfaceSubClass) &&
+			(0 == psInterface->bAlternateSetting) )
+			return psInterface;
+	}
+}
+
+/**
+ * Pick a slot for a new device. Behind a hub, a device on port n gets slot n - 1,
+ * so a device keeps its slot, and so its cables, for as long as it stays in the
+ * same hub port. Plugged in directly, it gets slot 0. If that slot is taken, or
+ * there is no such slot, the first free one will do.
+ * \returns the slot, or USBHMIDI_MAX_DEVICES if they are all taken.
+ */
+static uint32_t USBHMIDISlot(tUSBHostDevice *psDevice)
+{
+	uint32_t dev;
+
+	dev = 0;
+	if( psDevice->ui8Hub && psDevice->ui8HubPort )
+		dev = psDevice->ui8HubPort - 1;
+
+	if( (dev < USBHMIDI_MAX_DEVICES) && (0 == g_psUSBHMIDI[dev].psDevice) )
+		return dev;
+
+	for( dev = 0; dev < USBHMIDI_MAX_DEVICES; dev++ )
+	{
+		if( 0 == g_psUSBHMIDI[dev].psDevice )
+			break;
+	}
+	return dev;
+}
+
+/**
+ * A device of our class has been enumerated. Give it a slot, find the device's
+ * MIDI Streaming interface and its bulk IN endpoint, open a pipe to it, and start
+ * polling.
+ *
+ * \returns the slot, or 0 to turn the device down: no free slot, no MIDI
+ * Streaming interface, no bulk IN endpoint, or no pipe left.
+ */
+static void *USBHMIDIOpen(tUSBHostDevice *psDevice)
+{
+	tUSBHMIDIInstance *psInst;
+	tConfigDescriptor *psConfig;
+	tInterfaceDescriptor *psInterface;
+	tEndpointDescriptor *psEndpoint;
+	const uint8_t *pui8CS;
+	const uint8_t *pui8End;
+	uint32_t ui32MaxPacket;
+	uint32_t dev;
+	uint32_t idx;
+
+	dev = USBHMIDISlot(psDevice);
+	if( USBHMIDI_MAX_DEVICES == dev )
+		return 0;
+	psInst = &g_psUSBHMIDI[dev];
+
+	psConfig = psDevice->psConfigDescriptor;
+	pui8End = (const uint8_t *) psConfig + psConfig->wTotalLength;
+
+	psInterface = USBHMIDIFindStreaming(psConfig);
+	if( 0 == psInterface )
+		return 0;
+
+	for( idx = 0; ; idx++ )
+	{
+		psEndpoint = USBDescGetInterfaceEndpoint(psInterface, idx,
+				pui8End - (const uint8_t *) psInterface);
+		if( 0 == psEndpoint )
+			return 0;
+
+		if( ((psEndpoint->bmAttributes & USB_EP_ATTR_TYPE_M) == USB_EP_ATTR_BULK) &&
+			(psEndpoint->bEndpointAddress & USB_EP_DESC_IN) )
+			break;
+	}
+
+	// the MS endpoint descriptor comes right after, and counts the embedded jacks.
+	psInst->ui8NumCables = 1;
+	pui8CS = (const uint8_t *) psEndpoint + psEndpoint->bLength;
+	if( ((pui8CS + 4) <= pui8End) &&
+		(USB_CS_ENDPOINT_DESCRIPTOR == pui8CS[1]) &&
+		(USB_MIDI_CS_EP_MS_GENERAL == pui8CS[2]) && pui8CS[3] )
+	{
+		psInst->ui8NumCables = pui8CS[3];
+	}
+
+	psInst->ui32InPipe = USBHCDPipeAlloc(0, USBHCD_PIPE_BULK_IN, psDevice, USBHMIDIPipeCallback);
+	if( 0 == psInst->ui32InPipe )
+		return 0;
+
+	ui32MaxPacket = psEndpoint->wMaxPacketSize & 0x7FF;
+	if( ui32MaxPacket > USBHMIDI_PACKET_SIZE )
+		ui32MaxPacket = USBHMIDI_PACKET_SIZE;
+
+	// no NAK limit: the controller asks again until the device has something.
+	USBHCDPipeConfig(psInst->ui32InPipe, ui32MaxPacket, 0,
+			psEndpoint->bEndpointAddress & USB_EP_DESC_NUM_M);
+
+	USBMIDIFIFO_Init(&psInst->sInFifo);
+	psInst->bInHeld = false;
+	psInst->psDevice = psDevice;
+
+	MAP_GPIOPinWrite(LED_PORT, LED_LED0, LED_LED0);
+
+	USBHMIDIRequestIn(psInst);
+
+	return psInst;
+}
+
+/**
+ * The device has gone. Free its pipe and its slot. Messages still in its FIFO
+ * are thrown away.
+ */
+static void USBHMIDIClose(void *pvInstance)
+{
+	tUSBHMIDIInstance *psInst;
+	bool bIntStatus;
+
+	uint32_t dev;
+
+	psInst = (tUSBHMIDIInstance *) pvInstance;
+
+	bIntStatus = MAP_IntMasterDisable();
+	USBHCDPipeFree(psInst->ui32InPipe);
+	psInst->ui32InPipe = 0;
+	psInst->psDevice = 0;
+	psInst->bInHeld = false;
+	if( !bIntStatus )
+		MAP_IntMasterEnable();
+
+	// the LED stays on while any device is open.
+	for( dev = 0; dev < USBHMIDI_MAX_DEVICES; dev++ )
+	{
+		if( g_psUSBHMIDI[dev].psDevice )
+			return;
+	}
+	MAP_GPIOPinWrite(LED_PORT, LED_LED0, 0);
+}
+
+/**
+ * Hub events. The hub driver does all the work, so there is nothing to do.
+ */
+static void USBHMIDIHubCallback(tHubInstance *psHubInstance, uint32_t ui32Event,
+		uint32_t ui32MsgParam, void *pvMsgData)
+{
+	(void) psHubInstance;
+	(void) ui32Event;
+	(void) ui32MsgParam;
+	(void) pvMsgData;
+}
+
+void USBHMIDI_Init(void)
+{
+	USBHCDRegisterDrivers(0, g_ppsHostClassDrivers,
+			sizeof(g_ppsHostClassDrivers) / sizeof(g_ppsHostClassDrivers[0]));
+
+	// the hub driver must be open before a hub can be enumerated.
+	USBHHubOpen(USBHMIDIHubCallback);
+
+	// The LaunchPad's VBUS switch is turned on by USB0EPEN, active high. Its
+	// fault output isn't wired to us.
+	USBHCDPowerConfigInit(0, USBHCD_VBUS_AUTO_HIGH | USBHCD_VBUS_FILTER);
+
+	USBHCDInit(0, g_pui8HCDPool, USBHMIDI_POOL_SIZE);
+}
+
+void USBHMIDI_Task(void)
+{
+	tUSBHMIDIInstance *psInst;
+	bool bIntStatus;
+	uint32_t dev;
+
+	USBHCDMain();
+
+	for( dev = 0; dev < USBHMIDI_MAX_DEVICES; dev++ )
+	{
+		psInst = &g_psUSBHMIDI[dev];
+		if( psInst->bInHeld )
+		{
+			// the USB ISR also pushes and asks for packets, so keep it out.
+			bIntStatus = MAP_IntMasterDisable();
+			if( psInst->bInHeld && psInst->psDevice )
+			{
+				USBHMIDIPushIn(psInst);
+			}
+			if( !bIntStatus )
+				MAP_IntMasterEnable();
+		}
+	}
+}
+
+bool USBHMIDI_IsConnected(uint32_t dev)
+{
+	if( dev >= USBHMIDI_MAX_DEVICES )
+		return false;
+
+	return (0 != g_psUSBHMIDI[dev].psDevice);
+}
+
+uint8_t USBHMIDI_NumCables(uint32_t dev)
+{
+	if( dev >= USBHMIDI_MAX_DEVICES )
+		return 0;
+
+	return g_psUSBHMIDI[dev].ui8NumCables;
+}
+
+uint32_t USBHMIDI_ReadSpan(uint32_t dev, const USBMIDI_Message_t **span)
+{
+	const uint8_t *bytes;
+	uint32_t count;
+
+	if( dev >= USBHMIDI_MAX_DEVICES )
+		return 0;
+
+	count = USBMIDIFIFO_ReadSpan(&g_psUSBHMIDI[dev].sInFifo, &bytes);
+	*span = (const USBMIDI_Message_t *) bytes;
+	return count;
+}
+
+void USBHMIDI_ReadCommit(uint32_t dev, uint32_t count)
+{
+	if( dev >= USBHMIDI_MAX_DEVICES )
+		return;
+
+	USBMIDIFIFO_ReadCommit(&g_psUSBHMIDI[dev].sInFifo, count);
+}
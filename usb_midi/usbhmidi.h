@@ -0,0 +1,97 @@
+/*
+ * usbhmidi.h
+ *
+ *  Created on: Aug 18, 2020
+ *      Author: andy
+ *
+ * USB MIDI host: a class driver for the TI USB host stack, for class-compliant
+ * USB MIDI devices such as USB-only keyboards. Built in with USBMIDI_HOST in
+ * pconfig.h, in which case USB0 is a host and not the USB MIDI device.
+ *
+ * When a device is plugged in, the host stack offers it to us if its first
+ * interface is audio class. We look through its configuration for the MIDI
+ * Streaming interface, and take its bulk IN endpoint. The class-specific endpoint
+ * descriptor after it says how many cables (embedded jacks) the device sends on.
+ *
+ * The USB interrupt reads each IN packet into a buffer and pushes its event
+ * packets onto the device's message FIFO, then asks for the next one. The host
+ * controller keeps sending IN tokens until the device has something, so an event
+ * reaches the FIFO in the frame it was sent. If the FIFO hasn't room for a whole
+ * packet, the packet is held and no more are asked for until the main loop makes
+ * room, so the device waits instead of us losing messages.
+ *
+ * The main loop takes the messages with USBHMIDI_ReadSpan() and
+ * USBHMIDI_ReadCommit(), as the device side does with its OUT cables.
+ *
+ * Up to USBHMIDI_MAX_DEVICES devices can be open at once, behind a hub. The USB
+ * library's hub driver enumerates them, and each gets a slot of its own: pipe,
+ * packet buffer and message FIFO. A device on hub port n is in slot n - 1. Every
+ * slot's bulk IN is outstanding at once, each on its own host endpoint, so the
+ * USB controller shares the bus out between them and a busy device can only fill
+ * its own FIFO.
+ */
+
+#ifndef USB_MIDI_USBHMIDI_H_
+#define USB_MIDI_USBHMIDI_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "usb_midi.h"
+#include "pconfig.h"
+
+/**
+ * How many USB MIDI devices we look after at once. A hub takes one of the USB
+ * library's MAX_USB_DEVICES (5) for itself, which leaves four.
+ */
+#define USBHMIDI_MAX_DEVICES 4
+
+/**
+ * The USB0 vector: the host stack's ISR with USBMIDI_HOST, else the USB MIDI
+ * device's. The startup code puts this in the vector table.
+ */
+#if USBMIDI_HOST
+extern void USB0HostIntHandler(void);
+#define USBMIDI_USB0_VECTOR USB0HostIntHandler
+#else
+extern void USBMIDI_IntHandler(void);
+#define USBMIDI_USB0_VECTOR USBMIDI_IntHandler
+#endif
+
+/**
+ * Start the USB host stack with our class driver. Call after
+ * USBStackModeSet(0, eUSBModeHost, 0), with the USB clocks set with
+ * USBHCDFeatureSet().
+ */
+void USBHMIDI_Init(void);
+
+/**
+ * Run the host stack: enumeration, connects and disconnects. Call this often
+ * from the main loop. It also asks for the next IN packet of a device whose
+ * last one was held, once there is room for it.
+ */
+void USBHMIDI_Task(void);
+
+/**
+ * True if a USB MIDI device is open in slot dev.
+ */
+bool USBHMIDI_IsConnected(uint32_t dev);
+
+/**
+ * How many cables device dev sends on. Its messages are on cables 0 to this - 1.
+ */
+uint8_t USBHMIDI_NumCables(uint32_t dev);
+
+/**
+ * Get the oldest messages from device dev without copying them.
+ * \param[out] span: set to point at the first of them.
+ * \returns how many there are in one piece. There may be more after a wrap.
+ */
+uint32_t USBHMIDI_ReadSpan(uint32_t dev, const USBMIDI_Message_t **span);
+
+/**
+ * Pop count messages that were read through USBHMIDI_ReadSpan().
+ */
+void USBHMIDI_ReadCommit(uint32_t dev, uint32_t count);
+
+#endif /* USB_MIDI_USBHMIDI_H_ */
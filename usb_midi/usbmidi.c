@@ -8,6 +8,30 @@
  *  2020-02-25 andy. We can combine all of the config descriptor parts into one big lump.
  *  	This means the Audio Control and the MIDI Streaming interfaces are combined into
  *  	one.
+ *  2020-08-18 andy. The IN endpoint sends full packets of 16 messages, or a partial
+ *  	packet at a start-of-frame deadline. See USBMIDI_InEpSendMessages().
+ *  2020-08-18 andy. An OUT packet that doesn't fit in the OUT FIFO is not acked until
+ *  	it does, so the host is NAKed rather than messages being overwritten.
+ *  2020-08-18 andy. The message FIFOs are lock-free SPSC queues. Packets are copied
+ *  	to and from them whole, not one message at a time.
+ *  2020-08-18 andy. Optional USB DMA for the MIDI endpoints, USBMIDI_DMA in pconfig.h.
+ *  2020-08-18 andy. EP1 is double buffered both ways, USBMIDI_DOUBLE_BUFFER in pconfig.h.
+ *  2020-08-18 andy. USBMIDI_UMP adds alternate setting 1 of the MS interface, USB MIDI 2.0.
+ *  	See usbmidi_ump.h.
+ *  2020-08-18 andy. The jacks and the MS endpoint descriptors are made by macros for
+ *  	USBMIDI_NUM_CABLES_OUT and USBMIDI_NUM_CABLES_IN cables, and the lengths are worked
+ *  	out from those and checked at build time. The old wTotalLength of 0x61 was wrong.
+ *  2020-08-18 andy. The OUT endpoint is read a word at a time, and each message goes
+ *  	straight onto a queue for its cable, so a slow cable doesn't hold up the others'
+ *  	consumers. The OUT DMA is gone, as it can't sort by cable.
+ *  2020-08-19 andy. USBMIDI_InEpMsgWriteBatch() and USBMIDI_InEpSpace(), so the DIN
+ *  	ports can hand over their messages a run at a time.
+ *  2020-08-19 andy. USBMIDI_VENDOR adds a vendor-specific interface with a bulk OUT
+ *  	endpoint for raw byte streams to a DIN port.
+ *  2020-08-19 andy. USBMIDI_CDC makes the device composite, with a CDC-ACM console.
+ *  	The IAD is used at last. See usbcdc_console.h.
+ *  2020-08-19 andy. USBMIDI_REMOTE_WAKEUP: DIN input wakes a suspended host, and
+ *  	what waited goes at once on resume.
  *
  *  Good fucking god the API is over-complicated.
  *
@@ -37,8 +61,9 @@
  *
  * Interrupt handlers.
  *
- * The USB0 interrupt invokes USB0DeviceIntHandler() (in usbdhandler.c) and
- * that calls USBDeviceIntHandlerInternal() with the interrupt status
+ * The USB0 interrupt invokes USBMIDI_IntHandler(), which calls
+ * USB0DeviceIntHandler() (in usbdhandler.c) and then checks whether a partial IN
+ * packet is due to be sent. USB0DeviceIntHandler() calls USBDeviceIntHandlerInternal() with the interrupt status
  * from MAP_USBIntStatusControl().
  *
  * USBDeviceIntHandler() invokes callbacks for the various interrupt conditions,
@@ -62,6 +87,7 @@
 #include "inc/hw_memmap.h"
 #include "inc/hw_types.h"
 #include "driverlib/debug.h"
+#include "driverlib/interrupt.h"
 #include "driverlib/rom.h"
 #include "driverlib/rom_map.h"
 #include "driverlib/usb.h"
@@ -69,11 +95,13 @@
 #include "usblib/usblibpriv.h"
 #include "usblib/usbaudio.h"
 #include "usblib/device/usbdevice.h"
+#include "usblib/device/usbdevicepriv.h"
 
 #include "usbmidi.h"
 #include "usbmidi_types.h"
 #include "usbmidi_descriptors.h"
 #include "usbmidi_handlers.h"
+#include "usbcdc_console.h"
 #include "pconfig.h"
 
 /****************************************************************************
@@ -87,12 +115,15 @@ const uint8_t g_pui8AudioMIDIDeviceDescriptor[] =
     18,                   // bLength
     USB_DTYPE_DEVICE,     // bDescriptorType
     USBShort(0x0110),     // bcdUSB
+#if USBMIDI_CDC
+    USB_CLASS_MISC,             // bDeviceClass: miscellaneous class device for IAD
+    USB_MISC_SUBCLASS_COMMON,   // bDeviceSubClass: Common class for IAD
+    USB_MISC_PROTOCOL_IAD,      // bDeviceProtocol: Interface Association Descriptor.
+#else
     0x00,               // bDeviceClass,  defined at interface level
-//	0xEF,				  // bDeviceClass: miscellaneous class device for IAD
     0x00,               // bDeviceSubClass, defined at interface level
-//	0x02,				  // bDeviceSubClass: Common class for IAD
     0x00,               // bDeviceProtocol, defined at interface level
-//	0x01,				  // bDeviceProtocol: Interface Association Descriptor.
+#endif
     MAX_PACKET_SIZE_EP0,  // bMaxPacketSize0
     USBShort(0x14C5),     // idVendor
     USBShort(0x0668),     // idProduct
@@ -128,23 +159,25 @@ const uint8_t g_pui8AudioMIDIDeviceDescriptor[] =
 /**
  * Configuration Descriptor Header.
  */
-#define USBMIDI_INTERFACEDESCRIPTOR_SIZE (129)
-//#define USBMIDI_INTERFACEDESCRIPTOR_SIZE (137)
-
 const uint8_t g_pui8MidiDescriptor[] =
 {
     9,                         // bLength:         Size of this descriptor
     USB_DTYPE_CONFIGURATION,   // bDescriptorType: Type of descriptor
-    USBShort(USBMIDI_INTERFACEDESCRIPTOR_SIZE),             // wTotalLength:    Total size of full config descriptor, will be patched
-    2,                         // bNumInterfaces:  # of interfaces, Audio Control and MIDI Streaming
+    USBShort(USBMIDI_CONFIG_TOTAL_SIZE),    // wTotalLength:    Total size of full config descriptor, will be patched
+    USBMIDI_NUM_INTERFACES,    // bNumInterfaces:  # of interfaces, Audio Control and MIDI Streaming (and vendor)
     1,                         // bConfigurationValue: this is config #1
     5,                         // iConfiguration:  index to descriptive string
+#if USBMIDI_REMOTE_WAKEUP
+    USB_CONF_ATTR_SELF_PWR | USB_CONF_ATTR_RWAKE,  // bmAttrib: Self-powered, remote wakeup
+#else
     USB_CONF_ATTR_SELF_PWR,    // bmAttrib:        Self-powered
+#endif
     50                         // bMaxPower:       100 mA from the bus
 };
 
 /**
- * Interface association descriptor, for USB 2 composite devices.
+ * Interface association descriptor, for USB 2 composite devices. With USBMIDI_CDC
+ * it goes in front of the MIDI interfaces.
  */
 const uint8_t g_pui8IADMidiDescriptor[] =
 {
@@ -165,19 +198,6 @@ const tConfigSection g_sIADMidiConfigSection =
     g_pui8IADMidiDescriptor
 };
 
-/**
- * Define the MIDI Jacks for this particular design.
- */
-
-#define JACK1_EMBIN  0x01
-#define JACK2_EXTOUT 0x02
-#define JACK3_EXTIN  0x03
-#define JACK4_EMBOUT 0x04
-#define JACK5_EMBIN  0x05
-#define JACK6_EXTOUT 0x06
-#define JACK7_EXTIN  0x07
-#define JACK8_EMBOUT 0x08
-
 /**
  * The two interface descriptors.
  *
@@ -219,8 +239,8 @@ const uint8_t g_pui8MidiStreamInterface[] =
     // Standard Interface descriptor for a MIDI streaming interface
     9,                         // bDescriptorSize														20
     USB_DTYPE_INTERFACE,       // bDescriptorType														21
-    1,                         // bInterfaceNumber, MIDI streaming is #1								22
-    0,                         // bAlternateSetting, there is none										23
+    USBMIDI_MS_INTERFACE,      // bInterfaceNumber, MIDI streaming is #1								22
+    USBMIDI_ALT_MIDI1,         // bAlternateSetting, 0 is USB-MIDI 1.0									23
     2,                         // bNumEndpoints, we use two												24
     USB_CLASS_AUDIO,           // bInteraceClass, Audio Class											25
     USB_ASC_MIDI_STREAMING,    // bInterfaceSubClass													26
@@ -232,117 +252,260 @@ const uint8_t g_pui8MidiStreamInterface[] =
     USB_DTYPE_CS_INTERFACE,        // bDescriptorType: Class-specific interface descriptor				20
     MIDI_CS_IF_HEADER,             // bDescriptorSubType:												31
     USBShort(0x0100),              // bcdADC, version number of this class spec							32
-    USBShort(0x0061),              // wTotalLength, size of this descriptor								34
-
-    // Jack 1
-    USB_MIDI_IN_JACK_DESC_SIZE,    // bLength, size of a MIDI IN Jack descriptor						36
-    USB_DTYPE_CS_INTERFACE,        // bDescriptorType, this is a class-specific interface descriptor	37
-    MIDI_CS_IF_IN_JACK,            // bDescriptorSubType, a MIDI In Jack descriptor						38
-    MIDI_JACKTYPE_Embedded,        // bJackType, embedded												39
-    JACK1_EMBIN,                   // bJackID, this is Jack 1											40
-    0,                             // iJack, no string.													41
-
-    // Jack 2
-    USB_MIDI_OUT_JACK_DESCRIPTOR_SIZE(1),  // bLength, size of a MIDI OUT Jack descriptor				42
-    USB_DTYPE_CS_INTERFACE,        // bDescriptorType, this is a class-specific interface descriptor	43
-    MIDI_CS_IF_OUT_JACK,           // bDescriptorSubType, a MIDI Out Jack descriptor					44
-    MIDI_JACKTYPE_External,        // bJackType, external												45
-    JACK2_EXTOUT,                  // bJackID, this is Jack 2											46
-    1,                             // bNrInputPins, just one											47
-    JACK1_EMBIN,                   // baSourceID, input source is Jack 1 only							48
-    1,                             // baSourcePin, jack 1 is on input pin 1								49
-    0,                             // iJack, no string													50
-
-	// Jack 3
-	USB_MIDI_IN_JACK_DESC_SIZE,    // bLength, size of a MIDI IN Jack descriptor						51
-	USB_DTYPE_CS_INTERFACE,        // bDescriptorType, this is a class-specific interface descriptor	52
-	MIDI_CS_IF_IN_JACK,            // bDescriptorSubType, a MIDI In Jack descriptor						53
-	MIDI_JACKTYPE_External,        // bJackType, external												54
-	JACK3_EXTIN,                   // bJackID, this is Jack 3											55
-	0,                             // iJack, no string.													56
-
-	// Jack 4
-	USB_MIDI_OUT_JACK_DESCRIPTOR_SIZE(1),  // bLength, size of a MIDI OUT Jack descriptor				57
-	USB_DTYPE_CS_INTERFACE,        // bDescriptorType, this is a class-specific interface descriptor	58
-	MIDI_CS_IF_OUT_JACK,           // bDescriptorSubType, a MIDI Out Jack descriptor					59
-	MIDI_JACKTYPE_Embedded,        // bJackType, embedded												60
-	JACK4_EMBOUT,                  // bJackID, this is Jack 4											61
-	1,                             // bNrInputPins, just one											62
-	JACK3_EXTIN,                   // baSourceID, input source is Jack 3 only							63
-	1,                             // baSourcePin, jack 3 is on input pin 1								64
-	0,                             // iJack, no string													65
-
-	// Jack 5
-	USB_MIDI_IN_JACK_DESC_SIZE,    // bLength, size of a MIDI IN Jack descriptor						66
-	USB_DTYPE_CS_INTERFACE,        // bDescriptorType, this is a class-specific interface descriptor	67
-	MIDI_CS_IF_IN_JACK,            // bDescriptorSubType, a MIDI In Jack descriptor						68
-	MIDI_JACKTYPE_Embedded,        // bJackType, embedded												69
-	JACK5_EMBIN,                   // bJackID, this is Jack 5											70
-	0,                             // iJack, no string.													71
-
-	// Jack 6
-	USB_MIDI_OUT_JACK_DESCRIPTOR_SIZE(1),  // bLength, size of a MIDI OUT Jack descriptor				72
-	USB_DTYPE_CS_INTERFACE,        // bDescriptorType, this is a class-specific interface descriptor	73
-	MIDI_CS_IF_OUT_JACK,           // bDescriptorSubType, a MIDI Out Jack descriptor					74
-	MIDI_JACKTYPE_External,        // bJackType, external												75
-	JACK6_EXTOUT,                  // bJackID, this is Jack 6											76
-	1,                             // bNrInputPins, just one											77
-	JACK5_EMBIN,                   // baSourceID, input source is Jack 5 only							78
-	1,                             // baSourcePin, jack 5 is on input pin 1								79
-	0,                             // iJack, no string													80
-
-	// Jack 7
-	USB_MIDI_IN_JACK_DESC_SIZE,    // bLength, size of a MIDI IN Jack descriptor						81
-	USB_DTYPE_CS_INTERFACE,        // bDescriptorType, this is a class-specific interface descriptor	82
-	MIDI_CS_IF_IN_JACK,            // bDescriptorSubType, a MIDI In Jack descriptor						83
-	MIDI_JACKTYPE_External,        // bJackType, external												84
-	JACK7_EXTIN,                   // bJackID, this is Jack 7											85
-	0,                             // iJack, no string.													86
-
-	// Jack 8
-	USB_MIDI_OUT_JACK_DESCRIPTOR_SIZE(1),  // bLength, size of a MIDI OUT Jack descriptor				87
-	USB_DTYPE_CS_INTERFACE,        // bDescriptorType, this is a class-specific interface descriptor	88
-	MIDI_CS_IF_OUT_JACK,           // bDescriptorSubType, a MIDI Out Jack descriptor					89
-	MIDI_JACKTYPE_Embedded,        // bJackType, embedded												90
-	JACK8_EMBOUT,                  // bJackID, this is Jack 8											91
-	1,                             // bNrInputPins, just one											92
-	JACK7_EXTIN,                   // baSourceID, input source is Jack 7 only							93
-	1,                             // baSourcePin, jack 3 is on input pin 1								94
-	0,                             // iJack, no string													95
+    USBShort(USBMIDI_MS_CS_TOTAL_SIZE),  // wTotalLength, size of this descriptor and all that follow	34
+
+	// The jacks, two for each cable each way. See usbmidi_descriptors.h.
+	USBMIDI_ALL_JACKS,
+
+	// In Endpoint 1 Standard descriptor
+	USBMIDI_BULK_EP_DESC_SIZE,    // bLength, endpoint descriptors are 7 bytes
+	USB_DTYPE_ENDPOINT,           // bDescriptorSubType, this is a standard endpoint descriptor
+	USB_EP_DESC_IN | USBMIDI_MS_EP_IN,  // bEndpointAddress is IN Endpoint 1
+	USB_EP_ATTR_BULK,             // bmAttributes, this is a bulk endpoint
+	USBShort(64),                 // wMaxPacketSize, 64 is max for full speed bulk endpoint
+	0,                            // bInterval, must be 0 for bulk endpoint
+
+	// Class-specific IN Endpoint descriptor
+	USB_MIDI_CS_STREAMING_BULK_ENDPOINT_SIZE(USBMIDI_NUM_CABLES_IN),  // bLength
+	USB_CS_ENDPOINT_DESCRIPTOR,       // bDescriptorType
+	USB_MIDI_CS_EP_MS_GENERAL,        // bDescriptorSubType
+	USBMIDI_NUM_CABLES_IN,            // bNumEmbMIDIJack, how many embedded jacks in this direction?
+	USBMIDI_EP_IN_JACKS,              // baAssocJackID, the embedded OUT jacks
+
+	// Out Endpoint 1 standard descriptor
+	USBMIDI_BULK_EP_DESC_SIZE,       // bLength
+	USB_DTYPE_ENDPOINT,              // bDescriptorType, it's an endpoint
+	USB_EP_DESC_OUT | USBMIDI_MS_EP_OUT,    // bEndpointAddress, OUT EP 1
+	USB_EP_ATTR_BULK,                // bmAttributes, bulk endpoint
+	USBShort(64),                    // wMaxPacketSize, 64 is max for full speed bulk endpoint
+	0,                              // bInterval, must be 0 for bulk endpoint
+
+	// Class-specific OUT endpoint descriptor
+	USB_MIDI_CS_STREAMING_BULK_ENDPOINT_SIZE(USBMIDI_NUM_CABLES_OUT),  // bLength
+	USB_CS_ENDPOINT_DESCRIPTOR,       // bDescriptorType
+	USB_MIDI_CS_EP_MS_GENERAL,        // bDescriptorSubType
+	USBMIDI_NUM_CABLES_OUT,           // bNumEmbMIDIJack, how many embedded jacks in this direction?
+	USBMIDI_EP_OUT_JACKS              // baAssocJackID, the embedded IN jacks
+};
+
+#if USBMIDI_UMP
+/*****
+ * Alternate setting 1 of the MIDI Streaming interface, for USB MIDI 2.0.
+ * The same two endpoints carry Universal MIDI Packets. There are no jacks; the
+ * endpoints list group terminal blocks instead.
+ */
+const uint8_t g_pui8MidiStreamInterfaceUMP[] =
+{
+	// Standard Interface descriptor
+	9,                         // bDescriptorSize
+	USB_DTYPE_INTERFACE,       // bDescriptorType
+	USBMIDI_MS_INTERFACE,      // bInterfaceNumber, MIDI streaming is #1
+	USBMIDI_ALT_UMP,           // bAlternateSetting, 1 is USB MIDI 2.0
+	2,                         // bNumEndpoints, we use two
+	USB_CLASS_AUDIO,           // bInteraceClass, Audio Class
+	USB_ASC_MIDI_STREAMING,    // bInterfaceSubClass
+	0,                         // bInterfaceProtocol, none
+	0,                         // iInterface, no string
+
+	// Class-specific header. Nothing follows it.
+	USB_MIDI_CS_MS_IF_DESC_SIZE,   // bLength
+	USB_DTYPE_CS_INTERFACE,        // bDescriptorType: Class-specific interface descriptor
+	MIDI_CS_IF_HEADER,             // bDescriptorSubType
+	USBShort(0x0200),              // bcdMSC, USB MIDI 2.0
+	USBShort(USB_MIDI_CS_MS_IF_DESC_SIZE),  // wTotalLength, just this header
 
 	// In Endpoint 1 Standard descriptor
-	7,                            // bLength, endpoint descriptors are 7 bytes							96
-	USB_DTYPE_ENDPOINT,           // bDescriptorSubType, this is a standard endpoint descriptor			97
-	USB_EP_DESC_IN | USBMIDI_MS_EP_IN,  // bEndpointAddress is IN Endpoint 1							98
-	USB_EP_ATTR_BULK,             // bmAttributes, this is a bulk endpoint								99
-	USBShort(64),                 // wMaxPacketSize, 64 is max for full speed bulk endpoint				100
-	0,                            // bInterval, must be 0 for bulk endpoint								102
+	USBMIDI_BULK_EP_DESC_SIZE,    // bLength
+	USB_DTYPE_ENDPOINT,           // bDescriptorSubType, this is a standard endpoint descriptor
+	USB_EP_DESC_IN | USBMIDI_MS_EP_IN,  // bEndpointAddress is IN Endpoint 1
+	USB_EP_ATTR_BULK,             // bmAttributes, this is a bulk endpoint
+	USBShort(64),                 // wMaxPacketSize, 64 is max for full speed bulk endpoint
+	0,                            // bInterval, must be 0 for bulk endpoint
 
 	// Class-specific IN Endpoint descriptor
-	USB_MIDI_CS_STREAMING_BULK_ENDPOINT_SIZE(2),  // bLength											103
-	USB_CS_ENDPOINT_DESCRIPTOR,       // bDescriptorType												104
-	USB_MIDI_CS_EP_MS_GENERAL,        // bDescriptorSubType												105
-	2,                                // bNumEmbMIDIJack, how many embedded jacks in this direction?	106
-	JACK4_EMBOUT,                     // baAssocJackID 1												107
-	JACK8_EMBOUT,                     // baAssocJackID 2												108
+	USB_MIDI_CS_EP_MS_GENERAL_2_0_SIZE(USBMIDI_UMP_NUM_IN_BLOCKS),  // bLength
+	USB_CS_ENDPOINT_DESCRIPTOR,       // bDescriptorType
+	USB_MIDI_CS_EP_MS_GENERAL_2_0,    // bDescriptorSubType
+	USBMIDI_UMP_NUM_IN_BLOCKS,        // bNumGrpTrmBlock
+	USBMIDI_UMP_IN_BLOCKS,            // baAssoGrpTrmBlkID
 
 	// Out Endpoint 1 standard descriptor
-	7,                               // bLength															109
-	USB_DTYPE_ENDPOINT,              // bDescriptorType, it's an endpoint								110
-	USB_EP_DESC_OUT | USBMIDI_MS_EP_OUT,    // bEndpointAddress, OUT EP 1								111
-	USB_EP_ATTR_BULK,                // bmAttributes, bulk endpoint										112
-	USBShort(64),                    // wMaxPacketSize, 64 is max for full speed bulk endpoint			113
-	0,                              // bInterval, must be 0 for bulk endpoint							115
+	USBMIDI_BULK_EP_DESC_SIZE,       // bLength
+	USB_DTYPE_ENDPOINT,              // bDescriptorType, it's an endpoint
+	USB_EP_DESC_OUT | USBMIDI_MS_EP_OUT,    // bEndpointAddress, OUT EP 1
+	USB_EP_ATTR_BULK,                // bmAttributes, bulk endpoint
+	USBShort(64),                    // wMaxPacketSize, 64 is max for full speed bulk endpoint
+	0,                               // bInterval, must be 0 for bulk endpoint
 
 	// Class-specific OUT endpoint descriptor
-	USB_MIDI_CS_STREAMING_BULK_ENDPOINT_SIZE(2),  // bLength											116
-	USB_CS_ENDPOINT_DESCRIPTOR,       // bDescriptorType												117
-	USB_MIDI_CS_EP_MS_GENERAL,        // bDescriptorSubType												118
-	2,                                // bNumEmbMIDIJack, how many embedded jacks in this direction?	119
-	JACK1_EMBIN,                     // baAssocJackID 1													120
-	JACK5_EMBIN                      // baAssocJackID 2													121
+	USB_MIDI_CS_EP_MS_GENERAL_2_0_SIZE(USBMIDI_UMP_NUM_OUT_BLOCKS),  // bLength
+	USB_CS_ENDPOINT_DESCRIPTOR,       // bDescriptorType
+	USB_MIDI_CS_EP_MS_GENERAL_2_0,    // bDescriptorSubType
+	USBMIDI_UMP_NUM_OUT_BLOCKS,       // bNumGrpTrmBlock
+	USBMIDI_UMP_OUT_BLOCKS            // baAssoGrpTrmBlkID
+};
+
+/**
+ * The group terminal blocks, which HandleGetDescriptor() sends when asked.
+ */
+const uint8_t g_pui8MidiGroupTerminalBlocks[] =
+{
+	USB_MIDI_GR_TRM_BLOCK_HEADER_SIZE,  // bLength
+	USB_MIDI_DTYPE_CS_GR_TRM_BLOCK,     // bDescriptorType
+	MIDI_CS_GR_TRM_BLOCK_HEADER,        // bDescriptorSubtype
+	USBShort(USBMIDI_GTB_TOTAL_SIZE),   // wTotalLength, the header and the blocks
+
+	USBMIDI_GR_TRM_BLOCK(1, MIDI_GR_TRM_BLOCK_BIDIRECTIONAL, 0, USBMIDI_UMP_GROUPS_BOTH),
+#if USBMIDI_NUM_CABLES_OUT > USBMIDI_NUM_CABLES_IN
+	USBMIDI_GR_TRM_BLOCK(2, MIDI_GR_TRM_BLOCK_OUT, USBMIDI_UMP_GROUPS_BOTH,
+			USBMIDI_NUM_CABLES_OUT - USBMIDI_NUM_CABLES_IN),
+#elif USBMIDI_NUM_CABLES_OUT < USBMIDI_NUM_CABLES_IN
+	USBMIDI_GR_TRM_BLOCK(2, MIDI_GR_TRM_BLOCK_IN, USBMIDI_UMP_GROUPS_BOTH,
+			USBMIDI_NUM_CABLES_IN - USBMIDI_NUM_CABLES_OUT),
+#endif
+};
+
+USBMIDI_STATIC_ASSERT(sizeof(g_pui8MidiStreamInterfaceUMP) == USBMIDI_MS_UMP_IF_SIZE, usbmidi_ms_ump_if_size);
+USBMIDI_STATIC_ASSERT(sizeof(g_pui8MidiGroupTerminalBlocks) == USBMIDI_GTB_TOTAL_SIZE, usbmidi_gtb_size);
+#endif
+
+#if USBMIDI_CDC
+/*****
+ * The CDC-ACM console: its IAD, then the communications interface and the data
+ * interface. See usbcdc_console.h.
+ */
+const uint8_t g_pui8CDCInterfaces[] =
+{
+	// Interface association descriptor
+	USBMIDI_IAD_SIZE,           // bLength
+	USB_DTYPE_INTERFACE_ASC,    // bDescriptorType, this is an IAD
+	USBMIDI_CDC_COMM_INTERFACE, // bFirstInterface
+	2,                          // bInterfaceCount, communications and data
+	USB_CLASS_CDC,              // bFunctionClass
+	USB_CDC_SUBCLASS_ACM,       // bFunctionSubClass
+	USB_CDC_PROTOCOL_V25TER,    // bFunctionProtocol
+	0,                          // iFunction, no string
+
+	// Communications interface
+	9,                          // bLength
+	USB_DTYPE_INTERFACE,        // bDescriptorType
+	USBMIDI_CDC_COMM_INTERFACE, // bInterfaceNumber
+	0,                          // bAlternateSetting
+	1,                          // bNumEndpoints, the notification endpoint
+	USB_CLASS_CDC,              // bInterfaceClass
+	USB_CDC_SUBCLASS_ACM,       // bInterfaceSubClass
+	USB_CDC_PROTOCOL_V25TER,    // bInterfaceProtocol
+	0,                          // iInterface, no string
+
+	// Header functional descriptor
+	5,                          // bFunctionLength
+	USB_DTYPE_CS_INTERFACE,     // bDescriptorType
+	USB_CDC_CS_HEADER,          // bDescriptorSubtype
+	USBShort(0x0110),           // bcdCDC, 1.1
+
+	// Call management functional descriptor
+	5,                          // bFunctionLength
+	USB_DTYPE_CS_INTERFACE,     // bDescriptorType
+	USB_CDC_CS_CALL_MGMT,       // bDescriptorSubtype
+	0,                          // bmCapabilities, no call management
+	USBMIDI_CDC_DATA_INTERFACE, // bDataInterface
+
+	// ACM functional descriptor
+	4,                          // bFunctionLength
+	USB_DTYPE_CS_INTERFACE,     // bDescriptorType
+	USB_CDC_CS_ACM,             // bDescriptorSubtype
+	0x02,                       // bmCapabilities, line coding and control line state
+
+	// Union functional descriptor
+	5,                          // bFunctionLength
+	USB_DTYPE_CS_INTERFACE,     // bDescriptorType
+	USB_CDC_CS_UNION,           // bDescriptorSubtype
+	USBMIDI_CDC_COMM_INTERFACE, // bControlInterface
+	USBMIDI_CDC_DATA_INTERFACE, // bSubordinateInterface0
+
+	// Notification endpoint, interrupt IN 3
+	USBMIDI_INT_EP_DESC_SIZE,        // bLength
+	USB_DTYPE_ENDPOINT,              // bDescriptorType
+	USB_EP_DESC_IN | USBMIDI_CDC_EP_NOTIFY,  // bEndpointAddress, IN EP 3
+	USB_EP_ATTR_INT,                 // bmAttributes, interrupt endpoint
+	USBShort(16),                    // wMaxPacketSize
+	16,                              // bInterval, 16 ms
+
+	// Data interface
+	9,                          // bLength
+	USB_DTYPE_INTERFACE,        // bDescriptorType
+	USBMIDI_CDC_DATA_INTERFACE, // bInterfaceNumber
+	0,                          // bAlternateSetting
+	2,                          // bNumEndpoints, one each way
+	USB_CLASS_CDC_DATA,         // bInterfaceClass
+	0,                          // bInterfaceSubClass
+	0,                          // bInterfaceProtocol
+	0,                          // iInterface, no string
+
+	// Data IN endpoint 4
+	USBMIDI_BULK_EP_DESC_SIZE,       // bLength
+	USB_DTYPE_ENDPOINT,              // bDescriptorType
+	USB_EP_DESC_IN | USBMIDI_CDC_EP_DATA,   // bEndpointAddress, IN EP 4
+	USB_EP_ATTR_BULK,                // bmAttributes, bulk endpoint
+	USBShort(64),                    // wMaxPacketSize
+	0,                               // bInterval, must be 0 for bulk endpoint
+
+	// Data OUT endpoint 4
+	USBMIDI_BULK_EP_DESC_SIZE,       // bLength
+	USB_DTYPE_ENDPOINT,              // bDescriptorType
+	USB_EP_DESC_OUT | USBMIDI_CDC_EP_DATA,  // bEndpointAddress, OUT EP 4
+	USB_EP_ATTR_BULK,                // bmAttributes, bulk endpoint
+	USBShort(64),                    // wMaxPacketSize
+	0                                // bInterval, must be 0 for bulk endpoint
+};
+
+USBMIDI_STATIC_ASSERT(sizeof(g_pui8CDCInterfaces) == USBMIDI_CDC_IF_SIZE, usbmidi_cdc_if_size);
+USBMIDI_STATIC_ASSERT(sizeof(g_pui8IADMidiDescriptor) == USBMIDI_IAD_SIZE, usbmidi_iad_size);
+#endif
+
+#if USBMIDI_VENDOR
+/*****
+ * The vendor-specific interface, for raw byte streams to a DIN port. It has no
+ * class, so the host's MIDI driver leaves it alone, and the host's tool talks to
+ * it directly.
+ */
+const uint8_t g_pui8VendorInterface[] =
+{
+	// Standard Interface descriptor
+	9,                         // bDescriptorSize
+	USB_DTYPE_INTERFACE,       // bDescriptorType
+	USBMIDI_VENDOR_INTERFACE,  // bInterfaceNumber, the vendor interface is #2
+	0,                         // bAlternateSetting
+	1,                         // bNumEndpoints, just the one
+	USB_CLASS_VEND_SPECIFIC,   // bInterfaceClass, vendor-specific
+	0,                         // bInterfaceSubClass
+	0,                         // bInterfaceProtocol
+	0,                         // iInterface, no string
+
+	// Out Endpoint 2 standard descriptor
+	USBMIDI_BULK_EP_DESC_SIZE,       // bLength
+	USB_DTYPE_ENDPOINT,              // bDescriptorType, it's an endpoint
+	USB_EP_DESC_OUT | USBMIDI_VENDOR_EP_OUT,  // bEndpointAddress, OUT EP 2
+	USB_EP_ATTR_BULK,                // bmAttributes, bulk endpoint
+	USBShort(64),                    // wMaxPacketSize, 64 is max for full speed bulk endpoint
+	0                                // bInterval, must be 0 for bulk endpoint
 };
 
+USBMIDI_STATIC_ASSERT(sizeof(g_pui8VendorInterface) == USBMIDI_VENDOR_IF_SIZE, usbmidi_vendor_if_size);
+#endif
+
+/**
+ * The lengths in the descriptors are worked out from the number of cables.
+ * Make sure they match what was actually built.
+ */
+USBMIDI_STATIC_ASSERT(sizeof(g_pui8MidiDescriptor) == 9, usbmidi_config_desc_size);
+USBMIDI_STATIC_ASSERT(sizeof(g_pui8AudioMidiControlInterface) == USBMIDI_AC_IF_SIZE, usbmidi_ac_if_size);
+USBMIDI_STATIC_ASSERT(sizeof(g_pui8MidiStreamInterface) == USBMIDI_MS_IF_SIZE, usbmidi_ms_if_size);
+USBMIDI_STATIC_ASSERT(USBMIDI_CONFIG_TOTAL_SIZE == (sizeof(g_pui8MidiDescriptor) +
+		sizeof(g_pui8AudioMidiControlInterface) + sizeof(g_pui8MidiStreamInterface) +
+		USBMIDI_MS_UMP_IF_SIZE + USBMIDI_VENDOR_IF_SIZE + USBMIDI_MIDI_IAD_SIZE + USBMIDI_CDC_IF_SIZE),
+		usbmidi_config_total_size);
+
 /**
  * The MIDI device configuration descriptor is defined as three sections.
  * One contains the 9 byte USB configuration descriptor.
@@ -362,6 +525,39 @@ const tConfigSection g_sMidiStreamInterfaceSection =
 	.pui8Data = g_pui8MidiStreamInterface
 };
 
+#if USBMIDI_UMP
+/**
+ * Alternate setting 1 of the MIDI Streaming interface follows alternate setting 0.
+ */
+const tConfigSection g_sMidiStreamInterfaceUMPSection =
+{
+	.ui16Size = sizeof(g_pui8MidiStreamInterfaceUMP),
+	.pui8Data = g_pui8MidiStreamInterfaceUMP
+};
+#endif
+
+#if USBMIDI_VENDOR
+/**
+ * The vendor interface comes last.
+ */
+const tConfigSection g_sVendorInterfaceSection =
+{
+	.ui16Size = sizeof(g_pui8VendorInterface),
+	.pui8Data = g_pui8VendorInterface
+};
+#endif
+
+#if USBMIDI_CDC
+/**
+ * The CDC console comes after that.
+ */
+const tConfigSection g_sCDCInterfacesSection =
+{
+	.ui16Size = sizeof(g_pui8CDCInterfaces),
+	.pui8Data = g_pui8CDCInterfaces
+};
+#endif
+
 /**
  * the third holds the audio control interface.
  */
@@ -378,9 +574,20 @@ const tConfigSection g_sAudioMidiControlInterfaceSection =
 const tConfigSection *g_psMidiSections[] =
 {
 	&g_sMidiConfigSection,
-//	&g_sIADMidiConfigSection,
+#if USBMIDI_CDC
+	&g_sIADMidiConfigSection,
+#endif
 	&g_sAudioMidiControlInterfaceSection,
-	&g_sMidiStreamInterfaceSection
+	&g_sMidiStreamInterfaceSection,
+#if USBMIDI_UMP
+	&g_sMidiStreamInterfaceUMPSection,
+#endif
+#if USBMIDI_VENDOR
+	&g_sVendorInterfaceSection,
+#endif
+#if USBMIDI_CDC
+	&g_sCDCInterfacesSection,
+#endif
 };
 
 #define NUM_MIDI_SECTIONS (sizeof(g_psMidiSections) / sizeof(g_psMidiSections[0]))
@@ -481,11 +688,11 @@ const uint8_t *const stringDescriptors[] =
  */
 static const tCustomHandlers MidiHandlers =
 {
-	.pfnGetDescriptor     = 0,						// We only deal with standard descriptors
-	.pfnRequestHandler    = HandleRequests,			// There are no EP0 requests in this class
-	.pfnInterfaceChange   = 0,						// We have no alternate interfaces
+	.pfnGetDescriptor     = HandleGetDescriptor,	// Group terminal blocks, for USB MIDI 2.0
+	.pfnRequestHandler    = HandleRequests,			// None in this class, USBMIDI_VENDOR has one
+	.pfnInterfaceChange   = HandleInterfaceChange,	// MS interface alternate setting, MIDI 1.0 or 2.0
 	.pfnConfigChange      = HandleConfigChange,		// Check for the selected configuration, indicate connected
-	.pfnDataReceived      = 0, 						// We do not handle data for EP0
+	.pfnDataReceived      = HandleEP0Data, 			// SET_LINE_CODING's data, with USBMIDI_CDC
 	.pfnDataSent          = 0,						// We do not handle data for EP0
 	.pfnResetHandler      = 0,						// We do not need to handle bus reset (now)
 	.pfnSuspendHandler    = HandleSuspend,			// Handle USB suspension
@@ -523,14 +730,124 @@ static tUSBMidiDevice g_sUsbMidiDevice;
  */
 void USBMIDI_Init(uint32_t index)
 {
+	uint32_t cable;
+
 	USBMIDIFIFO_Init(&g_sUsbMidiDevice.InEpMsgFifo);
-	USBMIDIFIFO_Init(&g_sUsbMidiDevice.OutEpMsgFifo);
+	for( cable = 0; cable < USBMIDI_NUM_CABLES_OUT; cable++ )
+		USBMIDIFIFO_Init(&g_sUsbMidiDevice.OutCableFifo[cable]);
+#if USBMIDI_CDC
+	USBCDC_Init();
+#endif
 
 	USBDCDInit(index, 				// index of USB hardware (not base address)
 			&USBMIDIDeviceInfo, 	// tDeviceInfo
 			&g_sUsbMidiDevice);		// "callback data for any device callbacks."
+
+#if USBMIDI_DMA
+	{
+		tUSBMidiInstance *psInst = &g_sUsbMidiDevice.sPrivateData;
+
+		// USBDCDInit() has already set up the DMA, so this just gets it.
+		psInst->psDMAInstance = USBLibDMAInit(index);
+
+		psInst->ui32INDMA = USBLibDMAChannelAllocate(psInst->psDMAInstance, USB_EP_1,
+				USBMIDI_DMA_MODE0_SIZE, USB_DMA_EP_DEVICE | USB_DMA_EP_TYPE_BULK | USB_DMA_EP_TX);
+		USBLibDMAUnitSizeSet(psInst->psDMAInstance, psInst->ui32INDMA, 32);
+		USBLibDMAArbSizeSet(psInst->psDMAInstance, psInst->ui32INDMA, 16);
+
+		psInst->ui32INDMACount = 0;
+	}
+#endif
 }
 
+#if USBMIDI_REMOTE_WAKEUP
+/**
+ * How long we drive resume signalling, in SysTick milliseconds. USB 2.0 says 1 to
+ * 15 ms. The pulse starts part way through a tick, so it is 9 to 10 ms.
+ */
+#define USBMIDI_WAKE_PULSE_MS 10
+
+/**
+ * While the bus is suspended, the first message in USBMIDI_WAKE_CINS asks the host
+ * to wake up, if the host has enabled remote wakeup with SET_FEATURE. If it
+ * hasn't, the next such message looks again. Call with interrupts masked.
+ *
+ * We drive the resume signalling ourselves rather than with
+ * USBDCDRemoteWakeupRequest(), which times the pulse in SOFs, and there are none
+ * while the bus is suspended. USBMIDI_WakeTick() ends it, and
+ * USBMIDI_IntHandler() sees the resume when the SOFs start again.
+ */
+static void USBMIDI_WakeCheck(const USBMIDI_Message_t *msgs, uint32_t count)
+{
+	tUSBMidiInstance *psInst;
+	uint8_t cin;
+	uint32_t i;
+
+	psInst = &g_sUsbMidiDevice.sPrivateData;
+
+	if( !psInst->bSuspended || psInst->bWakeRequested )
+		return;
+
+	for( i = 0; i < count; i++ )
+	{
+		cin = msgs[i].header & 0x0F;
+		if( !((USBMIDI_WAKE_CINS) & (1 << cin)) )
+			continue;
+		if( (USB_MIDI_CIN_NOTEON == cin) && (0 == msgs[i].byte3) )
+			continue;
+
+		// the USB library keeps the host's SET_FEATURE in its device status.
+		if( g_psDCDInst[0].ui8Status & USB_STATUS_REMOTE_WAKE )
+		{
+			psInst->bWakeRequested = true;
+			psInst->bWakeReport = false;
+			psInst->ui32WakeTick = g_ui32SysTickCount;
+			psInst->bWakePulse = true;
+			MAP_USBHostResume(USB0_BASE, true);
+		}
+		return;
+	}
+}
+
+/**
+ * End our resume signalling once it has gone on for USBMIDI_WAKE_PULSE_MS. Call
+ * from the SysTick ISR, after the count goes up.
+ */
+void USBMIDI_WakeTick(void)
+{
+	tUSBMidiInstance *psInst;
+
+	psInst = &g_sUsbMidiDevice.sPrivateData;
+
+	if( psInst->bWakePulse &&
+		((g_ui32SysTickCount - psInst->ui32WakeTick) >= USBMIDI_WAKE_PULSE_MS) )
+	{
+		MAP_USBHostResume(USB0_BASE, false);
+		psInst->bWakePulse = false;
+	}
+}
+
+/**
+ * If we woke the host, how long it took, in milliseconds: from the request to the
+ * resume, and from the request to the host taking the first packet after it.
+ * \returns false if there is nothing new to report.
+ */
+bool USBMIDI_WakeReport(uint32_t *resumeMs, uint32_t *firstEventMs)
+{
+	tUSBMidiInstance *psInst;
+
+	psInst = &g_sUsbMidiDevice.sPrivateData;
+
+	if( !psInst->bWakeReport )
+		return false;
+
+	*resumeMs = psInst->ui32ResumeTick - psInst->ui32WakeTick;
+	*firstEventMs = psInst->ui32FirstEventTick - psInst->ui32WakeTick;
+	psInst->bWakeReport = false;
+	return true;
+}
+#endif
+
 /**
  * Return true if the USB device is connected to the bus.
  */
@@ -539,78 +856,403 @@ bool USBMIDI_IsConnected(void)
 	return g_sUsbMidiDevice.sPrivateData.bConnected;
 }
 
+#if USBMIDI_VENDOR
+/**
+ * If the endpoint ISR held a vendor OUT packet because the DIN port's transmit
+ * FIFO was full, the host is being NAKed. The UART drains that FIFO on its own, so
+ * this is called from the main loop to see if there is room yet, and to carry on
+ * with the held packet if there is.
+ */
+void USBMIDI_RawResume(void)
+{
+	bool bIntStatus;
+
+	if( g_sUsbMidiDevice.sPrivateData.bRawHeld )
+	{
+		bIntStatus = MAP_IntMasterDisable();
+		if( g_sUsbMidiDevice.sPrivateData.bRawHeld )
+			HandleRawPackets(&g_sUsbMidiDevice);
+		if( !bIntStatus )
+			MAP_IntMasterEnable();
+	}
+}
+#endif
+
+/**
+ * If the endpoint ISR held an OUT packet because a cable's queue was too full, the
+ * host is being NAKed. Once the queue has room, carry on with the held packet, and
+ * ack it if the rest fits, which lets the host go on.
+ */
+static void USBMIDI_OutResume(void)
+{
+	bool bIntStatus;
+
+	if( g_sUsbMidiDevice.sPrivateData.iUSBMidiRxState == eUsbMidiStateWaitData )
+	{
+		// the USB ISR also reads the endpoint, so keep it out.
+		bIntStatus = MAP_IntMasterDisable();
+		if( g_sUsbMidiDevice.sPrivateData.iUSBMidiRxState == eUsbMidiStateWaitData )
+		{
+			HandleOutPackets(&g_sUsbMidiDevice);
+		}
+		if( !bIntStatus )
+			MAP_IntMasterEnable();
+	}
+}
+
 /**
  * Functions to access the message FIFOs.
  *
- * Pop the OUT Endpoint FIFO, which returns messages sent to us from the host.
- * Returns true if msg holds a valid new message. Returns false if no message was available.
+ * Pop a cable's OUT queue, which returns messages sent to us from the host on that
+ * cable. Returns true if msg holds a valid new message. Returns false if no message
+ * was available, or there is no such cable.
+ */
+bool USBMIDI_OutCableFIFO_Pop(uint8_t cable, USBMIDI_Message_t *msg)
+{
+	if( cable >= USBMIDI_NUM_CABLES_OUT )
+		return false;
+
+	if( !USBMIDIFIFO_Pop(&g_sUsbMidiDevice.OutCableFifo[cable], msg) )
+		return false;
+
+	USBMIDI_OutResume();
+	return true;
+}
+
+/**
+ * The oldest messages in a cable's OUT queue, in place, as many as sit in one
+ * piece. Use them, then commit those used, with USBMIDI_OutCableReadCommit().
  */
-bool USBMIDI_OutEpFIFO_Pop(USBMIDI_Message_t *msg)
+uint32_t USBMIDI_OutCableReadSpan(uint8_t cable, const USBMIDI_Message_t **span)
 {
-	return USBMIDIFIFO_Pop(&g_sUsbMidiDevice.OutEpMsgFifo, msg);
+	const uint8_t *bytes;
+	uint32_t count;
+
+	if( cable >= USBMIDI_NUM_CABLES_OUT )
+		return 0;
+
+	count = USBMIDIFIFO_ReadSpan(&g_sUsbMidiDevice.OutCableFifo[cable], &bytes);
+	*span = (const USBMIDI_Message_t *) bytes;
+	return count;
+}
+
+void USBMIDI_OutCableReadCommit(uint8_t cable, uint32_t count)
+{
+	if( (cable >= USBMIDI_NUM_CABLES_OUT) || (0 == count) )
+		return;
+
+	USBMIDIFIFO_ReadCommit(&g_sUsbMidiDevice.OutCableFifo[cable], count);
+	USBMIDI_OutResume();
 }
 
 /**
  * Write a new outgoing message back to the host over the IN endpoint, if the USB
  * device is actually connected. Otherwise, just drop the message on the floor.
  *
- * This writes the message to the outgoing (IN endpoint) FIFO.
+ * This writes the message to the outgoing (IN endpoint) FIFO. If the FIFO is full,
+ * the message is dropped.
  *
- * After pushing the byte to the FIFO, check to see if the endpoint is busy sending
- * a previous USB packet. If it is not, then "prime the pump."
+ * The first message waiting in the FIFO starts the flush deadline, which is
+ * USBMIDI_IN_FLUSH_FRAMES start-of-frames from now. Then USBMIDI_InEpSendMessages()
+ * sends a packet if the endpoint is idle and there is a full packet or the deadline
+ * has passed. Otherwise the message waits for more to join it, and is sent by the
+ * SOF or endpoint interrupt.
  *
+ * On USBMIDI_ALT_UMP the message is translated to UMP words first, and those are
+ * pushed instead, all of them or none.
+ *
+ * The USB ISR also sends packets, so interrupts are masked while we do this.
  */
 void USBMIDI_InEpMsgWrite(USBMIDI_Message_t *msg)
 {
-	if( g_sUsbMidiDevice.sPrivateData.bConnected )
+	tUSBMidiInstance *psInst;
+	bool bIntStatus;
+	bool pushed;
+#if USBMIDI_UMP
+	uint32_t words[UMP_WORDS_PER_EVENT_MAX];
+	uint32_t nwords;
+#endif
+
+	psInst = &g_sUsbMidiDevice.sPrivateData;
+
+	if( psInst->bConnected )
 	{
-		USBMIDIFIFO_Push(&g_sUsbMidiDevice.InEpMsgFifo, msg);
-		if( g_sUsbMidiDevice.sPrivateData.iUSBMidiTxState == eUsbMidiStateIdle )
+		bIntStatus = MAP_IntMasterDisable();
+
+#if USBMIDI_REMOTE_WAKEUP
+		USBMIDI_WakeCheck(msg, 1);
+#endif
+
+#if USBMIDI_UMP
+		if( USBMIDI_ALT_UMP == psInst->ui8AltSetting )
+		{
+			nwords = USBMIDI_UMPFromEvent(&psInst->sUMP, msg, words);
+			pushed = (nwords > 0) && (nwords <= USBMIDIFIFO_Space(&g_sUsbMidiDevice.InEpMsgFifo));
+			if( pushed )
+				USBMIDIFIFO_PushBatch(&g_sUsbMidiDevice.InEpMsgFifo, (const uint8_t *) words, nwords);
+		}
+		else
+#endif
+		pushed = USBMIDIFIFO_Push(&g_sUsbMidiDevice.InEpMsgFifo, msg);
+
+		if( pushed )
 		{
-			USBMIDI_InEpSendMessages();
+			if( !psInst->bInFlushArmed )
+			{
+				psInst->bInFlushArmed = true;
+				psInst->ui32InFlushFrame = g_ui32USBSOFCount + USBMIDI_IN_FLUSH_FRAMES;
+			}
 		}
+
+		USBMIDI_InEpSendMessages();
+
+		if( !bIntStatus )
+			MAP_IntMasterEnable();
 	}
 }
 
 /**
- * Check to see if transmit (IN endpoint) message FIFO has things to send.
- * If it does, repeatedly pop the FIFO and write the message bytes into
- * a buffer which then gets loaded into the endpoint buffer and transmitted.
+ * How many messages USBMIDI_InEpMsgWriteBatch() is sure to take right now. On
+ * USBMIDI_ALT_UMP, a message may take up to UMP_WORDS_PER_EVENT_MAX words of the
+ * FIFO, so this counts each one as that many.
+ */
+uint32_t USBMIDI_InEpSpace(void)
+{
+	uint32_t space;
+
+	space = USBMIDIFIFO_Space(&g_sUsbMidiDevice.InEpMsgFifo);
+#if USBMIDI_UMP
+	if( USBMIDI_ALT_UMP == g_sUsbMidiDevice.sPrivateData.ui8AltSetting )
+		space /= UMP_WORDS_PER_EVENT_MAX;
+#endif
+	return space;
+}
+
+/**
+ * Write a run of messages for the host, as USBMIDI_InEpMsgWrite() does for one,
+ * with interrupts masked once and one look at the endpoint for the lot. On
+ * USBMIDI_ALT_MIDI1 they are copied onto the FIFO in one go. On USBMIDI_ALT_UMP
+ * each is translated, and we stop at the first that might not fit.
+ *
+ * The first of them starts the flush deadline, if none is running, so the run
+ * goes to the host within USBMIDI_IN_FLUSH_FRAMES frames even if it doesn't fill
+ * a packet.
+ *
+ * While the bus is suspended they wait in the FIFO, and with USBMIDI_REMOTE_WAKEUP
+ * the first that matters wakes the host.
  *
- * This is called either by USBMIDI_InEpMsgWrite() after a new message is pushed
- * onto the IN endpoint transmit FIFO, or by the EndpointHandler callback after
- * a previous USB packet has finished transmitting.
+ * If the USB device isn't connected, they are all dropped on the floor.
+ * \returns how many were taken. Ask USBMIDI_InEpSpace() first to be sure of all.
+ */
+uint32_t USBMIDI_InEpMsgWriteBatch(const USBMIDI_Message_t *msgs, uint32_t count)
+{
+	tUSBMidiInstance *psInst;
+	bool bIntStatus;
+	uint32_t pushed;
+#if USBMIDI_UMP
+	uint32_t words[UMP_WORDS_PER_EVENT_MAX];
+	uint32_t nwords;
+#endif
+
+	psInst = &g_sUsbMidiDevice.sPrivateData;
+
+	if( !psInst->bConnected )
+		return count;
+
+	bIntStatus = MAP_IntMasterDisable();
+
+#if USBMIDI_REMOTE_WAKEUP
+	USBMIDI_WakeCheck(msgs, count);
+#endif
+
+#if USBMIDI_UMP
+	if( USBMIDI_ALT_UMP == psInst->ui8AltSetting )
+	{
+		for( pushed = 0; pushed < count; pushed++ )
+		{
+			if( USBMIDIFIFO_Space(&g_sUsbMidiDevice.InEpMsgFifo) < UMP_WORDS_PER_EVENT_MAX )
+				break;
+
+			// SysEx bytes may be held back until a UMP's worth have come.
+			nwords = USBMIDI_UMPFromEvent(&psInst->sUMP, &msgs[pushed], words);
+			if( nwords )
+				USBMIDIFIFO_PushBatch(&g_sUsbMidiDevice.InEpMsgFifo, (const uint8_t *) words, nwords);
+		}
+	}
+	else
+#endif
+	pushed = USBMIDIFIFO_PushBatch(&g_sUsbMidiDevice.InEpMsgFifo, (const uint8_t *) msgs, count);
+
+	if( pushed && !psInst->bInFlushArmed &&
+		USBMIDIFIFO_Count(&g_sUsbMidiDevice.InEpMsgFifo) )
+	{
+		psInst->bInFlushArmed = true;
+		psInst->ui32InFlushFrame = g_ui32USBSOFCount + USBMIDI_IN_FLUSH_FRAMES;
+	}
+
+	USBMIDI_InEpSendMessages();
+
+	if( !bIntStatus )
+		MAP_IntMasterEnable();
+
+	return pushed;
+}
+
+/**
+ * Pop up to one packet's worth of messages from the IN endpoint FIFO, load them
+ * into the endpoint and send them. The endpoint must be idle.
  *
  * USB Packet size is 64 bytes and there are 4 bytes per message, so we can
- * put a maximum of 16 messages in one packet. I will eventually change from
- * the magic number 16 to a constant.
+ * put a maximum of USBMIDI_EVENTS_PER_PACKET (16) messages in one packet. Any
+ * left in the FIFO get a new flush deadline, counted from now.
+ *
+ * The messages are in the FIFO as they go on the wire, so they are written to the
+ * endpoint straight from the FIFO's storage, in two pieces if they wrap.
+ *
+ * With USBMIDI_DMA, the DMA loads the endpoint from the FIFO's storage instead.
+ * It takes one piece, so a packet stops short at the wrap. The messages stay in the
+ * FIFO until the DMA is done, and HandleEndpoints() then pops them and sends the
+ * packet.
+ *
+ * On USBMIDI_ALT_UMP the FIFO holds UMP words, and a UMP isn't split between
+ * packets, so a packet may be a word or three short of full. The CPU loads those.
+ */
+static void USBMIDI_InEpSendPacket(void)
+{
+	tUSBMidiInstance *psInst;
+	USBMIDIFIFO_t *fifo;
+	const uint8_t *span;
+	uint32_t spanCnt;
+	uint32_t remaining;
+	uint32_t msgCnt = 0;
+	uint32_t msgMax = USBMIDI_EVENTS_PER_PACKET;
+
+	psInst = &g_sUsbMidiDevice.sPrivateData;
+	fifo = &g_sUsbMidiDevice.InEpMsgFifo;
+
+#if USBMIDI_DMA
+	if( USBMIDI_EP_RAW(psInst) )
+	{
+		spanCnt = USBMIDIFIFO_ReadSpan(fifo, &span);
+		if( spanCnt > USBMIDI_EVENTS_PER_PACKET )
+			spanCnt = USBMIDI_EVENTS_PER_PACKET;
+
+		if( spanCnt )
+		{
+			psInst->iUSBMidiTxState = eUsbMidiStateWaitData;
+			psInst->ui32INDMACount = spanCnt;
+			USBLibDMATransfer(psInst->psDMAInstance, psInst->ui32INDMA, (void *) span, spanCnt * 4);
+		}
+
+		// the messages being moved stay in the FIFO until the DMA is done.
+		remaining = USBMIDIFIFO_Count(fifo) - spanCnt;
+	}
+	else
+#endif
+	{
+#if USBMIDI_UMP
+		if( USBMIDI_ALT_UMP == psInst->ui8AltSetting )
+		{
+			// as many whole UMPs as fit.
+			uint32_t count = USBMIDIFIFO_Count(fifo);
+			uint32_t words;
+
+			msgMax = 0;
+			while( msgMax < count )
+			{
+				words = UMP_Words(USBMIDIFIFO_PeekWord(fifo, msgMax));
+				if( (msgMax + words) > USBMIDI_EVENTS_PER_PACKET )
+					break;
+				msgMax += words;
+			}
+		}
+#endif
+
+		while( msgCnt < msgMax )
+		{
+			spanCnt = USBMIDIFIFO_ReadSpan(fifo, &span);
+			if( 0 == spanCnt )
+				break;
+			if( spanCnt > (msgMax - msgCnt) )
+				spanCnt = msgMax - msgCnt;
+
+			MAP_USBEndpointDataPut(USB0_BASE, USB_EP_1, (uint8_t *) span, spanCnt * 4);
+			USBMIDIFIFO_ReadCommit(fifo, spanCnt);
+			msgCnt += spanCnt;
+		}
+
+		// Send it! The endpoint stays busy until the host takes the packet and the
+		// IN endpoint interrupt says so.
+		if( msgCnt )
+		{
+			psInst->iUSBMidiTxState = eUsbMidiStateWaitData;
+			MAP_USBEndpointDataSend(USB0_BASE, USB_EP_1, USB_TRANS_IN);
+		}
+
+		remaining = USBMIDIFIFO_Count(fifo);
+	}
+
+	if( remaining )
+	{
+		psInst->bInFlushArmed = true;
+		psInst->ui32InFlushFrame = g_ui32USBSOFCount + USBMIDI_IN_FLUSH_FRAMES;
+	}
+	else
+	{
+		psInst->bInFlushArmed = false;
+	}
+}
+
+/**
+ * Send a packet to the host if the IN endpoint is idle and either a full packet of
+ * messages is waiting or the oldest waiting message has reached its flush deadline.
+ *
+ * This is called by USBMIDI_InEpMsgWrite() after a new message is pushed onto the
+ * IN endpoint transmit FIFO, by the EndpointHandler callback after a previous USB
+ * packet has finished transmitting, and by USBMIDI_IntHandler() on every USB
+ * interrupt, which includes the start-of-frame interrupt every millisecond.
+ *
+ * So under load, packets go out full, as fast as the host takes them. A lone
+ * message goes out at the first SOF after its deadline. Call with interrupts
+ * masked, or from the USB ISR.
  */
 void USBMIDI_InEpSendMessages(void)
 {
-	uint8_t buf[64];
-	uint8_t *pbuf;
-	uint8_t msgByteCnt = 0;
-	USBMIDI_Message_t msg;
+	tUSBMidiInstance *psInst;
+
+	psInst = &g_sUsbMidiDevice.sPrivateData;
 
-	pbuf = buf;
+	if( psInst->iUSBMidiTxState != eUsbMidiStateIdle )
+		return;
 
-	// As long as we have messages to send, pop them
-	while( USBMIDIFIFO_Pop(&g_sUsbMidiDevice.InEpMsgFifo, &msg) && (msgByteCnt < 64) )
+	if( (USBMIDIFIFO_Count(&g_sUsbMidiDevice.InEpMsgFifo) >= USBMIDI_EVENTS_PER_PACKET) ||
+		(psInst->bInFlushArmed &&
+		 ((int32_t) (g_ui32USBSOFCount - psInst->ui32InFlushFrame) >= 0)) )
 	{
-		msgByteCnt += 4;
-		*pbuf++ = msg.header;
-		*pbuf++ = msg.byte1;
-		*pbuf++ = msg.byte2;
-		*pbuf++ = msg.byte3;
+		USBMIDI_InEpSendPacket();
 	}
+}
 
-	// Load up the endpoint FIFO!
-	// Since this is called only when we know the endpoint FIFO is ready to
-	// accept a new packet.
-	if( msgByteCnt )
+/**
+ * The USB0 ISR, which goes in the vector table in place of USB0DeviceIntHandler().
+ *
+ * The USB library's handler does all of the work. Then, since the library has
+ * the SOF interrupt on and counts frames in g_ui32USBSOFCount, check the IN
+ * endpoint's flush deadline.
+ *
+ * With USBMIDI_REMOTE_WAKEUP, a SOF while we think the bus is suspended means the
+ * host has resumed it. After a resume we signalled, the controller doesn't give
+ * a resume interrupt, so this is how HandleResume() gets called then.
+ */
+void USBMIDI_IntHandler(void)
+{
+	USB0DeviceIntHandler();
+#if USBMIDI_REMOTE_WAKEUP
+	if( g_sUsbMidiDevice.sPrivateData.bSuspended &&
+		(g_ui32USBSOFCount != g_sUsbMidiDevice.sPrivateData.ui32SuspendSOF) )
 	{
-		g_sUsbMidiDevice.sPrivateData.iUSBMidiTxState == eUsbMidiStateWaitData;
-		USBEndpointDataPut(USB0_BASE, USB_EP_1, buf, msgByteCnt);
-		USBEndpointDataSend(USB0_BASE, USB_EP_1, USB_TRANS_IN );
+		HandleResume(&g_sUsbMidiDevice);
 	}
+#endif
+	USBMIDI_InEpSendMessages();
 }
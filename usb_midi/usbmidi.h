@@ -9,6 +9,10 @@
 #define USB_MIDI_USBMIDI_H_
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#include "usb_midi.h"
+#include "pconfig.h"
 
 /**
  * Initialize the USB MIDI device.
@@ -23,9 +27,25 @@ bool USBMIDI_IsConnected(void);
 /**
  * Functions to access the message FIFOs.
  *
- * Pop the OUT Endpoint FIFO, which returns messages sent to us from the host.
+ * Messages from the host are queued by cable, 0 to USBMIDI_NUM_CABLES_OUT - 1, so
+ * each cable's consumer goes at its own pace. Taking messages off a queue also
+ * takes the rest of a packet the endpoint is holding for lack of room, once it fits.
+ *
+ * Pop one message from a cable's queue.
+ */
+bool USBMIDI_OutCableFIFO_Pop(uint8_t cable, USBMIDI_Message_t *msg);
+
+/**
+ * Get the oldest messages in a cable's queue without copying them.
+ * \param[out] span: set to point at the first of them.
+ * \returns how many there are in one piece. There may be more after a wrap.
+ */
+uint32_t USBMIDI_OutCableReadSpan(uint8_t cable, const USBMIDI_Message_t **span);
+
+/**
+ * Pop count messages that were read through USBMIDI_OutCableReadSpan().
  */
-bool USBMIDI_OutEpFIFO_Pop(USBMIDI_Message_t *msg);
+void USBMIDI_OutCableReadCommit(uint8_t cable, uint32_t count);
 
 /**
  * Push a new message to the outgoing (IN Endpoint) fifo.
@@ -33,10 +53,54 @@ bool USBMIDI_OutEpFIFO_Pop(USBMIDI_Message_t *msg);
 void USBMIDI_InEpMsgWrite(USBMIDI_Message_t *msg);
 
 /**
- * Check to see if transmit (IN endpoint) message FIFO has things to send.
- * If it does, repeatedly pop the FIFO and write the message bytes into
- * a buffer which then gets loaded into the endpoint buffer and transmitted.
+ * How many messages USBMIDI_InEpMsgWriteBatch() will surely take right now.
+ */
+uint32_t USBMIDI_InEpSpace(void);
+
+/**
+ * Push a run of messages to the outgoing (IN Endpoint) fifo, with one interrupt
+ * mask for the lot.
+ * \returns how many were pushed, which is count if the device isn't connected.
+ */
+uint32_t USBMIDI_InEpMsgWriteBatch(const USBMIDI_Message_t *msgs, uint32_t count);
+
+/**
+ * With USBMIDI_VENDOR, the vendor interface's bulk OUT endpoint takes raw MIDI
+ * bytes, such as a SysEx dump, and puts them straight into the transmit FIFO of a
+ * DIN port. The host picks the port first with the vendor request
+ * USBMIDI_VENDOR_REQ_SET_CABLE (usbmidi_descriptors.h). The bytes go out as they
+ * are, so the host sends whole messages, and nothing else should be sent to the
+ * same port while a SysEx dump is going.
+ *
+ * Call this from the main loop, to take more of the stream once the port has room.
+ */
+void USBMIDI_RawResume(void);
+
+#if USBMIDI_REMOTE_WAKEUP
+/**
+ * With USBMIDI_REMOTE_WAKEUP, DIN input wakes a suspended host. This says how long
+ * the last wakeup took, in milliseconds, from our request to the resume and to the
+ * host taking the first packet, so it can be printed from the main loop.
+ * \returns false if there has been no new wakeup since the last call.
+ */
+bool USBMIDI_WakeReport(uint32_t *resumeMs, uint32_t *firstEventMs);
+
+/**
+ * Times our remote wakeup signalling. Call from the 1 ms SysTick ISR.
+ */
+void USBMIDI_WakeTick(void);
+#endif
+
+/**
+ * If the IN endpoint is idle, and a full packet of messages is waiting or the
+ * oldest one has waited USBMIDI_IN_FLUSH_FRAMES frames, pop them from the FIFO
+ * into the endpoint buffer and transmit.
  */
 void USBMIDI_InEpSendMessages(void);
 
+/**
+ * The USB0 ISR. It goes in the vector table instead of USB0DeviceIntHandler().
+ */
+void USBMIDI_IntHandler(void);
+
 #endif /* USB_MIDI_USBMIDI_H_ */
@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include "usblib/device/usbdevice.h"
 #include "usblib/usblib.h"
+#include "pconfig.h"
 
 /**
  * \def Class-specific endpoint descriptor type
@@ -62,4 +63,288 @@
 #define USBMIDI_MS_EP_IN  (0x01)
 #define USBMIDI_MS_EP_OUT (0x01)
 
+/**
+ * The MIDI Streaming interface's number, and its alternate settings: USB-MIDI 1.0
+ * event packets, and with USBMIDI_UMP, USB MIDI 2.0 Universal MIDI Packets.
+ */
+#define USBMIDI_MS_INTERFACE (1)
+#define USBMIDI_ALT_MIDI1 (0)
+#define USBMIDI_ALT_UMP (1)
+
+/**
+ * Size of a standard bulk endpoint descriptor.
+ */
+#define USBMIDI_BULK_EP_DESC_SIZE (7)
+
+/*****************************************************************************
+ * MIDI Streaming interface generator.
+ *
+ * The jacks and the class-specific endpoint descriptors are made by these macros
+ * for USBMIDI_NUM_CABLES_OUT cables from the host and USBMIDI_NUM_CABLES_IN cables
+ * to the host, as set in pconfig.h. Each can be 1 to 16.
+ *
+ * A cable from the host (OUT endpoint) is an embedded IN jack wired to an external
+ * OUT jack. A cable to the host (IN endpoint) is an external IN jack wired to an
+ * embedded OUT jack. The jack IDs are numbered from 1: the OUT cables' jacks first,
+ * two per cable, then the IN cables'.
+ *****************************************************************************/
+#if (USBMIDI_NUM_CABLES_OUT < 1) || (USBMIDI_NUM_CABLES_OUT > 16)
+#error USBMIDI_NUM_CABLES_OUT must be 1 to 16
+#endif
+#if (USBMIDI_NUM_CABLES_IN < 1) || (USBMIDI_NUM_CABLES_IN > 16)
+#error USBMIDI_NUM_CABLES_IN must be 1 to 16
+#endif
+
+/**
+ * Jack IDs for cable n.
+ */
+#define USBMIDI_JACK_EMBIN(n)  (1 + (2 * (n)))
+#define USBMIDI_JACK_EXTOUT(n) (2 + (2 * (n)))
+#define USBMIDI_JACK_EXTIN(n)  (1 + (2 * USBMIDI_NUM_CABLES_OUT) + (2 * (n)))
+#define USBMIDI_JACK_EMBOUT(n) (2 + (2 * USBMIDI_NUM_CABLES_OUT) + (2 * (n)))
+
+/**
+ * The two jack descriptors for OUT cable n: embedded IN jack, and the external
+ * OUT jack it feeds.
+ */
+#define USBMIDI_OUT_CABLE_JACKS(n)                                              \
+    USB_MIDI_IN_JACK_DESC_SIZE,             /* bLength */                       \
+    USB_DTYPE_CS_INTERFACE,                 /* bDescriptorType */               \
+    MIDI_CS_IF_IN_JACK,                     /* bDescriptorSubType */            \
+    MIDI_JACKTYPE_Embedded,                 /* bJackType */                     \
+    USBMIDI_JACK_EMBIN(n),                  /* bJackID */                       \
+    0,                                      /* iJack, no string */              \
+    USB_MIDI_OUT_JACK_DESCRIPTOR_SIZE(1),   /* bLength */                       \
+    USB_DTYPE_CS_INTERFACE,                 /* bDescriptorType */               \
+    MIDI_CS_IF_OUT_JACK,                    /* bDescriptorSubType */            \
+    MIDI_JACKTYPE_External,                 /* bJackType */                     \
+    USBMIDI_JACK_EXTOUT(n),                 /* bJackID */                       \
+    1,                                      /* bNrInputPins */                  \
+    USBMIDI_JACK_EMBIN(n),                  /* baSourceID */                    \
+    1,                                      /* baSourcePin */                   \
+    0                                       /* iJack, no string */
+
+/**
+ * The two jack descriptors for IN cable n: external IN jack, and the embedded
+ * OUT jack it feeds.
+ */
+#define USBMIDI_IN_CABLE_JACKS(n)                                               \
+    USB_MIDI_IN_JACK_DESC_SIZE,             /* bLength */                       \
+    USB_DTYPE_CS_INTERFACE,                 /* bDescriptorType */               \
+    MIDI_CS_IF_IN_JACK,                     /* bDescriptorSubType */            \
+    MIDI_JACKTYPE_External,                 /* bJackType */                     \
+    USBMIDI_JACK_EXTIN(n),                  /* bJackID */                       \
+    0,                                      /* iJack, no string */              \
+    USB_MIDI_OUT_JACK_DESCRIPTOR_SIZE(1),   /* bLength */                       \
+    USB_DTYPE_CS_INTERFACE,                 /* bDescriptorType */               \
+    MIDI_CS_IF_OUT_JACK,                    /* bDescriptorSubType */            \
+    MIDI_JACKTYPE_Embedded,                 /* bJackType */                     \
+    USBMIDI_JACK_EMBOUT(n),                 /* bJackID */                       \
+    1,                                      /* bNrInputPins */                  \
+    USBMIDI_JACK_EXTIN(n),                  /* baSourceID */                    \
+    1,                                      /* baSourcePin */                   \
+    0                                       /* iJack, no string */
+
+#define USBMIDI_CABLE_JACKS_SIZE (USB_MIDI_IN_JACK_DESC_SIZE + USB_MIDI_OUT_JACK_DESCRIPTOR_SIZE(1))
+
+/**
+ * USBMIDI_REPEAT(n, m) is m(0), m(1), ... m(n-1). n must be a plain number.
+ */
+#define USBMIDI_REPEAT_1(m) m(0)
+#define USBMIDI_REPEAT_2(m) USBMIDI_REPEAT_1(m), m(1)
+#define USBMIDI_REPEAT_3(m) USBMIDI_REPEAT_2(m), m(2)
+#define USBMIDI_REPEAT_4(m) USBMIDI_REPEAT_3(m), m(3)
+#define USBMIDI_REPEAT_5(m) USBMIDI_REPEAT_4(m), m(4)
+#define USBMIDI_REPEAT_6(m) USBMIDI_REPEAT_5(m), m(5)
+#define USBMIDI_REPEAT_7(m) USBMIDI_REPEAT_6(m), m(6)
+#define USBMIDI_REPEAT_8(m) USBMIDI_REPEAT_7(m), m(7)
+#define USBMIDI_REPEAT_9(m) USBMIDI_REPEAT_8(m), m(8)
+#define USBMIDI_REPEAT_10(m) USBMIDI_REPEAT_9(m), m(9)
+#define USBMIDI_REPEAT_11(m) USBMIDI_REPEAT_10(m), m(10)
+#define USBMIDI_REPEAT_12(m) USBMIDI_REPEAT_11(m), m(11)
+#define USBMIDI_REPEAT_13(m) USBMIDI_REPEAT_12(m), m(12)
+#define USBMIDI_REPEAT_14(m) USBMIDI_REPEAT_13(m), m(13)
+#define USBMIDI_REPEAT_15(m) USBMIDI_REPEAT_14(m), m(14)
+#define USBMIDI_REPEAT_16(m) USBMIDI_REPEAT_15(m), m(15)
+#define USBMIDI_REPEAT_(n, m) USBMIDI_REPEAT_##n(m)
+#define USBMIDI_REPEAT(n, m) USBMIDI_REPEAT_(n, m)
+
+/**
+ * All of the jacks, and the embedded jacks each endpoint carries.
+ */
+#define USBMIDI_ALL_JACKS                                                       \
+    USBMIDI_REPEAT(USBMIDI_NUM_CABLES_OUT, USBMIDI_OUT_CABLE_JACKS),            \
+    USBMIDI_REPEAT(USBMIDI_NUM_CABLES_IN, USBMIDI_IN_CABLE_JACKS)
+#define USBMIDI_EP_OUT_JACKS USBMIDI_REPEAT(USBMIDI_NUM_CABLES_OUT, USBMIDI_JACK_EMBIN)
+#define USBMIDI_EP_IN_JACKS USBMIDI_REPEAT(USBMIDI_NUM_CABLES_IN, USBMIDI_JACK_EMBOUT)
+
+/**
+ * Descriptor lengths, all worked out from the number of cables.
+ *
+ * USBMIDI_MS_CS_TOTAL_SIZE is the MS class-specific header's wTotalLength: the
+ * header, the jacks, and both endpoints' standard and class-specific descriptors.
+ */
+#define USBMIDI_MS_CS_TOTAL_SIZE (USB_MIDI_CS_MS_IF_DESC_SIZE +                 \
+    ((USBMIDI_NUM_CABLES_OUT + USBMIDI_NUM_CABLES_IN) * USBMIDI_CABLE_JACKS_SIZE) + \
+    USBMIDI_BULK_EP_DESC_SIZE + USB_MIDI_CS_STREAMING_BULK_ENDPOINT_SIZE(USBMIDI_NUM_CABLES_IN) + \
+    USBMIDI_BULK_EP_DESC_SIZE + USB_MIDI_CS_STREAMING_BULK_ENDPOINT_SIZE(USBMIDI_NUM_CABLES_OUT))
+
+#define USBMIDI_AC_IF_SIZE (9 + USB_MIDI_CS_AC_IF_DESC_SIZE)
+#define USBMIDI_MS_IF_SIZE (9 + USBMIDI_MS_CS_TOTAL_SIZE)
+#define USBMIDI_CONFIG_TOTAL_SIZE (9 + USBMIDI_MIDI_IAD_SIZE + USBMIDI_AC_IF_SIZE + USBMIDI_MS_IF_SIZE + \
+    USBMIDI_MS_UMP_IF_SIZE + USBMIDI_VENDOR_IF_SIZE + USBMIDI_CDC_IF_SIZE)
+
+/*****************************************************************************
+ * Vendor-specific raw stream interface, with USBMIDI_VENDOR.
+ *
+ * One bulk OUT endpoint, whose bytes go out a DIN port as they are. The host
+ * picks the port by its cable number with the vendor request
+ * USBMIDI_VENDOR_REQ_SET_CABLE (wValue is the cable number, wIndex the interface),
+ * which has no data stage.
+ *****************************************************************************/
+#define USBMIDI_VENDOR_INTERFACE (2)
+#define USBMIDI_VENDOR_EP_OUT (0x02)
+#define USBMIDI_VENDOR_REQ_SET_CABLE (0x01)
+
+#if USBMIDI_VENDOR
+#define USBMIDI_VENDOR_IF_SIZE (9 + USBMIDI_BULK_EP_DESC_SIZE)
+#else
+#define USBMIDI_VENDOR_IF_SIZE (0)
+#endif
+
+/*****************************************************************************
+ * CDC-ACM console, with USBMIDI_CDC.
+ *
+ * A communications interface with an interrupt IN endpoint for notifications,
+ * which we never send, and a data interface with a bulk endpoint each way. They
+ * follow the MIDI interfaces and the vendor interface. Each function has an
+ * Interface Association Descriptor, as a composite device needs.
+ *****************************************************************************/
+#define USBMIDI_CDC_COMM_INTERFACE (2 + USBMIDI_VENDOR)
+#define USBMIDI_CDC_DATA_INTERFACE (3 + USBMIDI_VENDOR)
+#define USBMIDI_CDC_EP_NOTIFY (0x03)
+#define USBMIDI_CDC_EP_DATA (0x04)
+
+#define USB_CDC_SUBCLASS_ACM (0x02)
+#define USB_CDC_PROTOCOL_V25TER (0x01)
+#define USB_CDC_CS_HEADER (0x00)
+#define USB_CDC_CS_CALL_MGMT (0x01)
+#define USB_CDC_CS_ACM (0x02)
+#define USB_CDC_CS_UNION (0x06)
+
+#define USBMIDI_IAD_SIZE (8)
+#define USBMIDI_INT_EP_DESC_SIZE (7)
+
+#if USBMIDI_CDC
+/**
+ * The CDC function: its IAD, the communications interface with its four
+ * functional descriptors (header 5, call management 5, ACM 4, union 5) and its
+ * endpoint, and the data interface with its two. The MIDI function has an IAD
+ * in front too.
+ */
+#define USBMIDI_CDC_IF_SIZE (USBMIDI_IAD_SIZE + 9 + 5 + 5 + 4 + 5 + USBMIDI_INT_EP_DESC_SIZE + \
+    9 + (2 * USBMIDI_BULK_EP_DESC_SIZE))
+#define USBMIDI_MIDI_IAD_SIZE USBMIDI_IAD_SIZE
+#else
+#define USBMIDI_CDC_IF_SIZE (0)
+#define USBMIDI_MIDI_IAD_SIZE (0)
+#endif
+
+/**
+ * Audio Control and MIDI Streaming, and the vendor and CDC interfaces if there
+ * are any.
+ */
+#define USBMIDI_NUM_INTERFACES (2 + USBMIDI_VENDOR + (2 * USBMIDI_CDC))
+
+/*****************************************************************************
+ * USB MIDI 2.0, alternate setting 1.
+ *
+ * Its class-specific endpoint descriptors list group terminal blocks instead of
+ * jacks. The blocks aren't in the configuration descriptor; the host asks for
+ * them with GET_DESCRIPTOR, see HandleGetDescriptor().
+ *
+ * UMP group n is cable n. Block 1 has the groups that go both ways, and if one
+ * way has more cables than the other, block 2 has the rest.
+ *****************************************************************************/
+#define USB_MIDI_CS_EP_MS_GENERAL_2_0 (0x02)
+#define USB_MIDI_DTYPE_CS_GR_TRM_BLOCK (0x26)
+#define MIDI_CS_GR_TRM_BLOCK_HEADER (0x01)
+#define MIDI_CS_GR_TRM_BLOCK (0x02)
+
+/**
+ * Group terminal block types and protocols.
+ */
+#define MIDI_GR_TRM_BLOCK_BIDIRECTIONAL (0x00)
+#define MIDI_GR_TRM_BLOCK_IN (0x01)
+#define MIDI_GR_TRM_BLOCK_OUT (0x02)
+#define MIDI_GR_TRM_PROTOCOL_MIDI1_64 (0x01)
+
+#define USB_MIDI_GR_TRM_BLOCK_HEADER_SIZE (5)
+#define USB_MIDI_GR_TRM_BLOCK_SIZE (13)
+#define USB_MIDI_CS_EP_MS_GENERAL_2_0_SIZE(NumBlocks) (4 + (NumBlocks))
+
+#if USBMIDI_UMP
+
+#define USBMIDI_UMP_GROUPS_BOTH ((USBMIDI_NUM_CABLES_OUT < USBMIDI_NUM_CABLES_IN) ? \
+		USBMIDI_NUM_CABLES_OUT : USBMIDI_NUM_CABLES_IN)
+
+#if USBMIDI_NUM_CABLES_OUT > USBMIDI_NUM_CABLES_IN
+#define USBMIDI_UMP_NUM_BLOCKS 2
+#define USBMIDI_UMP_OUT_BLOCKS 1, 2
+#define USBMIDI_UMP_NUM_OUT_BLOCKS 2
+#define USBMIDI_UMP_IN_BLOCKS 1
+#define USBMIDI_UMP_NUM_IN_BLOCKS 1
+#elif USBMIDI_NUM_CABLES_OUT < USBMIDI_NUM_CABLES_IN
+#define USBMIDI_UMP_NUM_BLOCKS 2
+#define USBMIDI_UMP_OUT_BLOCKS 1
+#define USBMIDI_UMP_NUM_OUT_BLOCKS 1
+#define USBMIDI_UMP_IN_BLOCKS 1, 2
+#define USBMIDI_UMP_NUM_IN_BLOCKS 2
+#else
+#define USBMIDI_UMP_NUM_BLOCKS 1
+#define USBMIDI_UMP_OUT_BLOCKS 1
+#define USBMIDI_UMP_NUM_OUT_BLOCKS 1
+#define USBMIDI_UMP_IN_BLOCKS 1
+#define USBMIDI_UMP_NUM_IN_BLOCKS 1
+#endif
+
+/**
+ * One group terminal block.
+ */
+#define USBMIDI_GR_TRM_BLOCK(id, type, first, count)                            \
+    USB_MIDI_GR_TRM_BLOCK_SIZE,             /* bLength */                       \
+    USB_MIDI_DTYPE_CS_GR_TRM_BLOCK,         /* bDescriptorType */               \
+    MIDI_CS_GR_TRM_BLOCK,                   /* bDescriptorSubtype */            \
+    (id),                                   /* bGrpTrmBlkID */                  \
+    (type),                                 /* bGrpTrmBlkType */                \
+    (first),                                /* nGroupTrm, the first group */    \
+    (count),                                /* nNumGroupTrm */                  \
+    0,                                      /* iBlockItem, no string */         \
+    MIDI_GR_TRM_PROTOCOL_MIDI1_64,          /* bMIDIProtocol */                 \
+    USBShort(0),                            /* wMaxInputBandwidth, unknown */   \
+    USBShort(0)                             /* wMaxOutputBandwidth, unknown */
+
+#define USBMIDI_GTB_TOTAL_SIZE (USB_MIDI_GR_TRM_BLOCK_HEADER_SIZE + \
+		(USBMIDI_UMP_NUM_BLOCKS * USB_MIDI_GR_TRM_BLOCK_SIZE))
+
+/**
+ * Alternate setting 1 of the MS interface: the standard interface descriptor, the
+ * class-specific header, which is all of its class-specific interface descriptor,
+ * and both endpoints' standard and class-specific descriptors.
+ */
+#define USBMIDI_MS_UMP_IF_SIZE (9 + USB_MIDI_CS_MS_IF_DESC_SIZE +               \
+    USBMIDI_BULK_EP_DESC_SIZE + USB_MIDI_CS_EP_MS_GENERAL_2_0_SIZE(USBMIDI_UMP_NUM_IN_BLOCKS) + \
+    USBMIDI_BULK_EP_DESC_SIZE + USB_MIDI_CS_EP_MS_GENERAL_2_0_SIZE(USBMIDI_UMP_NUM_OUT_BLOCKS))
+
+extern const uint8_t g_pui8MidiGroupTerminalBlocks[];
+
+#else
+#define USBMIDI_MS_UMP_IF_SIZE (0)
+#endif
+
+/**
+ * Fail the build if cond is false. name must be unique in its file.
+ */
+#define USBMIDI_STATIC_ASSERT(cond, name) typedef char name[(cond) ? 1 : -1]
+
 #endif /* DESCRIPTORS_H_ */
@@ -8,6 +8,9 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "inc/hw_memmap.h"
+#include "inc/hw_types.h"
+#include "inc/hw_usb.h"
 #include "driverlib/debug.h"
 #include "driverlib/rom.h"
 #include "driverlib/rom_map.h"
@@ -17,7 +20,11 @@
 
 #include "usbmidi_handlers.h"
 #include "usbmidi_types.h"
+#include "usbmidi_descriptors.h"
+#include "usbmidi_ump.h"
 #include "usbmidi.h"
+#include "midi_ports.h"
+#include "usbcdc_console.h"
 
 #include "pconfig.h"
 
@@ -25,12 +32,347 @@
 
 /**
  * USB MIDI does define some class-specific requests, which we do not handle.
+ *
+ * With USBMIDI_VENDOR, the vendor interface has one request of its own,
+ * USBMIDI_VENDOR_REQ_SET_CABLE, which picks the DIN port its bytes go to. The
+ * host should send it before the stream, not in the middle of a packet.
+ *
+ * With USBMIDI_CDC, the console's communications interface has the CDC-ACM
+ * requests, which usbcdc_console.c handles.
  */
 void HandleRequests(void *pvMidiDevice, tUSBRequest *pUSBRequest)
 {
+#if USBMIDI_CDC
+	if( USBCDC_HandleRequest(pUSBRequest) )
+		return;
+#endif
+
+#if USBMIDI_VENDOR
+	tUSBMidiDevice *psUsbMidiDevice;
+
+	if( ((pUSBRequest->bmRequestType & USB_RTYPE_TYPE_M) == USB_RTYPE_VENDOR) &&
+		((pUSBRequest->bmRequestType & USB_RTYPE_RECIPIENT_M) == USB_RTYPE_INTERFACE) &&
+		((pUSBRequest->wIndex & 0xFF) == USBMIDI_VENDOR_INTERFACE) &&
+		(pUSBRequest->bRequest == USBMIDI_VENDOR_REQ_SET_CABLE) &&
+		(pUSBRequest->wLength == 0) )
+	{
+		psUsbMidiDevice = (tUSBMidiDevice *) pvMidiDevice;
+		psUsbMidiDevice->sPrivateData.ui8RawCable = pUSBRequest->wValue & 0x0F;
+
+		// no data stage, so this is the end of it.
+		MAP_USBDevEndpointDataAck(USB0_BASE, USB_EP_0, true);
+		return;
+	}
+#endif
+
+	USBDCDStallEP0(0);
+}
+
+/**
+ * The data stage of a request that has one arrived. Only the console's
+ * SET_LINE_CODING asks for one.
+ */
+void HandleEP0Data(void *pvMidiDevice, uint32_t ui32DataSize)
+{
+	(void) pvMidiDevice;
+#if USBMIDI_CDC
+	USBCDC_HandleEP0Data(ui32DataSize);
+#else
+	(void) ui32DataSize;
+#endif
+}
+
+/**
+ * GET_DESCRIPTOR for a descriptor type the USB library doesn't know.
+ *
+ * With USBMIDI_UMP, a USB MIDI 2.0 host asks the MS interface for the group
+ * terminal blocks of alternate setting 1. Everything else is stalled.
+ */
+void HandleGetDescriptor(void *pvMidiDevice, tUSBRequest *pUSBRequest)
+{
+#if USBMIDI_UMP
+	uint32_t size;
+
+	(void) pvMidiDevice;
+	if( ((pUSBRequest->wValue >> 8) == USB_MIDI_DTYPE_CS_GR_TRM_BLOCK) &&
+		((pUSBRequest->wValue & 0xFF) == USBMIDI_ALT_UMP) &&
+		((pUSBRequest->wIndex & 0xFF) == USBMIDI_MS_INTERFACE) )
+	{
+		size = USBMIDI_GTB_TOTAL_SIZE;
+		if( size > pUSBRequest->wLength )
+			size = pUSBRequest->wLength;
+		USBDCDSendDataEP0(0, (uint8_t *) g_pui8MidiGroupTerminalBlocks, size);
+		return;
+	}
+#else
+	(void) pvMidiDevice;
+	(void) pUSBRequest;
+#endif
+
 	USBDCDStallEP0(0);
 }
 
+/**
+ * Dispatch one word from the OUT endpoint to the queue of its cable.
+ *
+ * On USB-MIDI 1.0 the word is an event packet, and it is pushed as it is onto the
+ * queue its cable number picks. On USBMIDI_ALT_UMP it is a UMP word, and the UMP's
+ * group picks the queue for the event packets it makes. A cable or group we don't
+ * have is dropped.
+ *
+ * \returns false if the queue hasn't room, and the word has to wait.
+ */
+static bool HandleOutWord(tUSBMidiDevice *psUsbMidiDevice, uint32_t word)
+{
+	uint32_t cable;
+
+#if USBMIDI_UMP
+	tUSBMidiInstance *psInst;
+
+	psInst = &psUsbMidiDevice->sPrivateData;
+
+	if( USBMIDI_ALT_UMP == psInst->ui8AltSetting )
+	{
+		USBMIDI_Message_t events[UMP_EVENTS_PER_UMP_MAX];
+		uint32_t n;
+
+		// a UMP's group is in its first word, which may have come already.
+		cable = ((psInst->sUMP.outwords ? psInst->sUMP.outump[0] : word) >> 24) & 0x0F;
+		if( (cable < USBMIDI_NUM_CABLES_OUT) &&
+			(USBMIDIFIFO_Space(&psUsbMidiDevice->OutCableFifo[cable]) < UMP_EVENTS_PER_UMP_MAX) )
+			return false;
+
+		// the translator still sees the words of a group we don't have, to keep
+		// its place in the stream.
+		n = USBMIDI_UMPToEvents(&psInst->sUMP, word, events);
+		if( cable < USBMIDI_NUM_CABLES_OUT )
+			USBMIDIFIFO_PushBatch(&psUsbMidiDevice->OutCableFifo[cable], (const uint8_t *) events, n);
+		return true;
+	}
+#endif
+
+	// the header is the first byte on the wire, so the low byte of the word.
+	cable = (word & 0xFF) >> 4;
+	if( cable >= USBMIDI_NUM_CABLES_OUT )
+		return true;
+
+	return USBMIDIFIFO_PushWord(&psUsbMidiDevice->OutCableFifo[cable], word);
+}
+
+/**
+ * Dispatch one word of the OUT packet with HandleOutWord(), or hold it back in
+ * pui32OutHeld if it can't go yet.
+ *
+ * On USB-MIDI 1.0 a word is held if its cable's queue is full, or if its cable
+ * already has words held, so each cable keeps its order. The words for the other
+ * cables still go. On USBMIDI_ALT_UMP the translator must see the words in the
+ * order they came, so once a word is held, so is the rest of the packet.
+ *
+ * \returns false if the rest of the packet has to wait in the endpoint.
+ */
+static bool TakeOutWord(tUSBMidiDevice *psUsbMidiDevice, uint32_t word)
+{
+	tUSBMidiInstance *psInst;
+	uint32_t cable;
+
+	psInst = &psUsbMidiDevice->sPrivateData;
+
+#if USBMIDI_UMP
+	if( USBMIDI_ALT_UMP == psInst->ui8AltSetting )
+	{
+		if( (0 == psInst->ui32OutHeldCount) && HandleOutWord(psUsbMidiDevice, word) )
+			return true;
+
+		psInst->pui32OutHeld[psInst->ui32OutHeldCount++] = word;
+		return false;
+	}
+#endif
+
+	cable = (word & 0xFF) >> 4;
+	if( !(psInst->ui32OutHeldCables & (1 << cable)) && HandleOutWord(psUsbMidiDevice, word) )
+		return true;
+
+	psInst->pui32OutHeld[psInst->ui32OutHeldCount++] = word;
+	psInst->ui32OutHeldCables |= 1 << cable;
+	return true;
+}
+
+/**
+ * Take the packet waiting in the OUT endpoint: read it from the endpoint FIFO a
+ * word at a time, and dispatch each word straight onto its cable's queue, with
+ * TakeOutWord(). Then ack it.
+ *
+ * A word whose cable's queue is full is held back, with the cable's words after
+ * it, and the words for the other cables go on to their queues, so one slow cable
+ * doesn't hold up the rest of the packet. Nothing is dropped: until the held words
+ * have gone too, the packet isn't acked and the Rx state is eUsbMidiStateWaitData,
+ * so the controller NAKs the host's next OUT and the host waits for us.
+ * USBMIDI_OutCableFIFO_Pop() and USBMIDI_OutCableReadCommit() call this again once
+ * they have made room, and it retries the held words in the order they came.
+ *
+ * Call from the USB ISR or with interrupts masked.
+ *
+ * \returns true if the packet was taken.
+ */
+bool HandleOutPacket(tUSBMidiDevice *psUsbMidiDevice)
+{
+	tUSBMidiInstance *psInst;
+	uint32_t held;
+	uint32_t idx;
+	bool more;
+
+	psInst = &psUsbMidiDevice->sPrivateData;
+
+	if( (0 == psInst->ui32OutHeldCount) && (0 == psInst->ui32OutPktLeft) )
+	{
+		// a new packet.
+		psInst->ui32OutPktLeft = MAP_USBEndpointDataAvail(USB0_BASE, USB_EP_1);
+	}
+
+	// first the words held back last time. TakeOutWord() holds again any that
+	// still can't go, at or before where they were.
+	held = psInst->ui32OutHeldCount;
+	psInst->ui32OutHeldCount = 0;
+	psInst->ui32OutHeldCables = 0;
+	more = true;
+	for( idx = 0; idx < held; idx++ )
+	{
+		if( !TakeOutWord(psUsbMidiDevice, psInst->pui32OutHeld[idx]) )
+			more = false;
+	}
+
+	while( more && (psInst->ui32OutPktLeft >= 4) )
+	{
+		// EP1's FIFO register gives the next four bytes of the packet.
+		psInst->ui32OutPktLeft -= 4;
+		more = TakeOutWord(psUsbMidiDevice, HWREG(USB0_BASE + USB_O_FIFO1));
+	}
+
+	if( psInst->ui32OutHeldCount )
+	{
+		// no room. Hold the packet, and the host, until there is.
+		psInst->iUSBMidiRxState = eUsbMidiStateWaitData;
+		return false;
+	}
+
+	// a stray partial event at the end is dropped with the packet.
+	psInst->ui32OutPktLeft = 0;
+
+	// ack the data, thus freeing the host to send the next packet.
+	psInst->iUSBMidiRxState = eUsbMidiStateIdle;
+	MAP_USBDevEndpointDataAck(USB0_BASE, USB_EP_1, true);
+
+	return true;
+}
+
+/**
+ * Take packets from the OUT endpoint for as long as there are packets and room
+ * for them. With double buffering there may be a second packet right behind the
+ * one just acked.
+ */
+void HandleOutPackets(tUSBMidiDevice *psUsbMidiDevice)
+{
+	while( (MAP_USBEndpointStatus(USB0_BASE, USB_EP_1) & USB_DEV_RX_PKT_RDY) &&
+			HandleOutPacket(psUsbMidiDevice) )
+		;
+}
+
+#if USBMIDI_VENDOR
+/**
+ * Take the packet waiting in the vendor OUT endpoint: copy its bytes from the
+ * endpoint FIFO straight into the transmit FIFO of the DIN port with cable number
+ * ui8RawCable, as many as fit, with MIDIUART_tryWriteRaw(). Then ack it. If there
+ * is no such port, the bytes are thrown away.
+ *
+ * The port's FIFO is smaller than a packet, so a packet usually goes in pieces.
+ * If the FIFO fills, the rest of the packet stays in the endpoint, bRawHeld is
+ * set, and the host is NAKed until USBMIDI_RawResume() finds room and carries on.
+ *
+ * Call from the USB ISR or with interrupts masked.
+ *
+ * \returns true if the packet was taken.
+ */
+static bool HandleRawPacket(tUSBMidiDevice *psUsbMidiDevice)
+{
+	tUSBMidiInstance *psInst;
+	midiport_t *port;
+	uint8_t buf[USBMIDI_EP_PACKET_SIZE];
+	uint32_t size;
+	uint32_t idx;
+
+	psInst = &psUsbMidiDevice->sPrivateData;
+
+	if( !psInst->bRawHeld )
+	{
+		// a new packet.
+		psInst->ui32RawPktLeft = MAP_USBEndpointDataAvail(USB0_BASE, USB_EP_2);
+	}
+
+	port = MIDIPORTS_byCable(psInst->ui8RawCable);
+
+	while( psInst->ui32RawPktLeft )
+	{
+		size = psInst->ui32RawPktLeft;
+		if( size > sizeof(buf) )
+			size = sizeof(buf);
+		if( port && (size > MIDIUART_txSpace(port)) )
+			size = MIDIUART_txSpace(port);
+
+		if( 0 == size )
+		{
+			// no room. Hold the rest of the packet, and the host, until there is.
+			psInst->bRawHeld = true;
+			return false;
+		}
+
+		// EP2's FIFO register gives the next byte of the packet.
+		for( idx = 0; idx < size; idx++ )
+			buf[idx] = HWREGB(USB0_BASE + USB_O_FIFO2);
+		psInst->ui32RawPktLeft -= size;
+
+		if( port )
+			MIDIUART_tryWriteRaw(port, buf, size);
+	}
+
+	psInst->bRawHeld = false;
+	MAP_USBDevEndpointDataAck(USB0_BASE, USB_EP_2, true);
+
+	return true;
+}
+
+/**
+ * Take packets from the vendor OUT endpoint for as long as there are packets and
+ * room for them.
+ */
+void HandleRawPackets(tUSBMidiDevice *psUsbMidiDevice)
+{
+	while( (MAP_USBEndpointStatus(USB0_BASE, USB_EP_2) & USB_DEV_RX_PKT_RDY) &&
+			HandleRawPacket(psUsbMidiDevice) )
+		;
+}
+#endif
+
+#if USBMIDI_DMA
+/**
+ * Finish off an IN endpoint DMA transfer: the packet is in the endpoint, so pop
+ * its messages and send it.
+ */
+static void HandleInDMADone(tUSBMidiDevice *psUsbMidiDevice)
+{
+	tUSBMidiInstance *psInst;
+
+	psInst = &psUsbMidiDevice->sPrivateData;
+
+	USBLibDMAChannelDisable(psInst->psDMAInstance, psInst->ui32INDMA);
+	MAP_USBEndpointDMADisable(USB0_BASE, USB_EP_1, USB_EP_DEV_IN);
+
+	USBMIDIFIFO_ReadCommit(&psUsbMidiDevice->InEpMsgFifo, psInst->ui32INDMACount);
+	psInst->ui32INDMACount = 0;
+
+	MAP_USBEndpointDataSend(USB0_BASE, USB_EP_1, USB_TRANS_IN);
+}
+#endif
+
 /**
  * Callback invoked when data are available on an OUT endpoint or to present data to an IN endpoint.
  *
@@ -58,10 +400,6 @@ void HandleEndpoints(void *pvMidiDevice, uint32_t ui32Status)
 	tUSBMidiDevice *psUsbMidiDevice;
 	tUSBMidiInstance *psInst;
 	uint32_t ui32EPStatus;
-	uint32_t bytecount;
-	uint8_t buf[64];	// read endpoint data into this, which is max packet size
-	uint8_t *pbuf;
-	USBMIDI_Message_t usbmep;			// build a message into this.
 
 	ASSERT(pvMidiDevice != 0);
 
@@ -74,48 +412,112 @@ void HandleEndpoints(void *pvMidiDevice, uint32_t ui32Status)
     // Clear the status bits.
     MAP_USBDevEndpointStatusClear(USB0_BASE, USB_EP_1, ui32EPStatus);
 
+#if USBMIDI_DMA
+    // The USB DMA interrupt comes here too, maybe with no endpoint interrupt.
+    if( psInst->ui32INDMACount &&
+    	(USBLibDMAChannelStatus(psInst->psDMAInstance, psInst->ui32INDMA) & USBLIBSTATUS_DMA_COMPLETE) )
+    {
+    	HandleInDMADone(psUsbMidiDevice);
+    }
+#endif
+
     // if Interrupt From OUT Endpoint.
 	// Data are coming in from the host, and we should handle them.
 	if( ui32Status & USB_INTEP_DEV_OUT_1 )
 	{
-		// Check to see if the OUT endpoint has data for us.
-		// I suppose that checking the data available amounts to the same thing.
-		if( ui32EPStatus & USB_DEV_RX_PKT_RDY )
-		{
-			// Data are being sent to us from the host.
-			// Get all bytes in buffer.
-			bytecount = MAP_USBEndpointDataAvail(USB0_BASE, USB_EP_1);
-			MAP_USBEndpointDataGet(USB0_BASE, USB_EP_1, buf, &bytecount);
-			// now take the contents of buf and make a bunch of MIDI packets
-			// and push them to the incoming data FIFO.
-			pbuf = buf;
-			while( bytecount ) {
-				usbmep.header = *pbuf++;
-				usbmep.byte1  = *pbuf++;
-				usbmep.byte2  = *pbuf++;
-				usbmep.byte3  = *pbuf++;
-				USBMIDIFIFO_Push(&psUsbMidiDevice->OutEpMsgFifo, &usbmep);
-				bytecount -= 4;
-			}
-
-			// ack the data, thus freeing the host to send the next packet.
-			MAP_USBDevEndpointDataAck(USB0_BASE, USB_EP_1, true);
-		}
+		// Data are being sent to us from the host. Take them if there is
+		// room, else NAK the host until the main loop makes room.
+		HandleOutPackets(psUsbMidiDevice);
     }
 
+#if USBMIDI_VENDOR
+	// Raw bytes for a DIN port, on the vendor interface.
+	if( ui32Status & USB_INTEP_DEV_OUT_2 )
+	{
+		MAP_USBDevEndpointStatusClear(USB0_BASE, USB_EP_2,
+				MAP_USBEndpointStatus(USB0_BASE, USB_EP_2));
+		HandleRawPackets(psUsbMidiDevice);
+	}
+#endif
+
+#if USBMIDI_CDC
+	// The console's data endpoint, both ways.
+	if( ui32Status & USB_INTEP_DEV_OUT_4 )
+	{
+		MAP_USBDevEndpointStatusClear(USB0_BASE, USB_EP_4,
+				MAP_USBEndpointStatus(USB0_BASE, USB_EP_4));
+		USBCDC_HandleOut();
+	}
+	if( ui32Status & USB_INTEP_DEV_IN_4 )
+		USBCDC_HandleIn();
+#endif
+
 	// Interrupt From IN Endpoint?
-	// This is set after a packet was sent to the host.
+	// This is set when the endpoint can take another packet: after a packet was
+	// sent to the host or, double buffered, as soon as the packet moves into the
+	// second buffer. So one packet can be in flight while the next is loaded.
 	// Check to see if there are more MIDI messages to send, and do so if there are.
 	if( ui32Status & USB_INTEP_DEV_IN_1 )
 	{
-		// Indicate that the endpoint is ready for new data.
+#if USBMIDI_REMOTE_WAKEUP
+		// the first packet the host took after we woke it.
+		if( psInst->bWakeRequested && !psInst->bSuspended )
+		{
+			psInst->ui32FirstEventTick = g_ui32SysTickCount;
+			psInst->bWakeRequested = false;
+			psInst->bWakeReport = true;
+		}
+#endif
+
+		// Indicate that the endpoint is ready for new data. The next packet
+		// goes now if it is full or due, else at the SOF when it is due.
 	    psInst->iUSBMidiTxState = eUsbMidiStateIdle;
 		USBMIDI_InEpSendMessages();
 	}
 }
 
+/**
+ * Start the MIDI endpoints afresh: nothing queued, nothing half sent or half read,
+ * and nothing for the DMA to finish. Done when the configuration or the alternate
+ * setting changes.
+ */
+static void ResetStreaming(tUSBMidiDevice *psUSBMidiDevice)
+{
+	tUSBMidiInstance *psInst;
+	uint32_t cable;
+
+	psInst = &psUSBMidiDevice->sPrivateData;
+    psInst->iUSBMidiRxState = eUsbMidiStateIdle;
+    psInst->iUSBMidiTxState = eUsbMidiStateIdle;
+    psInst->bInFlushArmed = false;
+
+#if USBMIDI_DMA
+    // anything the DMA was doing belongs to the old configuration or setting.
+    USBLibDMAChannelDisable(psInst->psDMAInstance, psInst->ui32INDMA);
+    psInst->ui32INDMACount = 0;
+#endif
+
+    // and so does any OUT packet half read.
+    psInst->ui32OutPktLeft = 0;
+    psInst->ui32OutHeldCount = 0;
+    psInst->ui32OutHeldCables = 0;
+#if USBMIDI_VENDOR
+    psInst->ui32RawPktLeft = 0;
+    psInst->bRawHeld = false;
+#endif
+
+	USBMIDIFIFO_Init(&psUSBMidiDevice->InEpMsgFifo);
+	for( cable = 0; cable < USBMIDI_NUM_CABLES_OUT; cable++ )
+		USBMIDIFIFO_Init(&psUSBMidiDevice->OutCableFifo[cable]);
+
+#if USBMIDI_UMP
+	USBMIDI_UMPInit(&psInst->sUMP);
+#endif
+}
+
 /**
  * This should indicate that we are attached to the bus, so turn on the LED.
+ * A new configuration starts on alternate setting 0, USB-MIDI 1.0.
  */
 void HandleConfigChange(void *pvMidiDevice, uint32_t ui32Status)
 {
@@ -125,16 +527,61 @@ void HandleConfigChange(void *pvMidiDevice, uint32_t ui32Status)
 	psUSBMidiDevice = (tUSBMidiDevice *) pvMidiDevice;
 	psInst = &psUSBMidiDevice->sPrivateData;
     psInst->bConnected = true;
-    psInst->iUSBMidiRxState = eUsbMidiStateIdle;
-    psInst->iUSBMidiTxState = eUsbMidiStateIdle;
-
-	USBMIDIFIFO_Init(&psUSBMidiDevice->InEpMsgFifo);
-	USBMIDIFIFO_Init(&psUSBMidiDevice->OutEpMsgFifo);
+#if USBMIDI_UMP
+    psInst->ui8AltSetting = USBMIDI_ALT_MIDI1;
+#endif
+#if USBMIDI_REMOTE_WAKEUP
+    psInst->bSuspended = false;
+    psInst->bWakeRequested = false;
+#endif
+    ResetStreaming(psUSBMidiDevice);
+#if USBMIDI_CDC
+    USBCDC_Reset();
+#endif
 
+#if USBMIDI_DOUBLE_BUFFER
+	// The USB library has just given EP1 one packet of FIFO RAM each way.
+	// Give it two each way instead, at the top of FIFO RAM, out of the way
+	// of what the library hands out from the bottom up.
+	MAP_USBFIFOConfigSet(USB0_BASE, USB_EP_1, USBMIDI_EP1_IN_FIFO_ADDR,
+			USB_FIFO_SZ_64 | USB_TXFIFOSZ_DPB, USB_EP_DEV_IN);
+	MAP_USBFIFOConfigSet(USB0_BASE, USB_EP_1, USBMIDI_EP1_OUT_FIFO_ADDR,
+			USB_FIFO_SZ_64 | USB_RXFIFOSZ_DPB, USB_EP_DEV_OUT);
+	HWREGH(USB0_BASE + USB_O_TXDPKTBUFDIS) &= ~USB_TXDPKTBUFDIS_EP1;
+	HWREGH(USB0_BASE + USB_O_RXDPKTBUFDIS) &= ~USB_RXDPKTBUFDIS_EP1;
+	MAP_USBFIFOFlush(USB0_BASE, USB_EP_1, USB_EP_DEV_IN);
+	MAP_USBFIFOFlush(USB0_BASE, USB_EP_1, USB_EP_DEV_OUT);
+#endif
 
 	MAP_GPIOPinWrite(LED_PORT, LED_LED0, LED_LED0);
 }
 
+/**
+ * The host picked an alternate setting of an interface. For the MS interface, that
+ * switches the endpoints between event packets and UMPs. What was in flight in
+ * the old format is thrown away, in the FIFOs and in the endpoint.
+ */
+void HandleInterfaceChange(void *pvMidiDevice, uint8_t ui8InterfaceNum, uint8_t ui8AlternateSetting)
+{
+#if USBMIDI_UMP
+	tUSBMidiDevice *psUSBMidiDevice;
+
+	if( USBMIDI_MS_INTERFACE != ui8InterfaceNum )
+		return;
+
+	psUSBMidiDevice = (tUSBMidiDevice *) pvMidiDevice;
+	psUSBMidiDevice->sPrivateData.ui8AltSetting = ui8AlternateSetting;
+	ResetStreaming(psUSBMidiDevice);
+
+	MAP_USBFIFOFlush(USB0_BASE, USB_EP_1, USB_EP_DEV_IN);
+	MAP_USBFIFOFlush(USB0_BASE, USB_EP_1, USB_EP_DEV_OUT);
+#else
+	(void) pvMidiDevice;
+	(void) ui8InterfaceNum;
+	(void) ui8AlternateSetting;
+#endif
+}
+
 void HandleDisconnect(void *pvMidiDevice)
 {
 
@@ -144,6 +591,18 @@ void HandleDisconnect(void *pvMidiDevice)
 	psUSBMidiDevice = (tUSBMidiDevice *) pvMidiDevice;
 	psInst = &psUSBMidiDevice->sPrivateData;
     psInst->bConnected = false;
+#if USBMIDI_REMOTE_WAKEUP
+    psInst->bSuspended = false;
+    psInst->bWakeRequested = false;
+    if( psInst->bWakePulse )
+    {
+        MAP_USBHostResume(USB0_BASE, false);
+        psInst->bWakePulse = false;
+    }
+#endif
+#if USBMIDI_CDC
+    USBCDC_Reset();
+#endif
 
     MAP_GPIOPinWrite(LED_PORT, LED_LED0, 0);
 }
@@ -151,17 +610,51 @@ void HandleDisconnect(void *pvMidiDevice)
 /**
  * Called when bus is put into suspend state.
  * Simply turn on an LED to indicate that state.
+ *
+ * With USBMIDI_REMOTE_WAKEUP, messages for the host wait in the IN endpoint FIFO
+ * from now on, and the first that matters asks the host to wake up. See
+ * USBMIDI_WakeCheck().
  */
 void HandleSuspend(void *pvMidiDevice)
 {
+#if USBMIDI_REMOTE_WAKEUP
+	tUSBMidiInstance *psInst;
+
+	psInst = &((tUSBMidiDevice *) pvMidiDevice)->sPrivateData;
+	psInst->ui32SuspendSOF = g_ui32USBSOFCount;
+	psInst->bSuspended = true;
+#endif
 	MAP_GPIOPinWrite(LED_PORT, LED_LED1, 0);
 }
 
 /**
- * Called when bus is resumed.
+ * Called when bus is resumed: by the USB library when the host resumes it, or by
+ * USBMIDI_IntHandler() at the first SOF after our remote wakeup signalling. The
+ * resume is timed from then, since the bus is running again.
+ *
+ * With USBMIDI_REMOTE_WAKEUP, what waited during suspend goes now. There were no
+ * SOFs to reach its flush deadline, so the deadline is moved to now.
  */
 void HandleResume(void *pvMidiDevice)
 {
+#if USBMIDI_REMOTE_WAKEUP
+	tUSBMidiInstance *psInst;
+
+	psInst = &((tUSBMidiDevice *) pvMidiDevice)->sPrivateData;
+	psInst->bSuspended = false;
+	if( psInst->bWakePulse )
+	{
+		// the host took over before our pulse was done.
+		MAP_USBHostResume(USB0_BASE, false);
+		psInst->bWakePulse = false;
+	}
+	if( psInst->bWakeRequested )
+		psInst->ui32ResumeTick = g_ui32SysTickCount;
+
+	if( psInst->bInFlushArmed )
+		psInst->ui32InFlushFrame = g_ui32USBSOFCount;
+	USBMIDI_InEpSendMessages();
+#endif
 	MAP_GPIOPinWrite(LED_PORT, LED_LED1, LED_LED1);
 }
 
@@ -12,14 +12,20 @@
 #include <stdbool.h>
 
 #include "usblib/device/usbdevice.h"
+#include "usbmidi_types.h"
 
 
 
 void HandleRequests(void *pvMidiDevice, tUSBRequest *pUSBRequest);
+void HandleGetDescriptor(void *pvMidiDevice, tUSBRequest *pUSBRequest);
+void HandleInterfaceChange(void *pvMidiDevice, uint8_t ui8InterfaceNum, uint8_t ui8AlternateSetting);
 void HandleConfigChange(void *pvMidiDevice, uint32_t ui32Info);
-//void HandleEP0Data(void *pvMidiDevice, uint32_t ui32DataSize);
+void HandleEP0Data(void *pvMidiDevice, uint32_t ui32DataSize);
 void HandleDisconnect(void *pvMidiDevice);
 void HandleEndpoints(void *pvMidiDevice, uint32_t ui32Status);
+bool HandleOutPacket(tUSBMidiDevice *psUsbMidiDevice);
+void HandleOutPackets(tUSBMidiDevice *psUsbMidiDevice);
+void HandleRawPackets(tUSBMidiDevice *psUsbMidiDevice);
 void HandleSuspend(void *pvMidiDevice);
 void HandleResume(void *pvMidiDevice);
 // static void HandleDevice(void *pvMidiDevice)
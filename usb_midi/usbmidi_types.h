@@ -13,6 +13,8 @@
 #include "usblib/usblib.h"
 #include "usblib/device/usbdevice.h"
 #include "usb_midi_fifo.h"
+#include "usbmidi_ump.h"
+#include "pconfig.h"
 
 
 /**
@@ -21,6 +23,29 @@
  */
 #define USB_BUFFER_SIZE (256)
 
+/**
+ * Bulk endpoint max packet size, and how many four-byte USB-MIDI event packets
+ * fit in one.
+ */
+#define USBMIDI_EP_PACKET_SIZE (64)
+#define USBMIDI_EVENTS_PER_PACKET (USBMIDI_EP_PACKET_SIZE / 4)
+
+/**
+ * The packet size we tell the USB DMA code. Every transfer is one packet or less,
+ * and the DMA code uses DMA mode 1 for a transfer of this size or more. So this is
+ * bigger than a packet, to keep every transfer in mode 0, in which the endpoint
+ * interrupts work as they do without DMA.
+ */
+#define USBMIDI_DMA_MODE0_SIZE (USBMIDI_EP_PACKET_SIZE + 4)
+
+/**
+ * With USBMIDI_DOUBLE_BUFFER, where EP1's two-packet FIFOs go in the USB
+ * controller's 4 KB of FIFO RAM: at the very top.
+ */
+#define USBMIDI_USB_FIFO_RAM_SIZE (4096)
+#define USBMIDI_EP1_OUT_FIFO_ADDR (USBMIDI_USB_FIFO_RAM_SIZE - (2 * USBMIDI_EP_PACKET_SIZE))
+#define USBMIDI_EP1_IN_FIFO_ADDR (USBMIDI_EP1_OUT_FIFO_ADDR - (2 * USBMIDI_EP_PACKET_SIZE))
+
 /**
  * status of the two directions.
  */
@@ -49,11 +74,95 @@ typedef struct
 	// state of transmit channel
 	volatile tUSBMidiState iUSBMidiTxState;
 
+	// true while messages wait in the IN endpoint FIFO for a partial packet to go.
+	volatile bool bInFlushArmed;
+
+	// g_ui32USBSOFCount at which that partial packet is sent.
+	volatile uint32_t ui32InFlushFrame;
+
+#if USBMIDI_DMA
+	// the USB controller's DMA, and its channel for the IN endpoint.
+	tUSBDMAInstance *psDMAInstance;
+	uint32_t ui32INDMA;
+
+	// how many messages the channel is moving, 0 when idle.
+	volatile uint32_t ui32INDMACount;
+#endif
+
+	// bytes of the OUT packet still to be read from the endpoint FIFO.
+	uint32_t ui32OutPktLeft;
+
+	// words read from the OUT packet that wait for room in their cable's queue, in
+	// the order they came, and a bit for each cable that has words in there.
+	uint32_t pui32OutHeld[USBMIDI_EVENTS_PER_PACKET];
+	uint32_t ui32OutHeldCount;
+	uint32_t ui32OutHeldCables;
+
+#if USBMIDI_VENDOR
+	// bytes of the vendor OUT packet still to be read from the endpoint FIFO.
+	uint32_t ui32RawPktLeft;
+
+	// true while that packet waits for room in the DIN port's transmit FIFO.
+	volatile bool bRawHeld;
+
+	// cable number of the DIN port the vendor OUT endpoint's bytes go to.
+	uint8_t ui8RawCable;
+#endif
+
+#if USBMIDI_UMP
+	// the MS interface's alternate setting, USBMIDI_ALT_MIDI1 or USBMIDI_ALT_UMP.
+	volatile uint8_t ui8AltSetting;
+
+	// translation between event packets and UMP, on USBMIDI_ALT_UMP.
+	USBMIDI_UMPState_t sUMP;
+#endif
+
 	// device connection status.
 	volatile bool bConnected;
 
+#if USBMIDI_REMOTE_WAKEUP
+	// true while the bus is suspended.
+	volatile bool bSuspended;
+
+	// g_ui32USBSOFCount when the bus was suspended. A SOF after that means it is
+	// running again.
+	uint32_t ui32SuspendSOF;
+
+	// true from our remote wakeup request until the first packet after it goes.
+	volatile bool bWakeRequested;
+
+	// true while we drive resume signalling on the bus.
+	volatile bool bWakePulse;
+
+	// true when the times below are ready for USBMIDI_WakeReport().
+	volatile bool bWakeReport;
+
+	// g_ui32SysTickCount at the request, at resume, and when that packet went.
+	uint32_t ui32WakeTick;
+	uint32_t ui32ResumeTick;
+	uint32_t ui32FirstEventTick;
+#endif
+
 } tUSBMidiInstance;
 
+#if USBMIDI_REMOTE_WAKEUP
+/**
+ * main.c's SysTick count, in milliseconds. SOFs stop during suspend, so the wakeup
+ * is timed with this instead of g_ui32USBSOFCount.
+ */
+extern volatile uint32_t g_ui32SysTickCount;
+#endif
+
+/**
+ * True when the MIDI endpoints carry event packets as they sit in the FIFOs, so
+ * the DMA can move them as they are. On USBMIDI_ALT_UMP they are translated.
+ */
+#if USBMIDI_UMP
+#define USBMIDI_EP_RAW(psInst) (USBMIDI_ALT_MIDI1 == (psInst)->ui8AltSetting)
+#else
+#define USBMIDI_EP_RAW(psInst) (true)
+#endif
+
 /**
  * This is the "device structure."
  * Its main purpose is to hold the USB Buffer callback functions and data.
@@ -62,7 +171,7 @@ typedef struct
 typedef struct
 {
 	USBMIDIFIFO_t InEpMsgFifo;
-	USBMIDIFIFO_t OutEpMsgFifo;
+	USBMIDIFIFO_t OutCableFifo[USBMIDI_NUM_CABLES_OUT];	// OUT endpoint messages, a queue per cable
 	tUSBMidiInstance sPrivateData;
 
 } tUSBMidiDevice;
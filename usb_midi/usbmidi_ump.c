@@ -0,0 +1,377 @@
+/*
+ * usbmidi_ump.c
+ *
+ *  Created on: Aug 18, 2020
+ *      Author: andy
+ *
+ * Translate between USB-MIDI 1.0 event packets and Universal MIDI Packets.
+ * See usbmidi_ump.h.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "usb_midi.h"
+#include "midi.h"
+#include "usbmidi_ump.h"
+
+/**
+ * Forget everything half done.
+ */
+void USBMIDI_UMPInit(USBMIDI_UMPState_t *st)
+{
+	memset(st, 0, sizeof(*st));
+}
+
+/*****************************************************************************
+ * From the host: UMP to event packets.
+ *****************************************************************************/
+
+/**
+ * Fill in an event packet.
+ */
+static void UMP_Event(USBMIDI_Message_t *ev, uint8_t cable, uint8_t cin,
+		uint8_t b1, uint8_t b2, uint8_t b3)
+{
+	ev->header = USB_MIDI_HEADER(cable, cin);
+	ev->byte1 = b1;
+	ev->byte2 = b2;
+	ev->byte3 = b3;
+}
+
+/**
+ * Add one byte to a group's SysEx. Three bytes make a start/continue event packet,
+ * and EOX ends the SysEx with a packet of one, two or three bytes.
+ * \returns how many event packets were made, 0 or 1.
+ */
+static uint32_t UMP_SysExByte(USBMIDI_UMPState_t *st, uint8_t group, uint8_t b, USBMIDI_Message_t *ev)
+{
+	uint8_t *sx = st->outsx[group];
+	uint8_t cnt;
+
+	cnt = st->outsxcnt[group];
+	sx[cnt++] = b;
+
+	if( MIDI_MSG_EOX == b )
+	{
+		// CIN 5, 6 or 7 for one, two or three bytes.
+		UMP_Event(ev, group, USB_MIDI_CIN_SYSEND1 + cnt - 1, sx[0],
+				(cnt > 1) ? sx[1] : 0, (cnt > 2) ? sx[2] : 0);
+		st->outsxcnt[group] = 0;
+		return 1;
+	}
+
+	if( 3 == cnt )
+	{
+		UMP_Event(ev, group, USB_MIDI_CIN_SYSEXSTART, sx[0], sx[1], sx[2]);
+		st->outsxcnt[group] = 0;
+		return 1;
+	}
+
+	st->outsxcnt[group] = cnt;
+	return 0;
+}
+
+/**
+ * A 7-bit SysEx UMP. Its bytes are put between F0 and F7 as its status says, and
+ * cut into event packets.
+ */
+static uint32_t UMP_SysEx7ToEvents(USBMIDI_UMPState_t *st, const uint32_t *ump, USBMIDI_Message_t *events)
+{
+	uint8_t group = (ump[0] >> 24) & 0x0F;
+	uint8_t status = (ump[0] >> 20) & 0x0F;
+	uint8_t nbytes = (ump[0] >> 16) & 0x0F;
+	uint8_t bytes[UMP_SYSEX7_MAX];
+	uint32_t n = 0;
+	uint32_t i;
+
+	if( nbytes > UMP_SYSEX7_MAX )
+		nbytes = UMP_SYSEX7_MAX;
+
+	bytes[0] = (ump[0] >> 8) & 0x7F;
+	bytes[1] = ump[0] & 0x7F;
+	bytes[2] = (ump[1] >> 24) & 0x7F;
+	bytes[3] = (ump[1] >> 16) & 0x7F;
+	bytes[4] = (ump[1] >> 8) & 0x7F;
+	bytes[5] = ump[1] & 0x7F;
+
+	if( (UMP_SYSEX_COMPLETE == status) || (UMP_SYSEX_START == status) )
+	{
+		// a new SysEx. Anything left of an unfinished one is dropped.
+		st->outsxcnt[group] = 0;
+		n += UMP_SysExByte(st, group, MIDI_MSG_SOX, &events[n]);
+	}
+
+	for( i = 0; i < nbytes; i++ )
+		n += UMP_SysExByte(st, group, bytes[i], &events[n]);
+
+	if( (UMP_SYSEX_COMPLETE == status) || (UMP_SYSEX_END == status) )
+		n += UMP_SysExByte(st, group, MIDI_MSG_EOX, &events[n]);
+
+	return n;
+}
+
+/**
+ * A MIDI 2.0 channel voice UMP, scaled down to MIDI 1.0 the way the UMP spec
+ * does it: the top bits of each value. Registered and assignable controllers
+ * become the RPN or NRPN controller messages, and a program change with a bank
+ * becomes bank select and then the program change. Per-note controllers,
+ * per-note pitch bend, relative controllers and per-note management have no
+ * MIDI 1.0 message, and are dropped.
+ */
+static uint32_t UMP_MIDI2ToEvents(const uint32_t *ump, USBMIDI_Message_t *events)
+{
+	uint8_t group = (ump[0] >> 24) & 0x0F;
+	uint8_t opcode = (ump[0] >> 20) & 0x0F;
+	uint8_t chan = (ump[0] >> 16) & 0x0F;
+	uint8_t idx1 = (ump[0] >> 8) & 0x7F;
+	uint8_t idx2 = ump[0] & 0x7F;
+	uint32_t data = ump[1];
+	uint8_t cc = MIDI_MSG_CTRLCHANGE | chan;
+	uint8_t vel;
+	uint32_t n = 0;
+
+	switch( opcode )
+	{
+	case 0x8:
+		UMP_Event(&events[n++], group, USB_MIDI_CIN_NOTEOFF, MIDI_MSG_NOTEOFF | chan, idx1, data >> 25);
+		break;
+
+	case 0x9:
+		// Velocity 0 is a note off in MIDI 1.0 but not in MIDI 2.0.
+		vel = data >> 25;
+		if( 0 == vel )
+			vel = 1;
+		UMP_Event(&events[n++], group, USB_MIDI_CIN_NOTEON, MIDI_MSG_NOTEON | chan, idx1, vel);
+		break;
+
+	case 0xA:
+		UMP_Event(&events[n++], group, USB_MIDI_CIN_POLYKEYPRESS, MIDI_MSG_POLYPRESSURE | chan, idx1, data >> 25);
+		break;
+
+	case 0xB:
+		UMP_Event(&events[n++], group, USB_MIDI_CIN_CTRLCHANGE, cc, idx1, data >> 25);
+		break;
+
+	case 0x2:	// registered controller, bank and index are the RPN
+	case 0x3:	// assignable controller, the NRPN
+		UMP_Event(&events[n++], group, USB_MIDI_CIN_CTRLCHANGE, cc,
+				(0x2 == opcode) ? MIDI_CC_RPN_MSB : MIDI_CC_NRPN_MSB, idx1);
+		UMP_Event(&events[n++], group, USB_MIDI_CIN_CTRLCHANGE, cc,
+				(0x2 == opcode) ? MIDI_CC_RPN_LSB : MIDI_CC_NRPN_LSB, idx2);
+		UMP_Event(&events[n++], group, USB_MIDI_CIN_CTRLCHANGE, cc, MIDI_CC_DATAENTRY_MSB, (data >> 25) & 0x7F);
+		UMP_Event(&events[n++], group, USB_MIDI_CIN_CTRLCHANGE, cc, MIDI_CC_DATAENTRY_LSB, (data >> 18) & 0x7F);
+		break;
+
+	case 0xC:
+		// bit 0 of the option flags says the bank is good.
+		if( ump[0] & 0x01 )
+		{
+			UMP_Event(&events[n++], group, USB_MIDI_CIN_CTRLCHANGE, cc, MIDI_CC_BANKSELECT_MSB, (data >> 8) & 0x7F);
+			UMP_Event(&events[n++], group, USB_MIDI_CIN_CTRLCHANGE, cc, MIDI_CC_BANKSELECT_LSB, data & 0x7F);
+		}
+		UMP_Event(&events[n++], group, USB_MIDI_CIN_PROGCHANGE, MIDI_MSG_PROGCHANGE | chan, (data >> 24) & 0x7F, 0);
+		break;
+
+	case 0xD:
+		UMP_Event(&events[n++], group, USB_MIDI_CIN_CHANPRESSURE, MIDI_MSG_CHANNELPRESSURE | chan, data >> 25, 0);
+		break;
+
+	case 0xE:
+		// 14 bits, LSB first.
+		UMP_Event(&events[n++], group, USB_MIDI_CIN_PITCHBEND, MIDI_MSG_PITCHBEND | chan,
+				(data >> 18) & 0x7F, (data >> 25) & 0x7F);
+		break;
+
+	default:
+		break;
+	}
+
+	return n;
+}
+
+/**
+ * A system UMP: System Common and Real Time messages, as they are.
+ */
+static uint32_t UMP_SystemToEvents(uint32_t word, USBMIDI_Message_t *events)
+{
+	static const uint8_t cin[16] = {
+		0, USB_MIDI_CIN_SYSCOM2, USB_MIDI_CIN_SYSCOM3, USB_MIDI_CIN_SYSCOM2,		// F0 - F3
+		0, 0, USB_MIDI_CIN_SYSEND1, 0,												// F4 - F7
+		USB_MIDI_CIN_SINGLEBYTE, 0, USB_MIDI_CIN_SINGLEBYTE, USB_MIDI_CIN_SINGLEBYTE,	// F8 - FB
+		USB_MIDI_CIN_SINGLEBYTE, 0, USB_MIDI_CIN_SINGLEBYTE, USB_MIDI_CIN_SINGLEBYTE	// FC - FF
+	};
+	uint8_t group = (word >> 24) & 0x0F;
+	uint8_t status = (word >> 16) & 0xFF;
+	uint8_t c;
+
+	if( status < 0xF0 )
+		return 0;
+	c = cin[status & 0x0F];
+	if( 0 == c )
+		return 0;
+
+	UMP_Event(events, group, c, status,
+			(c == USB_MIDI_CIN_SYSCOM2 || c == USB_MIDI_CIN_SYSCOM3) ? ((word >> 8) & 0x7F) : 0,
+			(c == USB_MIDI_CIN_SYSCOM3) ? (word & 0x7F) : 0);
+	return 1;
+}
+
+/**
+ * Gather the words of a UMP, and translate it when it's all in.
+ */
+uint32_t USBMIDI_UMPToEvents(USBMIDI_UMPState_t *st, uint32_t word, USBMIDI_Message_t *events)
+{
+	const uint32_t *ump = st->outump;
+	uint8_t status;
+
+	st->outump[st->outwords++] = word;
+	if( st->outwords < UMP_Words(st->outump[0]) )
+		return 0;
+	st->outwords = 0;
+
+	switch( ump[0] >> 28 )
+	{
+	case UMP_MT_SYSTEM:
+		return UMP_SystemToEvents(ump[0], events);
+
+	case UMP_MT_MIDI1_CV:
+		// already MIDI 1.0, the CIN is the status nybble.
+		status = (ump[0] >> 16) & 0xFF;
+		if( (status < 0x80) || (status >= 0xF0) )
+			return 0;
+		UMP_Event(events, (ump[0] >> 24) & 0x0F, status >> 4, status, (ump[0] >> 8) & 0x7F, ump[0] & 0x7F);
+		return 1;
+
+	case UMP_MT_SYSEX7:
+		return UMP_SysEx7ToEvents(st, ump, events);
+
+	case UMP_MT_MIDI2_CV:
+		return UMP_MIDI2ToEvents(ump, events);
+
+	default:
+		// utility (NOOP, timestamps), 8-bit SysEx, stream messages.
+		return 0;
+	}
+}
+
+/*****************************************************************************
+ * To the host: event packets to UMP.
+ *****************************************************************************/
+
+/**
+ * Make a 7-bit SysEx UMP from the bytes gathered for a cable.
+ * \returns 2, the number of words.
+ */
+static uint32_t UMP_SysEx7(USBMIDI_UMPState_t *st, uint8_t cable, uint8_t status, uint32_t *words)
+{
+	uint8_t b[UMP_SYSEX7_MAX];
+	uint8_t cnt = st->insxcnt[cable];
+
+	memset(b, 0, sizeof(b));
+	memcpy(b, st->insx[cable], cnt);
+
+	words[0] = UMP_WORD(UMP_MT_SYSEX7, cable, (status << 4) | cnt, b[0], b[1]);
+	words[1] = ((uint32_t) b[2] << 24) | ((uint32_t) b[3] << 16) | ((uint32_t) b[4] << 8) | b[5];
+
+	st->insxcnt[cable] = 0;
+	return 2;
+}
+
+/**
+ * Add one byte to a cable's SysEx. A UMP goes as soon as it has six bytes, and
+ * EOX sends whatever is left, maybe nothing, as the end.
+ * \returns how many words were made.
+ */
+static uint32_t UMP_SysExFromByte(USBMIDI_UMPState_t *st, uint8_t cable, uint8_t b, uint32_t *words)
+{
+	uint16_t bit = 1 << cable;
+	uint8_t status;
+
+	if( MIDI_MSG_SOX == b )
+	{
+		st->insxon |= bit;
+		st->insxstarted &= ~bit;
+		st->insxcnt[cable] = 0;
+		return 0;
+	}
+
+	if( !(st->insxon & bit) )
+		return 0;
+
+	if( MIDI_MSG_EOX == b )
+	{
+		status = (st->insxstarted & bit) ? UMP_SYSEX_END : UMP_SYSEX_COMPLETE;
+		st->insxon &= ~bit;
+		return UMP_SysEx7(st, cable, status, words);
+	}
+
+	st->insx[cable][st->insxcnt[cable]++] = b & 0x7F;
+	if( UMP_SYSEX7_MAX == st->insxcnt[cable] )
+	{
+		status = (st->insxstarted & bit) ? UMP_SYSEX_CONTINUE : UMP_SYSEX_START;
+		st->insxstarted |= bit;
+		return UMP_SysEx7(st, cable, status, words);
+	}
+
+	return 0;
+}
+
+/**
+ * Translate an event packet for the host. Channel voice messages go as MIDI 1.0
+ * channel voice UMPs, System Common and Real Time as system UMPs, and SysEx
+ * bytes are gathered into 7-bit SysEx UMPs.
+ */
+uint32_t USBMIDI_UMPFromEvent(USBMIDI_UMPState_t *st, const USBMIDI_Message_t *msg, uint32_t *words)
+{
+	uint8_t cable = USB_MIDI_CABLE_NUMBER(msg->header) & 0x0F;
+	uint8_t cin = USB_MIDI_CODE_INDEX_NUMBER(msg->header);
+	uint32_t n = 0;
+
+	switch( cin )
+	{
+	case USB_MIDI_CIN_NOTEOFF:
+	case USB_MIDI_CIN_NOTEON:
+	case USB_MIDI_CIN_POLYKEYPRESS:
+	case USB_MIDI_CIN_CTRLCHANGE:
+	case USB_MIDI_CIN_PROGCHANGE:
+	case USB_MIDI_CIN_CHANPRESSURE:
+	case USB_MIDI_CIN_PITCHBEND:
+		words[n++] = UMP_WORD(UMP_MT_MIDI1_CV, cable, msg->byte1, msg->byte2, msg->byte3);
+		break;
+
+	case USB_MIDI_CIN_SYSCOM2:
+	case USB_MIDI_CIN_SYSCOM3:
+		words[n++] = UMP_WORD(UMP_MT_SYSTEM, cable, msg->byte1, msg->byte2, msg->byte3);
+		break;
+
+	case USB_MIDI_CIN_SYSEND1:
+	case USB_MIDI_CIN_SINGLEBYTE:
+		// a one-byte system message, or the EOX ending a SysEx.
+		if( MIDI_MSG_EOX == msg->byte1 )
+			n += UMP_SysExFromByte(st, cable, msg->byte1, &words[n]);
+		else if( msg->byte1 > MIDI_MSG_EOX )
+			words[n++] = UMP_WORD(UMP_MT_SYSTEM, cable, msg->byte1, 0, 0);
+		else if( USB_MIDI_CIN_SINGLEBYTE == cin )
+			n += UMP_SysExFromByte(st, cable, msg->byte1, &words[n]);
+		break;
+
+	case USB_MIDI_CIN_SYSEND3:
+	case USB_MIDI_CIN_SYSEXSTART:
+		n += UMP_SysExFromByte(st, cable, msg->byte1, &words[n]);
+		n += UMP_SysExFromByte(st, cable, msg->byte2, &words[n]);
+		n += UMP_SysExFromByte(st, cable, msg->byte3, &words[n]);
+		break;
+
+	case USB_MIDI_CIN_SYSEND2:
+		n += UMP_SysExFromByte(st, cable, msg->byte1, &words[n]);
+		n += UMP_SysExFromByte(st, cable, msg->byte2, &words[n]);
+		break;
+
+	default:
+		break;
+	}
+
+	return n;
+}
@@ -0,0 +1,120 @@
+/*
+ * usbmidi_ump.h
+ *
+ *  Created on: Aug 18, 2020
+ *      Author: andy
+ *
+ * Translation between USB-MIDI 1.0 event packets and USB MIDI 2.0 Universal MIDI
+ * Packets (UMP), for alternate setting 1 of the MIDI Streaming interface.
+ *
+ * The rest of the firmware only ever sees event packets. On alternate setting 1,
+ * the OUT endpoint's UMPs are turned into event packets as they are read, and the
+ * event packets written for the host are turned into UMPs as they are queued. A
+ * UMP group is the cable number of the event packets.
+ *
+ * Our group terminal blocks are DIN ports, so they say MIDI 1.0 protocol, and the
+ * UMPs we send are the MIDI 1.0 ones: message types 1 (system), 2 (MIDI 1.0 channel
+ * voice) and 3 (7-bit SysEx). The host may still send MIDI 2.0 channel voice
+ * messages (type 4), and those are scaled down to MIDI 1.0 as the UMP spec says.
+ * Anything else is dropped.
+ *
+ * UMP words go on the wire least significant byte first, as they sit in our
+ * (little-endian) memory, so a word is kept in the message FIFOs as a uint32_t.
+ */
+
+#ifndef USB_MIDI_USBMIDI_UMP_H_
+#define USB_MIDI_USBMIDI_UMP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "usb_midi.h"
+
+/**
+ * UMP message types, the top nybble of the first word.
+ */
+#define UMP_MT_UTILITY		0x0
+#define UMP_MT_SYSTEM		0x1
+#define UMP_MT_MIDI1_CV		0x2
+#define UMP_MT_SYSEX7		0x3
+#define UMP_MT_MIDI2_CV		0x4
+#define UMP_MT_DATA128		0x5
+
+/**
+ * 7-bit SysEx status, bits 23:20 of the first word.
+ */
+#define UMP_SYSEX_COMPLETE	0x0
+#define UMP_SYSEX_START		0x1
+#define UMP_SYSEX_CONTINUE	0x2
+#define UMP_SYSEX_END		0x3
+
+/**
+ * Most 7-bit SysEx bytes in one UMP.
+ */
+#define UMP_SYSEX7_MAX		6
+
+/**
+ * Most words made from one event packet, and most event packets made from one
+ * UMP. No UMP makes more than two event packets for each of its words, so a run
+ * of n words, counting any already gathered, makes 2n event packets at most.
+ */
+#define UMP_WORDS_PER_EVENT_MAX	4
+#define UMP_EVENTS_PER_UMP_MAX	4
+#define UMP_EVENTS_PER_WORD_MAX	2
+
+/**
+ * Make the first word of a UMP.
+ */
+#define UMP_WORD(mt, group, b1, b2, b3) \
+	(((uint32_t) (mt) << 28) | ((uint32_t) (group) << 24) | \
+	 ((uint32_t) (b1) << 16) | ((uint32_t) (b2) << 8) | (uint32_t) (b3))
+
+/**
+ * How many 32-bit words are in a UMP, from its first word.
+ */
+static inline uint32_t UMP_Words(uint32_t word0)
+{
+	static const uint8_t words[16] = { 1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4 };
+
+	return words[word0 >> 28];
+}
+
+/**
+ * Translation state, per direction.
+ */
+typedef struct
+{
+	/* From the host. */
+	uint32_t outump[4];			//!< the UMP being gathered
+	uint8_t outwords;			//!< how many of its words are in
+	uint8_t outsx[16][3];		//!< per group, SysEx bytes for the next event packet
+	uint8_t outsxcnt[16];		//!< and how many
+
+	/* To the host. */
+	uint8_t insx[16][UMP_SYSEX7_MAX];	//!< per cable, SysEx bytes for the next UMP
+	uint8_t insxcnt[16];		//!< and how many
+	uint16_t insxon;			//!< bit per cable: inside a SysEx
+	uint16_t insxstarted;		//!< bit per cable: a START has gone for that SysEx
+} USBMIDI_UMPState_t;
+
+/**
+ * Forget everything half done, as when the alternate setting changes.
+ */
+void USBMIDI_UMPInit(USBMIDI_UMPState_t *st);
+
+/**
+ * Take the next UMP word from the host. When it finishes a UMP, that UMP is
+ * translated.
+ * \param[out] events: gets the event packets, UMP_EVENTS_PER_UMP_MAX at most.
+ * \returns how many event packets were made, often 0.
+ */
+uint32_t USBMIDI_UMPToEvents(USBMIDI_UMPState_t *st, uint32_t word, USBMIDI_Message_t *events);
+
+/**
+ * Translate an event packet for the host.
+ * \param[out] words: gets the UMP words, UMP_WORDS_PER_EVENT_MAX at most.
+ * \returns how many words were made, 0 for an event with no UMP.
+ */
+uint32_t USBMIDI_UMPFromEvent(USBMIDI_UMPState_t *st, const USBMIDI_Message_t *msg, uint32_t *words);
+
+#endif /* USB_MIDI_USBMIDI_UMP_H_ */